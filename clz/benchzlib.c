@@ -0,0 +1,92 @@
+/*
+ *  benchzlib - System zlib comparison for clz_bench
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/* This lives in its own file as zlib.h and crc32.h both declare a
+   crc32() and they don't agree on the types. */
+
+#include <stdlib.h>
+
+#ifdef CLZ_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+
+#define BZ_OUTBUF_SIZE      256 * 1024
+
+
+
+
+/*
+ *  benchzlib_available() - Was clz_bench built with zlib?
+ *
+ *  Returns: 1 if so, 0 if not
+ */
+
+int benchzlib_available(void)
+{
+#ifdef CLZ_HAVE_ZLIB
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+
+
+/*
+ *  benchzlib_inflate(inbuf, inlen, outlenp) - Inflate a raw deflate stream
+ *
+ *  Output is thrown away (much as clz_bench does with clz) but the
+ *  total is placed in *outlenp so the caller can sanity check it.
+ *
+ *  Returns: 1 on success, 0 on error or if zlib isn't available
+ */
+
+int benchzlib_inflate(const void *inbuf, size_t inlen, size_t *outlenp)
+{
+#ifdef CLZ_HAVE_ZLIB
+    static unsigned char *outbuf;
+    z_stream zs;
+    int ret;
+
+    if (!outbuf && (outbuf = malloc(BZ_OUTBUF_SIZE)) == NULL)
+        return 0;
+
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef *)inbuf;
+    zs.avail_in = inlen;
+
+    if (inflateInit2(&zs, -15) != Z_OK)     /* Raw deflate, 32K window */
+        return 0;
+
+    do {
+        zs.next_out = outbuf;
+        zs.avail_out = BZ_OUTBUF_SIZE;
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+
+    } while (ret == Z_OK);
+
+    *outlenp = zs.total_out;
+    inflateEnd(&zs);
+
+    return ret == Z_STREAM_END;
+#else
+    (void)inbuf;
+    (void)inlen;
+    (void)outlenp;
+    return 0;
+#endif
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
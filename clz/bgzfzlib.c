@@ -0,0 +1,94 @@
+/*
+ *  bgzfzlib - System zlib deflate for clz_bgzf
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/* This lives in its own file as zlib.h and crc32.h both declare a
+   crc32() and they don't agree on the types. */
+
+#include <stdlib.h>
+#include <zlib.h>
+
+
+
+
+/*
+ *  bgzfz_create(level) - Create a raw deflate compressor
+ *
+ *  One per thread, reused for every block.
+ *
+ *  Returns: pointer to the compressor, or NULL on error
+ */
+
+void *bgzfz_create(int level)
+{
+    z_stream *zs;
+
+    if ((zs = calloc(1, sizeof(z_stream))) == NULL)
+        return NULL;
+
+    /* Raw deflate, 32K window, default memory and strategy */
+
+    if (deflateInit2(zs, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        free(zs);
+        return NULL;
+    }
+
+    return zs;
+}
+
+
+
+
+/*
+ *  bgzfz_compress(zptr, in, inlen, out, outmax, outlenp) - Deflate a block
+ *
+ *  Compresses all of in as one complete raw deflate stream.
+ *
+ *  Returns: 1 on success, 0 on error or if it won't fit in outmax
+ */
+
+int bgzfz_compress(void *zptr, const void *in, size_t inlen,
+                   void *out, size_t outmax, size_t *outlenp)
+{
+    z_stream *zs = (z_stream *)zptr;
+    int ret;
+
+    if (deflateReset(zs) != Z_OK)
+        return 0;
+
+    zs->next_in = (Bytef *)in;
+    zs->avail_in = inlen;
+    zs->next_out = out;
+    zs->avail_out = outmax;
+
+    ret = deflate(zs, Z_FINISH);
+
+    *outlenp = zs->total_out;
+    return ret == Z_STREAM_END;
+}
+
+
+
+
+/*
+ *  bgzfz_destroy(zptr) - Free a compressor
+ */
+
+void bgzfz_destroy(void *zptr)
+{
+    if (zptr)
+    {
+        deflateEnd((z_stream *)zptr);
+        free(zptr);
+    }
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
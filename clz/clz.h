@@ -7,6 +7,9 @@
  *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
  */
 
+#ifndef CLZ_CLZ_H_
+#define CLZ_CLZ_H_
+
 #define clz_destroy(ptr)                \
     do {                                \
         if (ptr)                        \
@@ -14,6 +17,9 @@
         ptr = 0;                        \
     } while(0)
 
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 extern void *clz_create(void);
 
@@ -25,6 +31,134 @@ extern int clz_setcb_put(void *aptr, size_t (*putfn)(void *, void *, size_t),
 
 extern void clz_destroy_direct(void *aptr);
 extern int clz_decompress(void *aptr, int *cbusedp, unsigned int *crc32p);
+extern int clz_verify(void *aptr, size_t *outsizep, unsigned int *crc32p);
+
+extern int clz_setlimit(void *aptr, size_t outmax);
+extern int clz_suspended(void *aptr);
+extern int clz_pause(void *aptr);
+extern int clz_reset(void *aptr);
+extern int clz_set_ringsize(void *aptr, size_t size);
+
+extern int clz_set_checkpoint(void *aptr, size_t every);
+extern size_t clz_save_state(void *aptr, void *buf, size_t buflen);
+extern int clz_load_state(void *aptr, const void *buf, size_t buflen,
+                          size_t *inoffsetp);
+
+
+/*
+ *  Totals for a stream, from clz_get_result(). These are 64 bit where
+ *  clz_decompress() can only return up to INT_MAX.
+ */
+
+typedef struct
+{
+    unsigned long long bytes_in;        /* Input consumed */
+    unsigned long long bytes_out;       /* Output written */
+    unsigned int crc32;                 /* CRC32 of the output */
+    int suspended;                      /* As per clz_suspended() */
+
+} clz_result;
+
+extern int clz_get_result(void *aptr, clz_result *resultp);
+extern int clz_set_progress(void *aptr, size_t every,
+                            int (*progfn)(void *, unsigned long long,
+                                          unsigned long long, double),
+                            void *progpar);
+
+extern const char *clz_get_kernel(void *aptr);
+extern int clz_set_kernel(void *aptr, const char *name);
+
+
+extern void *clz_htcache_create(int nentries);
+extern int clz_set_htcache(void *aptr, void *cptr);
+extern void clz_htcache_destroy(void *cptr);
+
+extern void *clz_sink_create(int fd);
+extern size_t clz_sink_put(void *sinkp, void *buf, size_t nbytes);
+extern int clz_sink_flush(void *sinkp);
+extern void clz_sink_destroy(void *sinkp);
+
+#define CLZ_REC_LINES   0       /* Newline terminated records */
+#define CLZ_REC_LEN32   1       /* 32 bit little endian length, then data */
+
+extern void *clz_records_create(int format,
+                                int (*recfn)(void *, const void *, size_t),
+                                void *recpar);
+extern int clz_records_filter(void *recp, const void *needle, size_t nlen);
+extern size_t clz_records_put(void *recp, void *buf, size_t nbytes);
+extern int clz_records_finish(void *recp);
+extern void clz_records_destroy(void *recp);
+
+
+/*
+ *  A zip entry from clz_zip_next(). With bit 3 of flags set, the CRC and
+ *  sizes are in a data descriptor after the data and only filled in once
+ *  clz_zip_read() has read it.
+ */
+
+#define CLZ_ZIP_STORED      0
+#define CLZ_ZIP_DEFLATED    8
+
+typedef struct
+{
+    const char *name;                   /* Until the next clz_zip_next() */
+    int method;                         /* CLZ_ZIP_STORED or DEFLATED */
+    int flags;                          /* General purpose bit flags */
+    unsigned int crc32;
+    unsigned long long csize;           /* Compressed size */
+    unsigned long long usize;           /* Uncompressed size */
+
+} clz_zip_entry;
+
+extern void *clz_zip_create(void *fp);
+extern int clz_zip_next(void *zipp, clz_zip_entry *entryp);
+extern int clz_zip_read(void *zipp, size_t (*putfn)(void *, void *, size_t),
+                        void *putpar, clz_result *resultp);
+extern void clz_zip_destroy(void *zipp);
+
+/*
+ *  Per-stream decode statistics. Only collected if clzinflate.c is
+ *  compiled with CLZ_STATS defined, otherwise clz_get_stats() fails
+ *  with ENOSYS. Ticks are TSC cycles on x86, nanoseconds elsewhere.
+ */
+
+#define CLZ_STATS_SIZE_BUCKETS  24      /* log2 buckets, 1 byte to 8MB+ */
+
+typedef struct
+{
+    unsigned long blocks_stored;
+    unsigned long blocks_fixed;
+    unsigned long blocks_dynamic;
+
+    unsigned long long literals;
+    unsigned long long matches;
+    unsigned long long len_hist[29];    /* Matches by length code  */
+    unsigned long long dist_hist[30];   /* Matches by distance code */
+
+    unsigned long htcache_hits;         /* Dynamic trees not rebuilt */
+
+    unsigned long long ticks_build;     /* huff_build_dynamic()    */
+    unsigned long long ticks_inflate;   /* Block decode, less writes */
+    unsigned long long ticks_write;     /* slwin_write() callbacks */
+
+    /* Block sizes: histogram n is for sizes 2^n to 2^(n+1) - 1 */
+
+    unsigned long blk_in_hist[CLZ_STATS_SIZE_BUCKETS];
+    unsigned long blk_out_hist[CLZ_STATS_SIZE_BUCKETS];
+
+    unsigned long long in_stored, out_stored;
+    unsigned long long in_fixed, out_fixed;
+    unsigned long long in_dynamic, out_dynamic;
+
+} clz_stats;
+
+extern int clz_get_stats(void *aptr, clz_stats *statsp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* CLZ_CLZ_H_ */
 
 /* vi:set ts=4 sw=4 expandtab: */
 
@@ -0,0 +1,340 @@
+/*
+ *  clz.hpp - C++20 interface to clz, header only
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  clz::Inflater owns a clz state. Its inflate() is a coroutine that
+ *  yields the output a chunk at a time, each chunk a view straight into
+ *  the output ring (or the input, for stored blocks), so nothing is
+ *  copied and range-for just works:
+ *
+ *      clz::Inflater inf(1024 * 1024);
+ *
+ *      for (std::span<const std::byte> chunk : inf.inflate(input))
+ *          consume(chunk);
+ *
+ *  Decoding runs between iterations: the put callback hands its chunk
+ *  over and calls clz_pause(), so nothing more is decoded until the
+ *  loop asks for the next chunk. A chunk is only good until then. Link
+ *  with clzinflate.c and crc32.c as usual.
+ */
+
+#ifndef CLZ_CLZ_HPP_
+#define CLZ_CLZ_HPP_
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <span>
+#include <system_error>
+#include <utility>
+
+#include "clz.h"
+
+namespace clz {
+
+
+/*
+ *  Generator<T> - A coroutine yielding a sequence of T
+ *
+ *  A cut down std::generator (that's C++23): single pass, for range-for,
+ *  and each value is only good until the iterator moves on. An
+ *  exception thrown in the coroutine comes out of begin() or ++.
+ */
+
+template <typename T>
+class Generator
+{
+public:
+    struct promise_type
+    {
+        const T *value = nullptr;
+        std::exception_ptr error;
+
+        Generator get_return_object() noexcept
+        {
+            return Generator(
+                std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        std::suspend_always yield_value(const T &val) noexcept
+        {
+            value = std::addressof(val);
+            return {};
+        }
+
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept
+        {
+            error = std::current_exception();
+        }
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    class iterator
+    {
+    public:
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+
+        iterator() noexcept = default;
+        explicit iterator(handle h) noexcept : h_(h) {}
+
+        const T &operator*() const noexcept { return *h_.promise().value; }
+
+        iterator &operator++()
+        {
+            resume(h_);
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const noexcept
+        {
+            return !h_ || h_.done();
+        }
+
+    private:
+        handle h_;
+    };
+
+    Generator(Generator &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+
+    Generator &operator=(Generator &&other) noexcept
+    {
+        std::swap(h_, other.h_);
+        return *this;
+    }
+
+    Generator(const Generator &) = delete;
+    Generator &operator=(const Generator &) = delete;
+
+    ~Generator()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    iterator begin()
+    {
+        resume(h_);
+        return iterator(h_);
+    }
+
+    std::default_sentinel_t end() const noexcept { return {}; }
+
+private:
+    explicit Generator(handle h) noexcept : h_(h) {}
+
+    static void resume(handle h)
+    {
+        h.resume();
+
+        if (h.done() && h.promise().error)
+            std::rethrow_exception(std::exchange(h.promise().error, {}));
+    }
+
+    handle h_;
+};
+
+
+namespace detail {
+
+[[noreturn]] inline void throw_errno(const char *what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+
+/* Input from memory, a slice at a time, as usemem can only be an int */
+
+struct Slices
+{
+    const std::byte *p = nullptr;
+    std::size_t left = 0;
+
+    static std::size_t get(void *par, unsigned char **bufp) noexcept
+    {
+        auto *src = static_cast<Slices *>(par);
+        std::size_t n = src->left < (1u << 30) ? src->left : (1u << 30);
+
+        *bufp = reinterpret_cast<unsigned char *>(
+                                        const_cast<std::byte *>(src->p));
+        src->p += n;
+        src->left -= n;
+        return n;
+    }
+};
+
+
+/* The chunks put since the last pause. Usually one, the window can
+   be written out again on the way to the pause check */
+
+struct Chunks
+{
+    static constexpr int max = 4;
+
+    void *state;
+    std::span<const std::byte> spans[max];
+    int count = 0;
+
+    explicit Chunks(void *statep) noexcept : state(statep) {}
+
+    static std::size_t put(void *par, void *buf, std::size_t nbytes) noexcept
+    {
+        auto *chunks = static_cast<Chunks *>(par);
+
+        if (chunks->count == max)
+            return 0;
+
+        chunks->spans[chunks->count++] = {
+                        static_cast<const std::byte *>(buf), nbytes };
+        clz_pause(chunks->state);
+        return nbytes;
+    }
+};
+
+
+/* Abandons the stream if the generator goes before it's finished */
+
+struct Abandon
+{
+    void *state;
+
+    ~Abandon()
+    {
+        if (clz_suspended(state))
+            clz_reset(state);
+    }
+};
+
+}   // namespace detail
+
+
+/*
+ *  Inflater - Owns a clz state, one stream at a time
+ *
+ *  Move only. The Inflater must stay put, and outlive the generator,
+ *  while a stream is being read.
+ */
+
+class Inflater
+{
+public:
+    using Chunk = std::span<const std::byte>;
+
+    Inflater() : state_(clz_create())
+    {
+        if (state_ == nullptr)
+            throw std::bad_alloc();
+    }
+
+    /* Chunks are up to ringsize (32K by default) */
+
+    explicit Inflater(std::size_t ringsize) : Inflater()
+    {
+        if (!clz_set_ringsize(state_, ringsize))
+            detail::throw_errno("clz_set_ringsize");
+    }
+
+    ~Inflater()
+    {
+        clz_destroy(state_);
+    }
+
+    Inflater(Inflater &&other) noexcept
+        : state_(std::exchange(other.state_, nullptr)) {}
+
+    Inflater &operator=(Inflater &&other) noexcept
+    {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    Inflater(const Inflater &) = delete;
+    Inflater &operator=(const Inflater &) = delete;
+
+    /* For the rest of the C API: clz_set_kernel() and so on */
+
+    void *native() const noexcept { return state_; }
+
+    /* Raw deflate from memory. Stops at the end of the deflate data,
+       result().bytes_in says where that was */
+
+    Generator<Chunk> inflate(std::span<const std::byte> input)
+    {
+        detail::Slices src;
+
+        src.p = input.data();
+        src.left = input.size();
+        return run(state_, src, nullptr);
+    }
+
+    /* Raw deflate from fp, which is left just past the end of it */
+
+    Generator<Chunk> inflate(std::FILE *fp)
+    {
+        return run(state_, detail::Slices(), fp);
+    }
+
+    /* Totals and CRC32 for the last stream, once it's finished */
+
+    clz_result result() const
+    {
+        clz_result res;
+
+        if (!clz_get_result(state_, &res))
+            detail::throw_errno("clz_get_result");
+        return res;
+    }
+
+private:
+    /* src lives in the coroutine frame, so its address is good for the
+       whole stream */
+
+    static Generator<Chunk> run(void *state, detail::Slices src,
+                                std::FILE *fp)
+    {
+        detail::Chunks chunks(state);
+        detail::Abandon abandon{ state };
+
+        if (!(fp ? clz_setcb_get(state, nullptr, fp, 0)
+                 : clz_setcb_get(state, &detail::Slices::get, &src, 1)) ||
+            !clz_setcb_put(state, &detail::Chunks::put, &chunks))
+            detail::throw_errno("clz_setcb");
+
+        do {
+            chunks.count = 0;
+
+            if (!clz_decompress(state, nullptr, nullptr))
+                detail::throw_errno("clz_decompress");
+
+            for (int i = 0; i < chunks.count; i++)
+                co_yield chunks.spans[i];
+
+        } while (clz_suspended(state));
+    }
+
+    void *state_;
+};
+
+}   // namespace clz
+
+#endif  /* CLZ_CLZ_HPP_ */
+
+/* vi:set ts=4 sw=4 expandtab: */
@@ -0,0 +1,1716 @@
+/*
+ *  clzbench - Benchmark clz inflation over a generated corpus
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  The corpus is generated locally from a fixed seed so every run (and
+ *  every machine) decompresses exactly the same streams. As clz has no
+ *  deflate of its own, there's a small and fairly dumb one in here: a
+ *  greedy hash chain matcher with stored, fixed or dynamic blocks. It
+ *  isn't there to compress well, it's there to make streams of a known
+ *  shape for inflate to chew on.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/syscall.h>
+  #include <sys/ioctl.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define BENCH_HAVE_TSC
+#endif
+
+#include "crc32.h"
+#include "clz.h"
+
+
+#define BENCH_DEF_SIZE_MB   8
+#define BENCH_DEF_REPS      5
+
+#define BENCH_GREP          "[ERROR]"   /* Filter for the clz_grep run */
+
+#define ENC_STORED          0
+#define ENC_FIXED           1
+#define ENC_DYNAMIC         2
+#define ENC_DYNREPEAT       3       /* Dynamic, same header every block */
+
+#define ENC_HASH_BITS       15
+#define ENC_HASH_SIZE       (1 << ENC_HASH_BITS)
+#define ENC_WINDOW_SIZE     32768
+#define ENC_MAX_CHAIN       32
+#define ENC_MIN_MATCH       3
+#define ENC_MAX_MATCH       258
+
+#define PERF_CYCLES         0
+#define PERF_INSTRUCTIONS   1
+#define PERF_BRANCH_MISSES  2
+#define PERF_CACHE_MISSES   3
+#define PERF_NCOUNTERS      4
+
+
+extern int benchzlib_available(void);
+extern int benchzlib_inflate(const void *inbuf, size_t inlen, size_t *outlenp);
+
+
+
+
+/*
+ *  Corpus generation
+ *  -----------------
+ */
+
+
+static uint32_t g_rng;
+
+static uint32_t rng_next(void)
+{
+    /* xorshift32. Quick and, more importantly, the same everywhere */
+
+    g_rng ^= g_rng << 13;
+    g_rng ^= g_rng >> 17;
+    g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+
+static const char *g_words[] = {
+    "the", "of", "and", "to", "in", "a", "is", "that", "for", "it",
+    "as", "was", "with", "be", "by", "on", "not", "he", "this", "are",
+    "or", "his", "from", "at", "which", "but", "have", "an", "had",
+    "they", "you", "were", "their", "one", "all", "we", "can", "her",
+    "has", "there", "been", "if", "more", "when", "will", "would",
+    "who", "so", "no", "window", "sliding", "huffman", "decompress",
+    "literal", "distance", "stream", "block", "dynamic", "symbol",
+    "alphabet", "compression", "particularly", "approximately",
+    "nevertheless", "circumstances", "understanding", "independent"
+};
+
+
+static void gen_text(unsigned char *buf, size_t len)
+{
+    size_t i = 0;
+    int wcnt = 0;
+
+    while (i < len)
+    {
+        /* Skew towards the front of the word list, roughly Zipf */
+
+        const int nwords = sizeof(g_words) / sizeof(g_words[0]);
+        const char *w = g_words[(rng_next() % nwords) *
+                                (rng_next() % nwords) / nwords];
+
+        while (*w && i < len)
+            buf[i++] = *w++;
+
+        if (i < len)
+        {
+            if (++wcnt % 12 == 0)
+                buf[i++] = (rng_next() & 3) ? '.' : '\n';
+            else
+                buf[i++] = ' ';
+        }
+    }
+}
+
+
+static void gen_logs(unsigned char *buf, size_t len)
+{
+    static const char *levels[] = { "INFO", "INFO", "INFO", "WARN", "DEBUG",
+                                    "ERROR" };
+    static const char *paths[] = { "/api/v1/users", "/api/v1/orders",
+                                   "/static/app.js", "/healthz",
+                                   "/api/v2/search", "/login" };
+    char line[256];
+    unsigned int secs = 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        int n;
+
+        secs += rng_next() % 3;
+
+        n = snprintf(line, sizeof(line),
+                "2016-03-%02u %02u:%02u:%02u.%03u [%s] 10.%u.%u.%u GET %s "
+                "status=%u bytes=%u latency_ms=%u\n",
+                1 + (secs / 86400) % 28, (secs / 3600) % 24,
+                (secs / 60) % 60, secs % 60, rng_next() % 1000,
+                levels[rng_next() % 6],
+                rng_next() % 4, rng_next() % 256, rng_next() % 256,
+                paths[rng_next() % 6],
+                (rng_next() % 10) ? 200 : 404,
+                rng_next() % 65536, rng_next() % 500);
+
+        if (n > len - i)
+            n = len - i;
+
+        memcpy(buf + i, line, n);
+        i += n;
+    }
+}
+
+
+static void gen_binary(unsigned char *buf, size_t len)
+{
+    /* Structured records: id, small counters, a float-ish field and
+       some zero padding. Looks like a lot of real world binary data */
+
+    uint32_t id = 1000;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        unsigned char rec[32];
+        uint32_t v;
+        int k;
+
+        memset(rec, 0, sizeof(rec));
+
+        id += 1 + (rng_next() & 3);
+        for (k = 0; k < 4; k++)
+            rec[k] = id >> (k * 8);
+
+        rec[4] = rng_next() % 8;
+        rec[5] = rng_next() % 3;
+
+        v = 0x3f800000 + (rng_next() & 0x3fffff);
+        for (k = 0; k < 4; k++)
+            rec[8 + k] = v >> (k * 8);
+
+        v = rng_next() % 100000;
+        for (k = 0; k < 4; k++)
+            rec[16 + k] = v >> (k * 8);
+
+        for (k = 0; k < sizeof(rec) && i < len; k++)
+            buf[i++] = rec[k];
+    }
+}
+
+
+static void gen_repetitive(unsigned char *buf, size_t len)
+{
+    static const char pattern[] = "ABABABABCCCCCCCCABABABAB--------";
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = pattern[i % (sizeof(pattern) - 1)];
+
+    /* Long runs of one byte too, to get lots of distance 1 */
+
+    for (i = 0; i + 4096 < len; i += 65536)
+        memset(buf + i, 'z', 4096);
+
+    /* And the odd change so it isn't quite a single match */
+
+    for (i = 0; i < len; i += 1 + rng_next() % 8192)
+        buf[i] = rng_next();
+}
+
+
+static void gen_random(unsigned char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = rng_next() >> 24;
+}
+
+
+
+
+/*
+ *  A minimal deflate to make the streams
+ *  -------------------------------------
+ */
+
+
+typedef struct
+{
+    unsigned char *buf;
+    size_t len, cap;
+
+    uint64_t bitbuf;
+    int nbits;
+
+} Bitout;
+
+
+typedef struct
+{
+    unsigned short litlen;      /* Literal byte or match length */
+    unsigned short dist;        /* 0 if a literal               */
+
+} Lzsym;
+
+
+static const unsigned short g_lbase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char g_lext[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short g_dbase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+
+static const unsigned char g_dext[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static unsigned char g_lencode[ENC_MAX_MATCH + 1];
+
+
+static void bo_putbits(Bitout *bo, unsigned int val, int n)
+{
+    bo->bitbuf |= (uint64_t)val << bo->nbits;
+    bo->nbits += n;
+
+    while (bo->nbits >= 8)
+    {
+        if (bo->len == bo->cap)
+        {
+            bo->cap = bo->cap ? bo->cap * 2 : 65536;
+            if ((bo->buf = realloc(bo->buf, bo->cap)) == NULL)
+            {
+                perror("clz_bench");
+                exit(1);
+            }
+        }
+
+        bo->buf[bo->len++] = (unsigned char)bo->bitbuf;
+        bo->bitbuf >>= 8;
+        bo->nbits -= 8;
+    }
+}
+
+
+static void bo_align(Bitout *bo)
+{
+    if (bo->nbits)
+        bo_putbits(bo, 0, 8 - bo->nbits);
+}
+
+
+static int dist_code(int dist)
+{
+    int i;
+
+    for (i = 29; g_dbase[i] > dist; i--)
+        ;
+
+    return i;
+}
+
+
+/*
+ *  lz_parse(src, len, out) - Greedy LZ77 over src
+ *
+ *  Returns: number of symbols placed in out (at most len)
+ */
+
+static size_t lz_parse(const unsigned char *src, size_t len, Lzsym *out)
+{
+    int *head, *prev;
+    size_t i, nsyms = 0;
+
+    head = malloc(ENC_HASH_SIZE * sizeof(int));
+    prev = malloc(ENC_WINDOW_SIZE * sizeof(int));
+    if (!head || !prev)
+    {
+        perror("clz_bench");
+        exit(1);
+    }
+
+    for (i = 0; i < ENC_HASH_SIZE; i++)
+        head[i] = -1;
+
+    i = 0;
+    while (i < len)
+    {
+        int bestlen = 0, bestdist = 0;
+
+        if (i + ENC_MIN_MATCH <= len)
+        {
+            unsigned int h;
+            int cand, chain, k;
+
+            h = ((src[i] << 10) ^ (src[i + 1] << 5) ^ src[i + 2]) &
+                (ENC_HASH_SIZE - 1);
+
+            cand = head[h];
+            chain = ENC_MAX_CHAIN;
+
+            while (cand >= 0 && i - cand <= ENC_WINDOW_SIZE && chain--)
+            {
+                int maxlen = len - i;
+
+                if (maxlen > ENC_MAX_MATCH)
+                    maxlen = ENC_MAX_MATCH;
+
+                for (k = 0; k < maxlen && src[cand + k] == src[i + k]; k++)
+                    ;
+
+                if (k > bestlen)
+                {
+                    bestlen = k;
+                    bestdist = i - cand;
+
+                    if (k == maxlen)
+                        break;
+                }
+
+                cand = prev[cand & (ENC_WINDOW_SIZE - 1)];
+            }
+
+            prev[i & (ENC_WINDOW_SIZE - 1)] = head[h];
+            head[h] = i;
+        }
+
+        if (bestlen >= ENC_MIN_MATCH)
+        {
+            size_t end = i + bestlen;
+
+            out[nsyms].litlen = bestlen;
+            out[nsyms].dist = bestdist;
+
+            /* Hash the skipped positions too so matches keep chaining */
+
+            for (i++; i < end; i++)
+            {
+                if (i + ENC_MIN_MATCH <= len)
+                {
+                    unsigned int h;
+
+                    h = ((src[i] << 10) ^ (src[i + 1] << 5) ^ src[i + 2]) &
+                        (ENC_HASH_SIZE - 1);
+
+                    prev[i & (ENC_WINDOW_SIZE - 1)] = head[h];
+                    head[h] = i;
+                }
+            }
+        }
+        else
+        {
+            out[nsyms].litlen = src[i++];
+            out[nsyms].dist = 0;
+        }
+
+        nsyms++;
+    }
+
+    free(head);
+    free(prev);
+    return nsyms;
+}
+
+
+/*
+ *  huff_lengths(freq, n, maxbits, lens) - Length limited code lengths
+ *
+ *  Builds a plain Huffman tree. If it turns out too deep, the
+ *  frequencies are flattened and it's built again. Not optimal
+ *  but always gives a complete code which is all that matters.
+ */
+
+static void huff_lengths(const unsigned int *freq, int n, int maxbits,
+                         unsigned char *lens)
+{
+    unsigned int wt[2 * 320], fq[320];
+    int parent[2 * 320], active[2 * 320];
+    int i, nused, nnodes, maxlen;
+
+    memset(lens, 0, n);
+
+    for (i = 0, nused = 0; i < n; i++)
+    {
+        fq[i] = freq[i];
+        if (fq[i])
+            nused++;
+    }
+
+    if (nused == 0)
+        return;
+
+    if (nused == 1)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if (fq[i])
+                lens[i] = 1;
+        }
+        return;
+    }
+
+    while (1)
+    {
+        for (i = 0; i < n; i++)
+        {
+            wt[i] = fq[i];
+            active[i] = fq[i] != 0;
+            parent[i] = -1;
+        }
+
+        /* Join the two lightest nodes until there is only one left */
+
+        for (nnodes = n; nnodes < n + nused - 1; nnodes++)
+        {
+            int lo1 = -1, lo2 = -1;
+
+            for (i = 0; i < nnodes; i++)
+            {
+                if (!active[i])
+                    continue;
+
+                if (lo1 < 0 || wt[i] < wt[lo1])
+                {
+                    lo2 = lo1;
+                    lo1 = i;
+                }
+                else if (lo2 < 0 || wt[i] < wt[lo2])
+                {
+                    lo2 = i;
+                }
+            }
+
+            wt[nnodes] = wt[lo1] + wt[lo2];
+            active[nnodes] = 1;
+            parent[nnodes] = -1;
+
+            active[lo1] = active[lo2] = 0;
+            parent[lo1] = parent[lo2] = nnodes;
+        }
+
+        for (i = 0, maxlen = 0; i < n; i++)
+        {
+            int k, d = 0;
+
+            if (!fq[i])
+                continue;
+
+            for (k = i; parent[k] >= 0; k = parent[k])
+                d++;
+
+            lens[i] = d;
+            if (d > maxlen)
+                maxlen = d;
+        }
+
+        if (maxlen <= maxbits)
+            return;
+
+        for (i = 0; i < n; i++)
+        {
+            if (fq[i])
+                fq[i] = (fq[i] + 1) / 2;
+        }
+    }
+}
+
+
+/*
+ *  huff_codes(lens, n, codes) - Canonical codes, bit reversed for output
+ */
+
+static void huff_codes(const unsigned char *lens, int n, unsigned short *codes)
+{
+    int bl_count[16], next_code[16];
+    int i, k, code;
+
+    memset(bl_count, 0, sizeof(bl_count));
+
+    for (i = 0; i < n; i++)
+        bl_count[lens[i]]++;
+
+    bl_count[0] = 0;
+
+    for (i = 1, code = 0; i < 16; i++)
+    {
+        code = (code + bl_count[i - 1]) << 1;
+        next_code[i] = code;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        unsigned int c, r = 0;
+
+        if (!lens[i])
+            continue;
+
+        c = next_code[lens[i]]++;
+        for (k = 0; k < lens[i]; k++)
+            r |= ((c >> k) & 1) << (lens[i] - 1 - k);
+
+        codes[i] = r;
+    }
+}
+
+
+static void enc_symbols(Bitout *bo, const Lzsym *syms, size_t nsyms,
+                        const unsigned char *lllens, const unsigned short *llcodes,
+                        const unsigned char *dlens, const unsigned short *dcodes)
+{
+    size_t i;
+
+    for (i = 0; i < nsyms; i++)
+    {
+        if (!syms[i].dist)
+        {
+            bo_putbits(bo, llcodes[syms[i].litlen], lllens[syms[i].litlen]);
+        }
+        else
+        {
+            int lc = g_lencode[syms[i].litlen];
+            int dc = dist_code(syms[i].dist);
+
+            bo_putbits(bo, llcodes[257 + lc], lllens[257 + lc]);
+            bo_putbits(bo, syms[i].litlen - g_lbase[lc], g_lext[lc]);
+            bo_putbits(bo, dcodes[dc], dlens[dc]);
+            bo_putbits(bo, syms[i].dist - g_dbase[dc], g_dext[dc]);
+        }
+    }
+
+    bo_putbits(bo, llcodes[256], lllens[256]);
+}
+
+
+static void enc_block_stored(Bitout *bo, const unsigned char *src, size_t len,
+                             int bfinal)
+{
+    do {
+        size_t n = len > 65535 ? 65535 : len;
+
+        bo_putbits(bo, (bfinal && n == len) ? 1 : 0, 1);
+        bo_putbits(bo, 0, 2);
+        bo_align(bo);
+
+        bo_putbits(bo, n, 16);
+        bo_putbits(bo, ~n & 0xffff, 16);
+
+        for (len -= n; n; n--)
+            bo_putbits(bo, *src++, 8);
+
+    } while (len);
+}
+
+
+static void enc_block_fixed(Bitout *bo, const Lzsym *syms, size_t nsyms,
+                            int bfinal)
+{
+    static unsigned char lllens[288], dlens[30];
+    static unsigned short llcodes[288], dcodes[30];
+    int i;
+
+    if (!lllens[0])
+    {
+        for (i = 0; i < 288; i++)
+            lllens[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        for (i = 0; i < 30; i++)
+            dlens[i] = 5;
+
+        huff_codes(lllens, 288, llcodes);
+        huff_codes(dlens, 30, dcodes);
+    }
+
+    bo_putbits(bo, bfinal, 1);
+    bo_putbits(bo, 1, 2);
+    enc_symbols(bo, syms, nsyms, lllens, llcodes, dlens, dcodes);
+}
+
+
+/*
+ *  enc_block_dynamic(bo, syms, nsyms, fsyms, nfsyms, src, srclen, bfinal)
+ *
+ *  The trees are built from the symbol counts in fsyms which is
+ *  usually the same as syms, but can be the whole stream to give
+ *  every block an identical header.
+ */
+
+static void enc_block_dynamic(Bitout *bo, const Lzsym *syms, size_t nsyms,
+                              const Lzsym *fsyms, size_t nfsyms,
+                              const unsigned char *src, size_t srclen,
+                              int bfinal)
+{
+    static const unsigned char clsorder[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    unsigned int llfreq[286], dfreq[30], clfreq[19];
+    unsigned char lllens[286], dlens[30], cllens[19];
+    unsigned short llcodes[286], dcodes[30], clcodes[19];
+    unsigned char seq[286 + 30], rle[286 + 30], rlex[286 + 30];
+    int hlit, hdist, hclen, nseq, nrle, i, k;
+    size_t bits, s;
+
+    memset(llfreq, 0, sizeof(llfreq));
+    memset(dfreq, 0, sizeof(dfreq));
+    memset(clfreq, 0, sizeof(clfreq));
+
+    for (s = 0; s < nfsyms; s++)
+    {
+        if (!fsyms[s].dist)
+        {
+            llfreq[fsyms[s].litlen]++;
+        }
+        else
+        {
+            llfreq[257 + g_lencode[fsyms[s].litlen]]++;
+            dfreq[dist_code(fsyms[s].dist)]++;
+        }
+    }
+
+    llfreq[256] = 1;
+
+    for (i = 0, k = 0; i < 30; i++)
+        k |= dfreq[i];
+    if (!k)
+        dfreq[0] = 1;       /* A single 1 bit code for no distances */
+
+    huff_lengths(llfreq, 286, 15, lllens);
+    huff_lengths(dfreq, 30, 15, dlens);
+
+    for (hlit = 286; hlit > 257 && !lllens[hlit - 1]; hlit--)
+        ;
+    for (hdist = 30; hdist > 1 && !dlens[hdist - 1]; hdist--)
+        ;
+
+    memcpy(seq, lllens, hlit);
+    memcpy(seq + hlit, dlens, hdist);
+    nseq = hlit + hdist;
+
+
+    /* Run length the code lengths with 16, 17 and 18 */
+
+    for (i = 0, nrle = 0; i < nseq; )
+    {
+        int run = 1;
+
+        while (i + run < nseq && seq[i + run] == seq[i])
+            run++;
+
+        i += run;
+
+        if (seq[i - run] == 0)
+        {
+            while (run >= 11)
+            {
+                int n = run > 138 ? 138 : run;
+                rle[nrle] = 18; rlex[nrle++] = n - 11;
+                run -= n;
+            }
+            if (run >= 3)
+            {
+                rle[nrle] = 17; rlex[nrle++] = run - 3;
+                run = 0;
+            }
+        }
+        else
+        {
+            rle[nrle] = seq[i - run]; rlex[nrle++] = 0;
+            run--;
+
+            while (run >= 3)
+            {
+                int n = run > 6 ? 6 : run;
+                rle[nrle] = 16; rlex[nrle++] = n - 3;
+                run -= n;
+            }
+        }
+
+        while (run--)
+        {
+            rle[nrle] = seq[i - 1]; rlex[nrle++] = 0;
+        }
+    }
+
+    for (i = 0; i < nrle; i++)
+        clfreq[rle[i]]++;
+
+    /* Code length codes must be complete so use at least two */
+
+    for (i = 0, k = 0; i < 19; i++)
+        k += clfreq[i] != 0;
+    if (k < 2)
+        clfreq[clfreq[0] ? 1 : 0] = 1;
+
+    huff_lengths(clfreq, 19, 7, cllens);
+
+    for (hclen = 19; hclen > 4 && !cllens[clsorder[hclen - 1]]; hclen--)
+        ;
+
+    huff_codes(lllens, hlit, llcodes);
+    huff_codes(dlens, hdist, dcodes);
+    huff_codes(cllens, 19, clcodes);
+
+
+    /* If the block is no smaller than it would be stored, store it */
+
+    bits = 3 + 14 + hclen * 3;
+
+    for (i = 0; i < nrle; i++)
+    {
+        bits += cllens[rle[i]];
+        bits += rle[i] == 16 ? 2 : rle[i] == 17 ? 3 : rle[i] == 18 ? 7 : 0;
+    }
+
+    for (s = 0; s < nsyms; s++)
+    {
+        if (!syms[s].dist)
+        {
+            bits += lllens[syms[s].litlen];
+        }
+        else
+        {
+            int lc = g_lencode[syms[s].litlen];
+            int dc = dist_code(syms[s].dist);
+
+            bits += lllens[257 + lc] + g_lext[lc] + dlens[dc] + g_dext[dc];
+        }
+    }
+
+    if (fsyms == syms && bits / 8 >= srclen + 5 * (srclen / 65535 + 1))
+    {
+        enc_block_stored(bo, src, srclen, bfinal);
+        return;
+    }
+
+    bo_putbits(bo, bfinal, 1);
+    bo_putbits(bo, 2, 2);
+    bo_putbits(bo, hlit - 257, 5);
+    bo_putbits(bo, hdist - 1, 5);
+    bo_putbits(bo, hclen - 4, 4);
+
+    for (i = 0; i < hclen; i++)
+        bo_putbits(bo, cllens[clsorder[i]], 3);
+
+    for (i = 0; i < nrle; i++)
+    {
+        bo_putbits(bo, clcodes[rle[i]], cllens[rle[i]]);
+
+        if (rle[i] == 16)
+            bo_putbits(bo, rlex[i], 2);
+        else if (rle[i] == 17)
+            bo_putbits(bo, rlex[i], 3);
+        else if (rle[i] == 18)
+            bo_putbits(bo, rlex[i], 7);
+    }
+
+    enc_symbols(bo, syms, nsyms, lllens, llcodes, dlens, dcodes);
+}
+
+
+/*
+ *  enc_stream(bo, src, len, mode, blksyms) - Deflate src into bo
+ *
+ *  Fixed and dynamic streams are split into blocks of blksyms
+ *  symbols, so a small blksyms gives a lot of small blocks.
+ */
+
+static void enc_stream(Bitout *bo, const unsigned char *src, size_t len,
+                       int mode, size_t blksyms)
+{
+    Lzsym *syms;
+    size_t nsyms, s, pos;
+    int i, k;
+
+    for (i = 0; i < 29; i++)
+    {
+        for (k = g_lbase[i]; k < (i < 28 ? g_lbase[i + 1] : 259); k++)
+            g_lencode[k] = i;
+    }
+
+    if (mode == ENC_STORED)
+    {
+        enc_block_stored(bo, src, len, 1);
+        bo_align(bo);
+        return;
+    }
+
+    if ((syms = malloc((len + 1) * sizeof(Lzsym))) == NULL)
+    {
+        perror("clz_bench");
+        exit(1);
+    }
+
+    nsyms = lz_parse(src, len, syms);
+
+    for (s = 0, pos = 0; s < nsyms || s == 0; )
+    {
+        size_t n = nsyms - s, srclen = 0, j;
+        int bfinal;
+
+        if (n > blksyms)
+            n = blksyms;
+
+        bfinal = (s + n == nsyms);
+
+        for (j = s; j < s + n; j++)
+            srclen += syms[j].dist ? syms[j].litlen : 1;
+
+        if (mode == ENC_FIXED)
+            enc_block_fixed(bo, syms + s, n, bfinal);
+        else if (mode == ENC_DYNREPEAT)
+            enc_block_dynamic(bo, syms + s, n, syms, nsyms,
+                              src + pos, srclen, bfinal);
+        else
+            enc_block_dynamic(bo, syms + s, n, syms + s, n,
+                              src + pos, srclen, bfinal);
+
+        s += n;
+        pos += srclen;
+
+        if (bfinal)
+            break;
+    }
+
+    bo_align(bo);
+    free(syms);
+}
+
+
+
+
+/*
+ *  Measurement
+ *  -----------
+ */
+
+
+static int g_perf_fd[PERF_NCOUNTERS] = { -1, -1, -1, -1 };
+
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static uint64_t now_ticks(void)
+{
+#ifdef BENCH_HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ *  perf_open() - Open whatever hardware counters we're allowed
+ *
+ *  Containers and locked down perf_event_paranoid settings often
+ *  refuse, in which case the counters just report as unavailable.
+ */
+
+static void perf_open(void)
+{
+#ifdef __linux__
+    static const uint64_t config[PERF_NCOUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_MISSES
+    };
+    struct perf_event_attr pea;
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        memset(&pea, 0, sizeof(pea));
+        pea.type = PERF_TYPE_HARDWARE;
+        pea.size = sizeof(pea);
+        pea.config = config[i];
+        pea.disabled = 1;
+        pea.exclude_kernel = 1;
+        pea.exclude_hv = 1;
+
+        g_perf_fd[i] = syscall(__NR_perf_event_open, &pea, 0, -1, -1, 0);
+    }
+#endif
+}
+
+
+static void perf_start(void)
+{
+#ifdef __linux__
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        if (g_perf_fd[i] >= 0)
+        {
+            ioctl(g_perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(g_perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+
+/*
+ *  perf_stop(vals) - Stop counters, fill vals[]. -1 if unavailable
+ */
+
+static void perf_stop(double *vals)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        uint64_t count;
+
+        vals[i] = -1;
+
+#ifdef __linux__
+        if (g_perf_fd[i] < 0)
+            continue;
+
+        ioctl(g_perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+        if (read(g_perf_fd[i], &count, sizeof(count)) == sizeof(count))
+            vals[i] = (double)count;
+#else
+        (void)count;
+#endif
+    }
+}
+
+
+
+
+/*
+ *  Benchmarks
+ *  ----------
+ */
+
+
+typedef struct
+{
+    const char *name;
+    void (*gen)(unsigned char *, size_t);
+    int mode;
+    size_t blksyms;
+    size_t fieldlen;    /* Split into separate streams this size, or 0 */
+
+} Benchcase;
+
+
+static const Benchcase g_cases[] = {
+    { "text",           gen_text,       ENC_DYNAMIC,    32768,  0       },
+    { "logs",           gen_logs,       ENC_DYNAMIC,    32768,  0       },
+    { "binary",         gen_binary,     ENC_DYNAMIC,    32768,  0       },
+    { "repetitive",     gen_repetitive, ENC_DYNAMIC,    32768,  0       },
+    { "incompressible", gen_random,     ENC_DYNAMIC,    32768,  0       },
+    { "stored",         gen_logs,       ENC_STORED,     0,      0       },
+    { "fixed",          gen_text,       ENC_FIXED,      32768,  0       },
+    { "dynamic-heavy",  gen_logs,       ENC_DYNAMIC,    512,    0       },
+    { "dynamic-repeat", gen_logs,       ENC_DYNREPEAT,  512,    0       },
+    { "small-fields",   gen_logs,       ENC_DYNAMIC,    32768,  2048    },
+};
+
+
+typedef struct
+{
+    double secs;                        /* Best of the reps */
+    double ticks;                       /* TSC per rep, -1 if none */
+    double counters[PERF_NCOUNTERS];    /* Per rep, -1 if none */
+
+} Benchresult;
+
+
+static int g_machine;
+static int g_stats;
+static int g_reps = BENCH_DEF_REPS;
+static size_t g_ringsize;
+static const char *g_kernel;
+
+
+static size_t bench_put(void *par, void *buf, size_t buflen)
+{
+    (void)par;
+    (void)buf;
+    return buflen;
+}
+
+
+/*
+ *  Everything a timed run needs. Each run_*() function does one
+ *  pass and returns 1 if the result was right, 0 if not.
+ *
+ *  A case with a fieldlen is many small streams rather than one.
+ *  Each is described by an item in fields[] with its CRC in
+ *  fieldcrc[].
+ */
+
+typedef struct
+{
+    const void *inbuf;
+    size_t inlen;
+
+} Benchfield;
+
+typedef struct
+{
+    void *state;
+
+    unsigned char *raw;
+    size_t rawlen;
+    unsigned int rawcrc;
+
+    unsigned char *comp;
+    size_t complen;
+
+    Benchfield *fields;
+    unsigned int *fieldcrc;
+    int nfields;
+
+    size_t nlines;              /* Records in raw, and with BENCH_GREP */
+    size_t ngrep;
+    size_t reccount;
+
+} Runctx;
+
+
+static int run_clz(Runctx *rc)
+{
+    unsigned int crc;
+    int i;
+
+    if (rc->nfields)
+    {
+        for (i = 0; i < rc->nfields; i++)
+        {
+            if (!clz_setcb_get(rc->state, 0, (void *)rc->fields[i].inbuf,
+                               rc->fields[i].inlen))
+                return 0;
+
+            if (!clz_decompress(rc->state, 0, &crc) || crc != rc->fieldcrc[i])
+                return 0;
+        }
+
+        return 1;
+    }
+
+    if (!clz_setcb_get(rc->state, 0, rc->comp, rc->complen))
+        return 0;
+
+    return clz_decompress(rc->state, 0, &crc) != 0 && crc == rc->rawcrc;
+}
+
+
+static int run_clz_verify(Runctx *rc)
+{
+    unsigned int crc;
+    size_t outlen, total = 0;
+    int i;
+
+    if (rc->nfields)
+    {
+        for (i = 0; i < rc->nfields; i++)
+        {
+            if (!clz_setcb_get(rc->state, 0, (void *)rc->fields[i].inbuf,
+                               rc->fields[i].inlen))
+                return 0;
+
+            if (!clz_verify(rc->state, &outlen, &crc) ||
+                crc != rc->fieldcrc[i])
+                return 0;
+
+            total += outlen;
+        }
+
+        return total == rc->rawlen;
+    }
+
+    if (!clz_setcb_get(rc->state, 0, rc->comp, rc->complen))
+        return 0;
+
+    return clz_verify(rc->state, &outlen, &crc) != 0 &&
+           crc == rc->rawcrc && outlen == rc->rawlen;
+}
+
+
+static int run_clz_portable(Runctx *rc)
+{
+    int ret;
+
+    if (!clz_set_kernel(rc->state, "portable"))
+        return 0;
+
+    ret = run_clz(rc);
+
+    clz_set_kernel(rc->state, g_kernel);
+    return ret;
+}
+
+
+static int bench_record(void *par, const void *rec, size_t len)
+{
+    (void)rec;
+    (void)len;
+    ((Runctx *)par)->reccount++;
+    return 1;
+}
+
+
+static int run_records(Runctx *rc, const char *filter, size_t expect)
+{
+    unsigned int crc;
+    void *recs;
+    int ret;
+
+    if ((recs = clz_records_create(CLZ_REC_LINES, bench_record, rc)) == NULL)
+        return 0;
+
+    rc->reccount = 0;
+
+    ret = (!filter || clz_records_filter(recs, filter, strlen(filter))) &&
+          clz_setcb_get(rc->state, 0, rc->comp, rc->complen) &&
+          clz_setcb_put(rc->state, clz_records_put, recs) &&
+          clz_decompress(rc->state, 0, &crc) != 0 && crc == rc->rawcrc &&
+          clz_records_finish(recs) && rc->reccount == expect;
+
+    clz_setcb_put(rc->state, bench_put, 0);
+    clz_records_destroy(recs);
+    return ret;
+}
+
+
+static int run_clz_records(Runctx *rc)
+{
+    return run_records(rc, NULL, rc->nlines);
+}
+
+
+static int run_clz_grep(Runctx *rc)
+{
+    return run_records(rc, BENCH_GREP, rc->ngrep);
+}
+
+
+static int run_crc32(Runctx *rc)
+{
+    return crc32(0, rc->raw, rc->rawlen) == rc->rawcrc;
+}
+
+
+static int run_zlib(Runctx *rc)
+{
+    size_t outlen, total = 0;
+    int i;
+
+    if (rc->nfields)
+    {
+        for (i = 0; i < rc->nfields; i++)
+        {
+            if (!benchzlib_inflate(rc->fields[i].inbuf, rc->fields[i].inlen,
+                                   &outlen))
+                return 0;
+
+            total += outlen;
+        }
+
+        return total == rc->rawlen;
+    }
+
+    return benchzlib_inflate(rc->comp, rc->complen, &outlen) &&
+           outlen == rc->rawlen;
+}
+
+
+/*
+ *  time_runs(runfn, rc, br) - Time g_reps runs of runfn
+ *
+ *  Keeps the best wall time and the average counters per run
+ *
+ *  Returns: 1 if every run succeeded, 0 if not
+ */
+
+static int time_runs(int (*runfn)(Runctx *), Runctx *rc, Benchresult *br)
+{
+    uint64_t t0;
+    double start, secs;
+    int rep;
+
+    memset(br, 0, sizeof(*br));
+    br->secs = 1e9;
+
+    perf_start();
+    t0 = now_ticks();
+
+    for (rep = 0; rep < g_reps; rep++)
+    {
+        start = now_secs();
+
+        if (!runfn(rc))
+            return 0;
+
+        secs = now_secs() - start;
+        if (secs < br->secs)
+            br->secs = secs;
+    }
+
+    br->ticks = now_ticks() - t0;
+    perf_stop(br->counters);
+
+    br->ticks = t0 ? br->ticks / g_reps : -1;
+    for (rep = 0; rep < PERF_NCOUNTERS; rep++)
+    {
+        if (br->counters[rep] >= 0)
+            br->counters[rep] /= g_reps;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  report_stats(cname, state) - Dump clz_get_stats() for the last run
+ */
+
+static void report_stats(const char *cname, void *state)
+{
+    clz_stats cs;
+    unsigned long long ticks;
+    unsigned long nblocks;
+
+    if (!clz_get_stats(state, &cs))
+    {
+        fprintf(stderr, "clz_bench: no stats (build with CLZDEFS=-DCLZ_STATS)\n");
+        return;
+    }
+
+    nblocks = cs.blocks_stored + cs.blocks_fixed + cs.blocks_dynamic;
+    ticks = cs.ticks_build + cs.ticks_inflate + cs.ticks_write;
+    if (!ticks)
+        ticks = 1;
+
+    if (g_machine)
+    {
+        printf("{\"case\":\"%s\",\"func\":\"clz_stats\","
+               "\"blocks_stored\":%lu,\"blocks_fixed\":%lu,"
+               "\"blocks_dynamic\":%lu,\"htcache_hits\":%lu,"
+               "\"literals\":%llu,\"matches\":%llu,"
+               "\"ticks_build\":%llu,\"ticks_inflate\":%llu,"
+               "\"ticks_write\":%llu}\n",
+               cname, cs.blocks_stored, cs.blocks_fixed, cs.blocks_dynamic,
+               cs.htcache_hits, cs.literals, cs.matches,
+               cs.ticks_build, cs.ticks_inflate, cs.ticks_write);
+        return;
+    }
+
+    printf("%-15s   blocks s/f/d %lu/%lu/%lu, literals %llu, matches %llu,"
+           " time build/inflate/write %.0f%%/%.0f%%/%.0f%%\n",
+           cname, cs.blocks_stored, cs.blocks_fixed, cs.blocks_dynamic,
+           cs.literals, cs.matches,
+           100.0 * cs.ticks_build / ticks,
+           100.0 * cs.ticks_inflate / ticks,
+           100.0 * cs.ticks_write / ticks);
+
+    if (nblocks)
+    {
+        printf("%-15s   avg block in/out %llu/%llu bytes,"
+               " dynamic trees cached %lu\n", "",
+               (cs.in_stored + cs.in_fixed + cs.in_dynamic) / nblocks,
+               (cs.out_stored + cs.out_fixed + cs.out_dynamic) / nblocks,
+               cs.htcache_hits);
+    }
+}
+
+
+static void report(const char *cname, const char *func, const char *kernel,
+                   size_t inlen, size_t outlen, const Benchresult *br)
+{
+    double mbps, perbyte[PERF_NCOUNTERS], cycles;
+    int i;
+
+    mbps = br->secs > 0 ? outlen / br->secs / 1e6 : 0;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+        perbyte[i] = br->counters[i] >= 0 ? br->counters[i] / outlen : -1;
+
+    /* Prefer the real cycle counter, fall back to TSC */
+
+    cycles = perbyte[PERF_CYCLES];
+    if (cycles < 0 && br->ticks >= 0)
+        cycles = br->ticks / outlen;
+
+    if (g_machine)
+    {
+        static const char *names[PERF_NCOUNTERS] = {
+            "cycles_per_byte", "instructions_per_byte",
+            "branch_misses_per_byte", "cache_misses_per_byte"
+        };
+
+        printf("{\"case\":\"%s\",\"func\":\"%s\",\"kernel\":\"%s\","
+               "\"in_bytes\":%zu,\"out_bytes\":%zu,\"mb_per_s\":%.2f",
+               cname, func, kernel, inlen, outlen, mbps);
+
+        for (i = 0; i < PERF_NCOUNTERS; i++)
+        {
+            double v = i == PERF_CYCLES ? cycles : perbyte[i];
+
+            if (v < 0)
+                printf(",\"%s\":null", names[i]);
+            else
+                printf(",\"%s\":%.4f", names[i], v);
+        }
+
+        printf("}\n");
+        return;
+    }
+
+    printf("%-15s %-15s %9zu %9zu %8.1f", cname, func, inlen, outlen, mbps);
+
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+    {
+        double v = i == PERF_CYCLES ? cycles : perbyte[i];
+
+        if (v < 0)
+            printf("  %7s", "-");
+        else
+            printf("  %7.3f", v);
+    }
+
+    printf("\n");
+}
+
+
+/*
+ *  count_lines(rc) - Count the lines in rc->raw, and those with BENCH_GREP
+ *
+ *  The slow and obvious way, to check the clz_records runs against
+ */
+
+static void count_lines(Runctx *rc)
+{
+    size_t glen = strlen(BENCH_GREP), start = 0, i, j;
+
+    rc->nlines = 0;
+    rc->ngrep = 0;
+
+    for (i = 0; i <= rc->rawlen; i++)
+    {
+        if (i < rc->rawlen && rc->raw[i] != '\n')
+            continue;
+
+        /* An unterminated last line is a record too, an empty one isn't */
+
+        if (i < rc->rawlen || i > start)
+        {
+            rc->nlines++;
+
+            for (j = start; j + glen <= i; j++)
+            {
+                if (memcmp(rc->raw + j, BENCH_GREP, glen) == 0)
+                {
+                    rc->ngrep++;
+                    break;
+                }
+            }
+        }
+
+        start = i + 1;
+    }
+}
+
+
+/*
+ *  bench_fields(rc, bo, bc) - Compress rc->raw as separate small streams
+ *
+ *  Fills in rc->fields and rc->fieldcrc. Each field's inbuf is left
+ *  as an offset into bo until it's finished growing.
+ */
+
+static void bench_fields(Runctx *rc, Bitout *bo, const Benchcase *bc)
+{
+    size_t pos, len;
+    int i;
+
+    rc->nfields = (rc->rawlen + bc->fieldlen - 1) / bc->fieldlen;
+
+    rc->fields = calloc(rc->nfields, sizeof(Benchfield));
+    rc->fieldcrc = calloc(rc->nfields, sizeof(unsigned int));
+
+    if (!rc->fields || !rc->fieldcrc)
+    {
+        perror("clz_bench");
+        exit(1);
+    }
+
+    for (i = 0, pos = 0; i < rc->nfields; i++, pos += len)
+    {
+        len = rc->rawlen - pos;
+        if (len > bc->fieldlen)
+            len = bc->fieldlen;
+
+        rc->fields[i].inbuf = (void *)bo->len;
+        enc_stream(bo, rc->raw + pos, len, bc->mode, bc->blksyms);
+        rc->fields[i].inlen = bo->len - (size_t)rc->fields[i].inbuf;
+        rc->fieldcrc[i] = crc32(0, rc->raw + pos, len);
+    }
+}
+
+
+/*
+ *  bench_case(bc, size) - Generate, compress and time one corpus entry
+ *
+ *  Returns: 1 on success, 0 if decompression failed or was wrong
+ */
+
+static int bench_case(const Benchcase *bc, size_t size, void *state)
+{
+    static const struct
+    {
+        const char *name;
+        int (*runfn)(Runctx *);
+
+    } runs[] = {
+        { "clz_decompress",     run_clz         },
+        { "clz_portable",       run_clz_portable },
+        { "clz_verify",         run_clz_verify  },
+        { "clz_records",        run_clz_records },
+        { "clz_grep",           run_clz_grep    },
+        { "crc32",              run_crc32       },
+        { "zlib_inflate",       run_zlib        },
+    };
+    Bitout bo;
+    Benchresult br;
+    Runctx rc;
+    int i, ok = 1;
+
+    memset(&rc, 0, sizeof(rc));
+    rc.state = state;
+    rc.rawlen = size;
+
+    if ((rc.raw = malloc(size)) == NULL)
+    {
+        perror("clz_bench");
+        exit(1);
+    }
+
+    g_rng = 0x2545F491;
+    bc->gen(rc.raw, size);
+
+    memset(&bo, 0, sizeof(bo));
+
+    if (bc->fieldlen)
+        bench_fields(&rc, &bo, bc);
+    else
+        enc_stream(&bo, rc.raw, size, bc->mode, bc->blksyms);
+
+    count_lines(&rc);
+
+    rc.rawcrc = crc32(0, rc.raw, size);
+    rc.comp = bo.buf;
+    rc.complen = bo.len;
+
+    for (i = 0; i < rc.nfields; i++)
+        rc.fields[i].inbuf = rc.comp + (size_t)rc.fields[i].inbuf;
+
+    for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++)
+    {
+        if (runs[i].runfn == run_zlib && !benchzlib_available())
+            continue;
+
+        /* Only worth timing the portable kernel if it's not the one
+           being used anyway */
+
+        if (runs[i].runfn == run_clz_portable &&
+            strcmp(g_kernel, "portable") == 0)
+            continue;
+
+        /* The record runs only make sense with one stream */
+
+        if ((runs[i].runfn == run_clz_records ||
+             runs[i].runfn == run_clz_grep) && rc.nfields)
+            continue;
+
+        if (!time_runs(runs[i].runfn, &rc, &br))
+        {
+            fprintf(stderr, "clz_bench: %s: %s failed (%s)\n",
+                    bc->name, runs[i].name, strerror(errno));
+            ok = 0;
+            break;
+        }
+
+        /* crc32() only reads the raw data, so in = out for that one */
+
+        report(bc->name, runs[i].name,
+               runs[i].runfn == run_clz_portable ? "portable" : g_kernel,
+               runs[i].runfn == run_crc32 ? size : bo.len, size, &br);
+
+        if (g_stats && runs[i].runfn == run_clz)
+            report_stats(bc->name, state);
+    }
+
+    if (rc.nfields)
+    {
+        free(rc.fields);
+        free(rc.fieldcrc);
+    }
+
+    free(rc.raw);
+    free(bo.buf);
+    return ok;
+}
+
+
+static void bench_help(void)
+{
+    printf( "\n"
+            "clz_bench usage:\n"
+            "   clz_bench [-m] [-S] [-s MB] [-r reps] [-w KB] [-k kernel]"
+            " [case ...]\n"
+            "\n"
+            "   -m       Machine readable output (one JSON object per line)\n"
+            "   -S       Report clz_get_stats() (needs -DCLZ_STATS build)\n"
+            "   -s MB    Uncompressed size of each corpus entry (default %d)\n"
+            "   -r reps  Repetitions, the best time is kept (default %d)\n"
+            "   -w KB    Output ring size, 32 to 16384 (default 32)\n"
+            "   -k name  Inflate kernel: portable, bmi2+avx2 (default best)\n"
+            "\n"
+            "   Cases:  ", BENCH_DEF_SIZE_MB, BENCH_DEF_REPS);
+
+    {
+        int i;
+        for (i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++)
+            printf("%s ", g_cases[i].name);
+    }
+
+    printf("\n\n");
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t size = BENCH_DEF_SIZE_MB * 1024 * 1024;
+    void *state;
+    int opt, i, k, failed = 0;
+
+    while ((opt = getopt(argc, argv, "hmSs:r:w:k:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                g_machine = 1;
+                break;
+
+            case 'S':
+                g_stats = 1;
+                break;
+
+            case 's':
+                size = (size_t)(atof(optarg) * 1024 * 1024);
+                break;
+
+            case 'r':
+                g_reps = atoi(optarg);
+                break;
+
+            case 'w':
+                g_ringsize = (size_t)atoi(optarg) * 1024;
+                break;
+
+            case 'k':
+                g_kernel = optarg;
+                break;
+
+            default:
+                bench_help();
+                return 1;
+        }
+    }
+
+    if (size == 0 || g_reps <= 0)
+    {
+        bench_help();
+        return 1;
+    }
+
+    if ((state = clz_create()) == NULL)
+    {
+        perror("clz_create");
+        return 1;
+    }
+
+    if (!clz_setcb_put(state, bench_put, 0))
+    {
+        perror("clz_setcb_put");
+        return 1;
+    }
+
+    if (g_ringsize && !clz_set_ringsize(state, g_ringsize))
+    {
+        perror("clz_set_ringsize");
+        return 1;
+    }
+
+    if (g_kernel && !clz_set_kernel(state, g_kernel))
+    {
+        perror("clz_set_kernel");
+        return 1;
+    }
+
+    g_kernel = clz_get_kernel(state);
+
+    perf_open();
+
+    if (!g_machine)
+    {
+        printf("kernel: %s\n\n", g_kernel);
+        printf("%-15s %-15s %9s %9s %8s  %7s  %7s  %7s  %7s\n",
+               "case", "function", "in", "out", "MB/s",
+               "cyc/B", "ins/B", "brmis/B", "cmis/B");
+        printf("-----------------------------------------------------------"
+               "--------------------------------------------\n");
+    }
+
+    for (i = 0; i < sizeof(g_cases) / sizeof(g_cases[0]); i++)
+    {
+        if (optind < argc)
+        {
+            for (k = optind; k < argc; k++)
+            {
+                if (strcmp(argv[k], g_cases[i].name) == 0)
+                    break;
+            }
+            if (k == argc)
+                continue;
+        }
+
+        if (!bench_case(&g_cases[i], size, state))
+            failed = 1;
+    }
+
+    clz_destroy(state);
+    return failed;
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
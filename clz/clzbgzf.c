@@ -0,0 +1,716 @@
+/*
+ *  clzbgzf - Transcode gzip to BGZF, with a .gzi index
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  A gzip file of one (or more) members is decompressed with clz and
+ *  recompressed as BGZF: a series of small gzip members, each holding
+ *  at most 0xFF00 bytes and carrying its own compressed size (BSIZE)
+ *  in an extra field, so any of them can be found and decompressed on
+ *  its own. The .gzi index alongside lists where each member starts,
+ *  compressed and uncompressed, in the form htslib uses.
+ *
+ *  The main thread decompresses into a fixed ring of blocks, worker
+ *  threads deflate them (with the system zlib, clz has no deflate) and
+ *  a writer thread writes them out in order. Memory use is bounded by
+ *  the ring, however large the input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "crc32.h"
+#include "clz.h"
+
+
+#define BGZF_DATA_MAX       0xFF00      /* Uncompressed bytes per block */
+#define BGZF_BLOCK_MAX      65536       /* BSIZE + 1 can't exceed this */
+#define BGZF_HDR_SIZE       18
+#define BGZF_FTR_SIZE       8
+#define BGZF_CDATA_MAX      (BGZF_BLOCK_MAX - BGZF_HDR_SIZE - BGZF_FTR_SIZE)
+#define BGZF_JOBS_PER_THREAD 4
+#define BGZF_MAX_THREADS    64
+#define BGZF_DEF_LEVEL      6
+
+/* gzip header flags */
+
+#define GZ_FHCRC            0x02
+#define GZ_FEXTRA           0x04
+#define GZ_FNAME            0x08
+#define GZ_FCOMMENT         0x10
+#define GZ_FRESERVED        0xE0
+
+
+/* Every BGZF member starts like this, BSIZE (bytes 16-17) aside */
+
+static const unsigned char g_bgzf_hdr[BGZF_HDR_SIZE] = {
+    0x1F, 0x8B, 8, GZ_FEXTRA, 0, 0, 0, 0, 0, 0xFF, 6, 0, 'B', 'C', 2, 0, 0, 0
+};
+
+/* And the file ends with an empty member */
+
+static const unsigned char g_bgzf_eof[28] = {
+    0x1F, 0x8B, 8, GZ_FEXTRA, 0, 0, 0, 0, 0, 0xFF, 6, 0, 'B', 'C', 2, 0,
+    0x1B, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+
+extern void *bgzfz_create(int level);
+extern int bgzfz_compress(void *zptr, const void *in, size_t inlen,
+                          void *out, size_t outmax, size_t *outlenp);
+extern void bgzfz_destroy(void *zptr);
+
+
+/*
+ *  One block in the ring. Block number seq lives in jobs[seq % njobs]
+ */
+
+typedef struct
+{
+    unsigned char data[BGZF_DATA_MAX];
+    size_t datalen;
+
+    unsigned char out[BGZF_BLOCK_MAX];
+    size_t outlen;
+    int done;                   /* Compressed, ready to write */
+
+} Bgzfjob;
+
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     /* Broadcast on any of the below */
+
+    Bgzfjob *jobs;
+    int njobs;
+
+    unsigned long nfilled;      /* Blocks handed over by the reader */
+    unsigned long nclaimed;     /* Blocks taken by workers */
+    unsigned long nwritten;     /* Blocks written out */
+    int finished;               /* Reader has no more */
+    int failed;                 /* Writer's errno, 0 if all's well */
+
+    int level;
+    FILE *outfp;
+    FILE *idxfp;                /* NULL if no index */
+    unsigned long long caddr;   /* Compressed and uncompressed offsets */
+    unsigned long long uaddr;
+    unsigned long long nindex;
+
+} Pipeline;
+
+
+static const char *g_infile = "-";
+static const char *g_outfile;
+
+
+
+
+/*
+ *  put_le(p, val, nbytes) - Store val little endian at p
+ */
+
+static void put_le(unsigned char *p, unsigned long long val, int nbytes)
+{
+    while (nbytes--)
+    {
+        *p++ = (unsigned char)val;
+        val >>= 8;
+    }
+}
+
+
+
+
+/*
+ *  bgzf_block(zptr, job) - Make job->data into a complete BGZF member
+ *
+ *  Data that deflate can't get under the BGZF size limit goes in as a
+ *  stored block, which always fits.
+ */
+
+static void bgzf_block(void *zptr, Bgzfjob *job)
+{
+    unsigned char *cdata = job->out + BGZF_HDR_SIZE;
+    size_t clen;
+
+    if (!bgzfz_compress(zptr, job->data, job->datalen, cdata,
+                        BGZF_CDATA_MAX, &clen))
+    {
+        cdata[0] = 1;           /* Final, stored */
+        put_le(cdata + 1, job->datalen, 2);
+        put_le(cdata + 3, ~job->datalen, 2);
+        memcpy(cdata + 5, job->data, job->datalen);
+        clen = job->datalen + 5;
+    }
+
+    job->outlen = BGZF_HDR_SIZE + clen + BGZF_FTR_SIZE;
+
+    memcpy(job->out, g_bgzf_hdr, BGZF_HDR_SIZE);
+    put_le(job->out + 16, job->outlen - 1, 2);
+    put_le(cdata + clen, crc32(0, job->data, job->datalen), 4);
+    put_le(cdata + clen + 4, job->datalen, 4);
+}
+
+
+
+
+/*
+ *  worker_thread(arg) - Compress blocks in whatever order they come
+ */
+
+static void *worker_thread(void *arg)
+{
+    Pipeline *pl = (Pipeline *)arg;
+    void *zptr;
+    Bgzfjob *job;
+
+    if ((zptr = bgzfz_create(pl->level)) == NULL)
+    {
+        fprintf(stderr, "clz_bgzf: can't set up deflate\n");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&pl->lock);
+
+    while (1)
+    {
+        while (pl->nclaimed == pl->nfilled && !pl->finished)
+            pthread_cond_wait(&pl->changed, &pl->lock);
+
+        if (pl->nclaimed == pl->nfilled)
+            break;
+
+        job = &pl->jobs[pl->nclaimed++ % pl->njobs];
+        pthread_mutex_unlock(&pl->lock);
+
+        bgzf_block(zptr, job);
+
+        pthread_mutex_lock(&pl->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&pl->changed);
+    }
+
+    pthread_mutex_unlock(&pl->lock);
+    bgzfz_destroy(zptr);
+    return NULL;
+}
+
+
+
+
+/*
+ *  write_block(pl, job) - Write a member, and its entry in the index
+ *
+ *  The index is a count followed by a compressed and uncompressed
+ *  offset for the start of every member bar the first.
+ *
+ *  Returns: 1 on success, 0 on error
+ */
+
+static int write_block(Pipeline *pl, Bgzfjob *job)
+{
+    unsigned char entry[16];
+
+    if (fwrite(job->out, 1, job->outlen, pl->outfp) != job->outlen)
+        return 0;
+
+    pl->caddr += job->outlen;
+    pl->uaddr += job->datalen;
+
+    if (pl->idxfp)
+    {
+        put_le(entry, pl->caddr, 8);
+        put_le(entry + 8, pl->uaddr, 8);
+
+        if (fwrite(entry, 1, 16, pl->idxfp) != 16)
+            return 0;
+
+        pl->nindex++;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  writer_thread(arg) - Write blocks out in order as they're finished
+ */
+
+static void *writer_thread(void *arg)
+{
+    Pipeline *pl = (Pipeline *)arg;
+    Bgzfjob *job;
+    int ok;
+
+    pthread_mutex_lock(&pl->lock);
+
+    while (1)
+    {
+        job = &pl->jobs[pl->nwritten % pl->njobs];
+
+        while (pl->nwritten < pl->nfilled && !job->done)
+            pthread_cond_wait(&pl->changed, &pl->lock);
+
+        if (pl->nwritten == pl->nfilled)
+        {
+            if (pl->finished)
+                break;
+
+            pthread_cond_wait(&pl->changed, &pl->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pl->lock);
+
+        ok = pl->failed || write_block(pl, job);
+
+        pthread_mutex_lock(&pl->lock);
+
+        if (!ok)
+            pl->failed = errno ? errno : EIO;
+
+        pl->nwritten++;
+        pthread_cond_broadcast(&pl->changed);
+    }
+
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+
+
+
+/*
+ *  pipeline_next(pl) - Hand over the block being filled, if it has
+ *                      anything in it, and wait for a free one
+ *
+ *  Returns: the block to fill next
+ */
+
+static Bgzfjob *pipeline_next(Pipeline *pl)
+{
+    Bgzfjob *job;
+
+    pthread_mutex_lock(&pl->lock);
+
+    if (pl->jobs[pl->nfilled % pl->njobs].datalen)
+    {
+        pl->nfilled++;
+        pthread_cond_broadcast(&pl->changed);
+    }
+
+    while (pl->nfilled - pl->nwritten >= pl->njobs)
+        pthread_cond_wait(&pl->changed, &pl->lock);
+
+    job = &pl->jobs[pl->nfilled % pl->njobs];
+    job->datalen = 0;
+    job->done = 0;
+
+    pthread_mutex_unlock(&pl->lock);
+    return job;
+}
+
+
+
+
+/*
+ *  Decompressed output goes into the block being filled
+ */
+
+typedef struct
+{
+    Pipeline *pl;
+    Bgzfjob *job;
+    unsigned long long total;   /* Bytes out of the current member */
+
+} Reader;
+
+
+static size_t reader_put(void *par, void *buf, size_t nbytes)
+{
+    Reader *rd = (Reader *)par;
+    unsigned char *src = (unsigned char *)buf;
+    size_t left = nbytes, room;
+
+    if (rd->pl->failed)
+        return 0;
+
+    while (left)
+    {
+        room = BGZF_DATA_MAX - rd->job->datalen;
+        if (room > left)
+            room = left;
+
+        memcpy(rd->job->data + rd->job->datalen, src, room);
+        rd->job->datalen += room;
+        src += room;
+        left -= room;
+
+        if (rd->job->datalen == BGZF_DATA_MAX)
+            rd->job = pipeline_next(rd->pl);
+    }
+
+    rd->total += nbytes;
+    return nbytes;
+}
+
+
+
+
+/*
+ *  gz_header(fp) - Read past a gzip member header
+ *
+ *  Returns:  1 on success
+ *            0 at the end of input, before any header
+ *            -1 if it isn't a gzip header
+ */
+
+static int gz_header(FILE *fp)
+{
+    int c, flags, i, xlen;
+
+    if ((c = getc(fp)) == EOF)
+        return 0;
+
+    if (c != 0x1F || getc(fp) != 0x8B || getc(fp) != 8)
+        return -1;
+
+    if ((flags = getc(fp)) == EOF || (flags & GZ_FRESERVED))
+        return -1;
+
+    for (i = 0; i < 6; i++)     /* MTIME, XFL, OS */
+    {
+        if (getc(fp) == EOF)
+            return -1;
+    }
+
+    if (flags & GZ_FEXTRA)
+    {
+        xlen = getc(fp);
+        xlen |= getc(fp) << 8;
+
+        while (xlen-- > 0)
+        {
+            if (getc(fp) == EOF)
+                return -1;
+        }
+    }
+
+    if (flags & GZ_FNAME)
+    {
+        while ((c = getc(fp)) != 0)
+        {
+            if (c == EOF)
+                return -1;
+        }
+    }
+
+    if (flags & GZ_FCOMMENT)
+    {
+        while ((c = getc(fp)) != 0)
+        {
+            if (c == EOF)
+                return -1;
+        }
+    }
+
+    if ((flags & GZ_FHCRC) && (getc(fp) == EOF || getc(fp) == EOF))
+        return -1;
+
+    return 1;
+}
+
+
+
+
+/*
+ *  gz_trailer(fp, crc, size) - Check a gzip member trailer
+ *
+ *  Returns: 1 if it matches, 0 if not
+ */
+
+static int gz_trailer(FILE *fp, unsigned int crc, unsigned long long size)
+{
+    unsigned char tr[8];
+    unsigned int tcrc, tsize;
+
+    if (fread(tr, 1, 8, fp) != 8)
+        return 0;
+
+    tcrc = tr[0] | tr[1] << 8 | tr[2] << 16 | (unsigned int)tr[3] << 24;
+    tsize = tr[4] | tr[5] << 8 | tr[6] << 16 | (unsigned int)tr[7] << 24;
+
+    return tcrc == crc && tsize == (unsigned int)size;
+}
+
+
+
+
+/*
+ *  transcode(infp, pl) - Decompress every member of infp into pl
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int transcode(FILE *infp, Pipeline *pl)
+{
+    Reader rd;
+    void *state;
+    unsigned int crc;
+    int ret, members = 0;
+
+    if ((state = clz_create()) == NULL)
+    {
+        perror("clz_bgzf");
+        return 0;
+    }
+
+    rd.pl = pl;
+    rd.job = pipeline_next(pl);
+
+    clz_setcb_put(state, reader_put, &rd);
+
+    while ((ret = gz_header(infp)) > 0)
+    {
+        rd.total = 0;
+
+        /* clz gives back anything it read past the end of the deflate
+           data, so the trailer follows */
+
+        if (!clz_setcb_get(state, NULL, infp, 0) ||
+            !clz_decompress(state, NULL, &crc))
+        {
+            if (!pl->failed)
+                fprintf(stderr, "clz_bgzf: %s: %s\n", g_infile,
+                        strerror(errno));
+            break;
+        }
+
+        if (!gz_trailer(infp, crc, rd.total))
+        {
+            fprintf(stderr, "clz_bgzf: %s: bad gzip trailer\n", g_infile);
+            ret = -1;
+            break;
+        }
+
+        members++;
+    }
+
+    if (ret < 0 && !members)
+        fprintf(stderr, "clz_bgzf: %s: not in gzip format\n", g_infile);
+    else if (ret < 0)
+        fprintf(stderr, "clz_bgzf: %s: trailing garbage\n", g_infile);
+
+    /* Hand over the last block, if any, and let the threads finish */
+
+    pipeline_next(pl);
+
+    pthread_mutex_lock(&pl->lock);
+    pl->finished = 1;
+    pthread_cond_broadcast(&pl->changed);
+    pthread_mutex_unlock(&pl->lock);
+
+    clz_destroy(state);
+    return ret == 0;
+}
+
+
+
+
+static void bgzf_help(void)
+{
+    printf( "\n"
+            "clz_bgzf usage:\n"
+            "   clz_bgzf [-l level] [-t threads] [-I] [-i index] [in.gz] out.gz\n"
+            "\n"
+            "   -l level    Deflate level, 1 to 9 (default %d)\n"
+            "   -t threads  Deflate threads (default one per CPU)\n"
+            "   -I          Don't write an index\n"
+            "   -i index    Index file (default out.gz.gzi)\n"
+            "\n"
+            "   Use - for stdin or stdout. There is no index for stdout\n"
+            "   unless -i is given.\n"
+            "\n", BGZF_DEF_LEVEL);
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+    Pipeline pl;
+    pthread_t workers[BGZF_MAX_THREADS], writer;
+    const char *idxfile = NULL;
+    char *idxname = NULL;
+    FILE *infp;
+    unsigned char count[8];
+    int opt, i, nthreads = 0, noindex = 0, ok;
+
+    memset(&pl, 0, sizeof(pl));
+    pl.level = BGZF_DEF_LEVEL;
+
+    while ((opt = getopt(argc, argv, "hl:t:Ii:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                pl.level = atoi(optarg);
+                break;
+
+            case 't':
+                nthreads = atoi(optarg);
+                break;
+
+            case 'I':
+                noindex = 1;
+                break;
+
+            case 'i':
+                idxfile = optarg;
+                break;
+
+            default:
+                bgzf_help();
+                return 1;
+        }
+    }
+
+    if (argc - optind == 2)
+        g_infile = argv[optind++];
+
+    if (argc - optind != 1 || pl.level < 1 || pl.level > 9)
+    {
+        bgzf_help();
+        return 1;
+    }
+
+    g_outfile = argv[optind];
+
+    if (nthreads <= 0)
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+    if (nthreads > BGZF_MAX_THREADS)
+        nthreads = BGZF_MAX_THREADS;
+
+    infp = strcmp(g_infile, "-") ? fopen(g_infile, "rb") : stdin;
+    if (!infp)
+    {
+        fprintf(stderr, "clz_bgzf: %s: %s\n", g_infile, strerror(errno));
+        return 1;
+    }
+
+    pl.outfp = strcmp(g_outfile, "-") ? fopen(g_outfile, "wb") : stdout;
+    if (!pl.outfp)
+    {
+        fprintf(stderr, "clz_bgzf: %s: %s\n", g_outfile, strerror(errno));
+        return 1;
+    }
+
+    if (!noindex && !idxfile && strcmp(g_outfile, "-"))
+    {
+        if ((idxname = malloc(strlen(g_outfile) + 5)) == NULL)
+        {
+            perror("clz_bgzf");
+            return 1;
+        }
+        sprintf(idxname, "%s.gzi", g_outfile);
+        idxfile = idxname;
+    }
+
+    if (!noindex && idxfile)
+    {
+        /* The count goes at the front once it's known */
+
+        memset(count, 0, sizeof(count));
+
+        if ((pl.idxfp = fopen(idxfile, "wb")) == NULL ||
+            fwrite(count, 1, 8, pl.idxfp) != 8)
+        {
+            fprintf(stderr, "clz_bgzf: %s: %s\n", idxfile, strerror(errno));
+            return 1;
+        }
+    }
+
+    pl.njobs = nthreads * BGZF_JOBS_PER_THREAD;
+
+    if ((pl.jobs = calloc(pl.njobs, sizeof(Bgzfjob))) == NULL)
+    {
+        perror("clz_bgzf");
+        return 1;
+    }
+
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.changed, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&workers[i], NULL, worker_thread, &pl) != 0)
+            break;
+    }
+
+    if ((nthreads = i) == 0 ||
+        pthread_create(&writer, NULL, writer_thread, &pl) != 0)
+    {
+        fprintf(stderr, "clz_bgzf: can't start threads\n");
+        return 1;
+    }
+
+    ok = transcode(infp, &pl);
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(workers[i], NULL);
+    pthread_join(writer, NULL);
+
+    if (pl.failed)
+        fprintf(stderr, "clz_bgzf: %s: %s\n", g_outfile, strerror(pl.failed));
+
+    ok = ok && !pl.failed &&
+         fwrite(g_bgzf_eof, 1, sizeof(g_bgzf_eof), pl.outfp) ==
+                                                    sizeof(g_bgzf_eof);
+
+    if (fclose(pl.outfp) != 0)
+        ok = 0;
+
+    if (pl.idxfp)
+    {
+        /* The last member's end isn't the start of anything */
+
+        if (pl.nindex)
+            pl.nindex--;
+
+        put_le(count, pl.nindex, 8);
+
+        if (fflush(pl.idxfp) != 0 ||
+            ftruncate(fileno(pl.idxfp), 8 + 16 * pl.nindex) != 0 ||
+            fseek(pl.idxfp, 0, SEEK_SET) != 0 ||
+            fwrite(count, 1, 8, pl.idxfp) != 8 || fclose(pl.idxfp) != 0)
+        {
+            fprintf(stderr, "clz_bgzf: %s: %s\n", idxfile, strerror(errno));
+            ok = 0;
+        }
+    }
+
+    if (infp != stdin)
+        fclose(infp);
+
+    free(pl.jobs);
+    free(idxname);
+    return ok ? 0 : 1;
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
@@ -0,0 +1,1790 @@
+/*
+ *  clzcli - clz command line: decompress .gz, .zip and raw deflate files
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  Each input is mapped into memory and handed to clz a large slice at
+ *  a time, so nothing is copied on the way in. Output goes through an
+ *  output sink (clzsink.c) from a 1MB ring, so it comes out in large
+ *  writes, or is spliced when it's a pipe.
+ *
+ *  Inputs are spread over a pool of threads, each with its own deque
+ *  of jobs. A thread works through its own deque from the front and,
+ *  when that runs dry, steals from the back of someone else's. A zip
+ *  file starts as a single job which, when run, adds a job per entry
+ *  to the front of its thread's deque where idle threads can steal
+ *  them. With -c, output has to come out in order, so jobs on other
+ *  threads spool to temporary files that the main thread copies to
+ *  stdout as each turn comes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "crc32.h"
+#include "clz.h"
+
+
+#define CLI_RING_SIZE       (1024 * 1024)
+#define CLI_SLICE_MAX       (256 * 1024 * 1024)  /* Input per getfn call */
+#define CLI_COPY_SIZE       (1024 * 1024)
+#define CLI_MAX_THREADS     256
+
+#define IN_GZIP             0
+#define IN_ZIP              1
+#define IN_RAW              2
+
+/* gzip header flags */
+
+#define GZ_FHCRC            0x02
+#define GZ_FEXTRA           0x04
+#define GZ_FNAME            0x08
+#define GZ_FCOMMENT         0x10
+#define GZ_FRESERVED        0xE0
+
+/* zip signatures and fields */
+
+#define ZIP_LOCAL_SIG       0x04034B50
+#define ZIP_CENTRAL_SIG     0x02014B50
+#define ZIP_EOCD_SIG        0x06054B50
+#define ZIP_EOCD64_SIG      0x06064B50
+#define ZIP_LOC64_SIG       0x07064B50
+#define ZIP_LOCAL_SIZE      30
+#define ZIP_CENTRAL_SIZE    46
+#define ZIP_EOCD_SIZE       22
+#define ZIP_FLAG_ENCRYPTED  0x0001
+#define ZIP_STORED          0
+#define ZIP_DEFLATED        8
+
+
+typedef struct Clzjob Clzjob;
+
+
+/*
+ *  One input file. Its jobs are known once it's expanded: a gzip or
+ *  raw file is one job from the start, a zip is one per entry once
+ *  its central directory has been read.
+ */
+
+typedef struct
+{
+    const char *path;
+    int type;                   /* IN_* */
+
+    int fd;
+    const unsigned char *map;
+    size_t maplen;
+    FILE *fp;                   /* A pipe or stdin, read as it comes */
+
+    Clzjob **jobs;
+    int njobs;
+    int expanded;
+    int failed;
+
+} Clzinput;
+
+
+struct Clzjob
+{
+    Clzinput *in;
+    int expand;                 /* Read the zip central directory */
+
+    const char *name;           /* Zip entry name */
+    const unsigned char *data;  /* Zip entry data */
+    unsigned long long csize;
+    unsigned long long usize;
+    unsigned int crc;
+    int method;
+
+    FILE *spool;                /* Output waiting for its turn (-c) */
+    int done;
+    int failed;
+
+    unsigned long long bytesin;
+    unsigned long long bytesout;
+    double secs;
+};
+
+
+/*
+ *  A thread's jobs. It takes from the front, thieves take from the back
+ */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    Clzjob **jobs;
+    int head, count, max;       /* Ring of max */
+
+} Deque;
+
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    void *state;
+    Deque deque;
+
+} Worker;
+
+
+/*
+ *  Where a job's output goes
+ */
+
+typedef struct
+{
+    int fd;
+    void *sink;
+    char *path;                 /* Output file, NULL if stdout/spool */
+
+} Output;
+
+
+/*
+ *  Input handed to clz a slice at a time
+ */
+
+typedef struct
+{
+    const unsigned char *p;
+    unsigned long long left;
+
+} Mapsrc;
+
+
+static int g_test, g_stdout, g_keep, g_force, g_quiet;
+static int g_direct;            /* -c straight to stdout, no spooling */
+static void *g_stdout_sink;     /* With g_direct, one sink for the run */
+static int g_nworkers;
+static Worker *g_workers;
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_cond = PTHREAD_COND_INITIALIZER;
+static int g_outstanding;       /* Jobs queued or running */
+
+
+
+
+/*
+ *  get_le(p, nbytes) - Little endian value at p
+ */
+
+static unsigned long long get_le(const unsigned char *p, int nbytes)
+{
+    unsigned long long val = 0;
+
+    while (nbytes--)
+        val = (val << 8) | p[nbytes];
+
+    return val;
+}
+
+
+
+
+static double now_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+
+/*
+ *  Job deques
+ *  ----------
+ */
+
+static int deque_grow(Deque *dq)
+{
+    int newmax = dq->max ? dq->max * 2 : 16, i;
+    Clzjob **newjobs;
+
+    if ((newjobs = malloc(newmax * sizeof(Clzjob *))) == NULL)
+        return 0;
+
+    for (i = 0; i < dq->count; i++)
+        newjobs[i] = dq->jobs[(dq->head + i) % dq->max];
+
+    free(dq->jobs);
+    dq->jobs = newjobs;
+    dq->head = 0;
+    dq->max = newmax;
+    return 1;
+}
+
+
+
+
+/*
+ *  deque_push(dq, job, front) - Add a job at the back, or the front
+ *
+ *  Returns: 1 on success, 0 if out of memory
+ */
+
+static int deque_push(Deque *dq, Clzjob *job, int front)
+{
+    int ok = 1;
+
+    pthread_mutex_lock(&dq->lock);
+
+    if (dq->count == dq->max)
+        ok = deque_grow(dq);
+
+    if (ok && front)
+    {
+        dq->head = (dq->head + dq->max - 1) % dq->max;
+        dq->jobs[dq->head] = job;
+        dq->count++;
+    }
+    else if (ok)
+    {
+        dq->jobs[(dq->head + dq->count++) % dq->max] = job;
+    }
+
+    pthread_mutex_unlock(&dq->lock);
+    return ok;
+}
+
+
+
+
+/*
+ *  deque_take(dq, back) - Take the job at the front (or the back)
+ *
+ *  Returns: the job, or NULL if there isn't one
+ */
+
+static Clzjob *deque_take(Deque *dq, int back)
+{
+    Clzjob *job = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+
+    if (dq->count && back)
+    {
+        job = dq->jobs[(dq->head + --dq->count) % dq->max];
+    }
+    else if (dq->count)
+    {
+        job = dq->jobs[dq->head];
+        dq->head = (dq->head + 1) % dq->max;
+        dq->count--;
+    }
+
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+
+
+
+/*
+ *  find_job(w) - The next job from our own deque, or one stolen
+ *
+ *  Returns: the job, or NULL if there's nothing anywhere
+ */
+
+static Clzjob *find_job(Worker *w)
+{
+    Clzjob *job;
+    int i;
+
+    if ((job = deque_take(&w->deque, 0)) != NULL)
+        return job;
+
+    for (i = 1; i < g_nworkers; i++)
+    {
+        job = deque_take(&g_workers[(w->id + i) % g_nworkers].deque, 1);
+        if (job)
+            return job;
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+ *  Output
+ *  ------
+ */
+
+/*
+ *  make_dirs(path) - Create the directories leading up to path
+ */
+
+static void make_dirs(const char *path)
+{
+    char *dir, *p;
+
+    if ((dir = strdup(path)) == NULL)
+        return;
+
+    for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/'))
+    {
+        *p = 0;
+        mkdir(dir, 0777);
+        *p = '/';
+    }
+
+    free(dir);
+}
+
+
+
+
+/*
+ *  output_open(job, path, out) - Open somewhere for job's output
+ *
+ *  That's path, or stdout with -c, or a spool file with -c when the
+ *  job may finish out of turn. With -t there's nowhere.
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int output_open(Clzjob *job, const char *path, Output *out)
+{
+    memset(out, 0, sizeof(Output));
+    out->fd = -1;
+
+    if (g_test)
+        return 1;
+
+    if (g_direct)
+    {
+        out->fd = STDOUT_FILENO;
+        out->sink = g_stdout_sink;
+        return 1;
+    }
+
+    if (g_stdout)
+    {
+        if ((job->spool = tmpfile()) == NULL)
+        {
+            fprintf(stderr, "clz: spool file: %s\n", strerror(errno));
+            return 0;
+        }
+        out->fd = fileno(job->spool);
+    }
+    else
+    {
+        out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC |
+                             (g_force ? 0 : O_EXCL), 0666);
+
+        if (out->fd < 0)
+        {
+            fprintf(stderr, "clz: %s: %s\n", path, strerror(errno));
+            return 0;
+        }
+
+        out->path = strdup(path);
+    }
+
+    if ((out->sink = clz_sink_create(out->fd)) == NULL)
+    {
+        fprintf(stderr, "clz: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  output_close(out, ok) - Finish with an output, removing it on failure
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int output_close(Output *out, int ok)
+{
+    if (out->sink)
+    {
+        if (ok && !clz_sink_flush(out->sink))
+        {
+            fprintf(stderr, "clz: %s: %s\n",
+                    out->path ? out->path : "stdout", strerror(errno));
+            ok = 0;
+        }
+        if (out->sink != g_stdout_sink)
+            clz_sink_destroy(out->sink);
+    }
+
+    if (out->path)
+    {
+        if (close(out->fd) != 0 && ok)
+        {
+            fprintf(stderr, "clz: %s: %s\n", out->path, strerror(errno));
+            ok = 0;
+        }
+
+        if (!ok)
+            unlink(out->path);
+
+        free(out->path);
+    }
+
+    return ok;
+}
+
+
+
+
+/*
+ *  output_name(path, type) - Work out the output file name for an input
+ *
+ *  .gz and .tgz are taken off (or made .tar) and .deflate taken off a
+ *  raw file. Anything else gets .out added.
+ *
+ *  Returns: the name (free it), or NULL if out of memory
+ */
+
+static char *output_name(const char *path, int type)
+{
+    static const struct
+    {
+        const char *from, *to;
+        int type;
+
+    } suffixes[] = {
+        { ".gz",        "",     IN_GZIP },
+        { ".tgz",       ".tar", IN_GZIP },
+        { ".deflate",   "",     IN_RAW  },
+    };
+    size_t len = strlen(path), slen;
+    char *name;
+    int i;
+
+    if ((name = malloc(len + 5)) == NULL)
+        return NULL;
+
+    strcpy(name, path);
+
+    for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++)
+    {
+        slen = strlen(suffixes[i].from);
+
+        if (type == suffixes[i].type && len > slen &&
+            strcmp(path + len - slen, suffixes[i].from) == 0)
+        {
+            strcpy(name + len - slen, suffixes[i].to);
+            return name;
+        }
+    }
+
+    strcat(name, ".out");
+    return name;
+}
+
+
+
+
+/*
+ *  Decompression
+ *  -------------
+ */
+
+static size_t map_get(void *par, unsigned char **bufp)
+{
+    Mapsrc *src = (Mapsrc *)par;
+    size_t n = src->left < CLI_SLICE_MAX ? src->left : CLI_SLICE_MAX;
+
+    *bufp = (unsigned char *)src->p;
+    src->p += n;
+    src->left -= n;
+    return n;
+}
+
+
+
+
+/*
+ *  inflate_error(err) - Say what went wrong in inflate_to()
+ *
+ *  Returns: a message for errno value err
+ */
+
+static const char *inflate_error(int err)
+{
+    switch (err)
+    {
+        case EIO:
+            return "unexpected end of input";
+
+        case EILSEQ:
+            return "invalid deflate data";
+
+        case ERANGE:
+            return "output error";
+
+        default:
+            return strerror(err);
+    }
+}
+
+
+
+
+/*
+ *  inflate_run(w, out, resp) - Inflate from wherever the input is set up
+ *
+ *  Stops at the end of the deflate data. resp has how much was used and
+ *  made, and the CRC32. With -t there's no output, just the check.
+ *
+ *  Returns: 1 on success, 0 on error and sets errno
+ */
+
+static int inflate_run(Worker *w, Output *out, clz_result *resp)
+{
+    int ret;
+
+    if (out->sink)
+    {
+        clz_setcb_put(w->state, clz_sink_put, out->sink);
+        ret = clz_decompress(w->state, NULL, NULL);
+    }
+    else
+        ret = clz_verify(w->state, NULL, NULL);
+
+    return ret && clz_get_result(w->state, resp);
+}
+
+
+
+
+/*
+ *  inflate_to(w, p, len, out, resp) - Inflate the deflate data at p
+ *
+ *  As inflate_run(). The deflate data may end short of len.
+ *
+ *  Returns: 1 on success, 0 on error and sets errno
+ */
+
+static int inflate_to(Worker *w, const unsigned char *p, unsigned long long len,
+                      Output *out, clz_result *resp)
+{
+    Mapsrc src;
+
+    src.p = p;
+    src.left = len;
+
+    return clz_setcb_get(w->state, map_get, &src, 1) &&
+           inflate_run(w, out, resp);
+}
+
+
+
+
+/*
+ *  gz_header(p, len) - Size of the gzip member header at p
+ *
+ *  Returns:  the header size on success
+ *            0 if it isn't a (complete) gzip header
+ */
+
+static size_t gz_header(const unsigned char *p, size_t len)
+{
+    size_t pos = 10;
+    int flags;
+
+    if (len < 10 || p[0] != 0x1F || p[1] != 0x8B || p[2] != 8 ||
+        (p[3] & GZ_FRESERVED))
+        return 0;
+
+    flags = p[3];
+
+    if (flags & GZ_FEXTRA)
+    {
+        if (len < pos + 2)
+            return 0;
+        pos += 2 + get_le(p + pos, 2);
+    }
+
+    if (flags & GZ_FNAME)
+    {
+        while (pos < len && p[pos])
+            pos++;
+        pos++;
+    }
+
+    if (flags & GZ_FCOMMENT)
+    {
+        while (pos < len && p[pos])
+            pos++;
+        pos++;
+    }
+
+    if (flags & GZ_FHCRC)
+        pos += 2;
+
+    return pos <= len ? pos : 0;
+}
+
+
+
+
+/*
+ *  run_gzip(w, job, out) - Decompress every member of a gzip file
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_gzip(Worker *w, Clzjob *job, Output *out)
+{
+    Clzinput *in = job->in;
+    clz_result res;
+    size_t pos = 0, hdr;
+
+    do {
+        if ((hdr = gz_header(in->map + pos, in->maplen - pos)) == 0)
+        {
+            if (pos == 0)
+            {
+                fprintf(stderr, "clz: %s: not in gzip format\n", in->path);
+                return 0;
+            }
+
+            fprintf(stderr, "clz: %s: trailing garbage ignored\n", in->path);
+            break;
+        }
+
+        pos += hdr;
+
+        if (!inflate_to(w, in->map + pos, in->maplen - pos, out, &res))
+        {
+            fprintf(stderr, "clz: %s: %s\n", in->path, inflate_error(errno));
+            return 0;
+        }
+
+        pos += res.bytes_in;
+
+        if (in->maplen - pos < 8 ||
+            get_le(in->map + pos, 4) != res.crc32 ||
+            get_le(in->map + pos + 4, 4) != (res.bytes_out & 0xFFFFFFFF))
+        {
+            fprintf(stderr, "clz: %s: bad gzip trailer\n", in->path);
+            return 0;
+        }
+
+        pos += 8;
+        job->bytesout += res.bytes_out;
+
+    } while (pos < in->maplen);
+
+    job->bytesin = in->maplen;
+    return 1;
+}
+
+
+
+
+/*
+ *  run_raw(w, job, out) - Decompress a raw deflate file
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_raw(Worker *w, Clzjob *job, Output *out)
+{
+    Clzinput *in = job->in;
+    clz_result res;
+
+    if (!inflate_to(w, in->map, in->maplen, out, &res))
+    {
+        fprintf(stderr, "clz: %s: %s\n", in->path, inflate_error(errno));
+        return 0;
+    }
+
+    if (res.bytes_in < in->maplen)
+        fprintf(stderr, "clz: %s: trailing garbage ignored\n", in->path);
+
+    job->bytesin = in->maplen;
+    job->bytesout = res.bytes_out;
+    return 1;
+}
+
+
+
+
+/*
+ *  run_zip_entry(w, job, out) - Decompress (or copy) one zip entry
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_zip_entry(Worker *w, Clzjob *job, Output *out)
+{
+    clz_result res;
+
+    if (job->method == ZIP_STORED)
+    {
+        res.bytes_in = res.bytes_out = job->csize;
+        res.crc32 = crc32(0, job->data, job->csize);
+
+        if (out->sink && clz_sink_put(out->sink, (void *)job->data,
+                                      job->csize) != job->csize)
+        {
+            fprintf(stderr, "clz: %s: %s\n", job->name, strerror(errno));
+            return 0;
+        }
+    }
+    else if (!inflate_to(w, job->data, job->csize, out, &res))
+    {
+        fprintf(stderr, "clz: %s: %s: %s\n", job->in->path, job->name,
+                inflate_error(errno));
+        return 0;
+    }
+
+    if (res.bytes_in != job->csize || res.bytes_out != job->usize ||
+        res.crc32 != job->crc)
+    {
+        fprintf(stderr, "clz: %s: %s: bad CRC or size\n", job->in->path,
+                job->name);
+        return 0;
+    }
+
+    job->bytesin = job->csize;
+    job->bytesout = res.bytes_out;
+    return 1;
+}
+
+
+
+
+/*
+ *  gz_header_fp(fp) - Read past a gzip member header on fp
+ *
+ *  Returns:  the header size on success
+ *            0 if it isn't a (complete) gzip header
+ */
+
+static size_t gz_header_fp(FILE *fp)
+{
+    unsigned char hdr[10];
+    size_t size = 10;
+    int c, n;
+
+    if (fread(hdr, 1, 10, fp) != 10 || hdr[0] != 0x1F || hdr[1] != 0x8B ||
+        hdr[2] != 8 || (hdr[3] & GZ_FRESERVED))
+        return 0;
+
+    if (hdr[3] & GZ_FEXTRA)
+    {
+        n = getc(fp);
+        n |= getc(fp) << 8;
+
+        for (size += 2 + n; n > 0; n--)
+            getc(fp);
+    }
+
+    for (c = hdr[3] & GZ_FNAME; c && c != EOF; size++)
+        c = getc(fp);
+
+    for (c = hdr[3] & GZ_FCOMMENT; c && c != EOF; size++)
+        c = getc(fp);
+
+    if (hdr[3] & GZ_FHCRC)
+    {
+        getc(fp);
+        getc(fp);
+        size += 2;
+    }
+
+    return feof(fp) || ferror(fp) ? 0 : size;
+}
+
+
+
+
+/*
+ *  run_stream_gzip(w, job, out) - Decompress a gzip file as it comes
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_stream_gzip(Worker *w, Clzjob *job, Output *out)
+{
+    Clzinput *in = job->in;
+    unsigned char trailer[8];
+    clz_result res;
+    size_t hdr;
+    int c;
+
+    if (!clz_setcb_get(w->state, NULL, in->fp, 0))
+        return 0;
+
+    do {
+        if ((hdr = gz_header_fp(in->fp)) == 0)
+        {
+            fprintf(stderr, "clz: %s: %s\n", in->path, job->bytesin ?
+                    "trailing garbage ignored" : "not in gzip format");
+            return job->bytesin != 0;
+        }
+
+        if (!inflate_run(w, out, &res))
+        {
+            fprintf(stderr, "clz: %s: %s\n", in->path, inflate_error(errno));
+            return 0;
+        }
+
+        if (fread(trailer, 1, 8, in->fp) != 8 ||
+            get_le(trailer, 4) != res.crc32 ||
+            get_le(trailer + 4, 4) != (res.bytes_out & 0xFFFFFFFF))
+        {
+            fprintf(stderr, "clz: %s: bad gzip trailer\n", in->path);
+            return 0;
+        }
+
+        job->bytesin += hdr + res.bytes_in + 8;
+        job->bytesout += res.bytes_out;
+
+    } while ((c = getc(in->fp)) != EOF && ungetc(c, in->fp) != EOF);
+
+    return 1;
+}
+
+
+
+
+/*
+ *  run_stream_raw(w, job, out) - Decompress a raw deflate file as it comes
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_stream_raw(Worker *w, Clzjob *job, Output *out)
+{
+    Clzinput *in = job->in;
+    clz_result res;
+
+    if (!clz_setcb_get(w->state, NULL, in->fp, 0) ||
+        !inflate_run(w, out, &res))
+    {
+        fprintf(stderr, "clz: %s: %s\n", in->path, inflate_error(errno));
+        return 0;
+    }
+
+    if (getc(in->fp) != EOF)
+        fprintf(stderr, "clz: %s: trailing garbage ignored\n", in->path);
+
+    job->bytesin = res.bytes_in;
+    job->bytesout = res.bytes_out;
+    return 1;
+}
+
+
+
+
+/*
+ *  zip_central(in, cdp, nentriesp) - Find a zip's central directory
+ *
+ *  Returns: 1 on success, 0 if it can't be found
+ */
+
+static int zip_central(Clzinput *in, const unsigned char **cdp,
+                       unsigned long long *nentriesp)
+{
+    const unsigned char *p = in->map, *eocd = NULL;
+    unsigned long long cdoff, n;
+    size_t i;
+
+    if (in->maplen < ZIP_EOCD_SIZE)
+        return 0;
+
+    /* The end record is last, bar a comment of up to 64K */
+
+    for (i = in->maplen - ZIP_EOCD_SIZE; ; i--)
+    {
+        if (get_le(p + i, 4) == ZIP_EOCD_SIG)
+        {
+            eocd = p + i;
+            break;
+        }
+
+        if (i == 0 || in->maplen - i > ZIP_EOCD_SIZE + 0xFFFF)
+            return 0;
+    }
+
+    n = get_le(eocd + 10, 2);
+    cdoff = get_le(eocd + 16, 4);
+
+    /* Zip64: the real values are in the zip64 end record */
+
+    if ((n == 0xFFFF || cdoff == 0xFFFFFFFF) && eocd - p >= 20 &&
+        get_le(eocd - 20, 4) == ZIP_LOC64_SIG)
+    {
+        unsigned long long off = get_le(eocd - 20 + 8, 8);
+
+        if (in->maplen < 56 || off > in->maplen - 56 ||
+            get_le(p + off, 4) != ZIP_EOCD64_SIG)
+            return 0;
+
+        n = get_le(p + off + 32, 8);
+        cdoff = get_le(p + off + 48, 8);
+    }
+
+    if (cdoff > in->maplen)
+        return 0;
+
+    *cdp = p + cdoff;
+    *nentriesp = n;
+    return 1;
+}
+
+
+
+
+/*
+ *  zip_zip64(extra, len, job, offp) - Pick up zip64 sizes and offset
+ *
+ *  Only the fields that are all ones in the central entry are there,
+ *  in this order.
+ */
+
+static void zip_zip64(const unsigned char *extra, size_t len, Clzjob *job,
+                      unsigned long long *offp)
+{
+    size_t pos = 0, dlen, at;
+
+    while (pos + 4 <= len)
+    {
+        dlen = get_le(extra + pos + 2, 2);
+
+        if (get_le(extra + pos, 2) == 1 && pos + 4 + dlen <= len)
+        {
+            at = pos + 4;
+
+            if (job->usize == 0xFFFFFFFF && at + 8 <= pos + 4 + dlen)
+                job->usize = get_le(extra + at, 8), at += 8;
+            if (job->csize == 0xFFFFFFFF && at + 8 <= pos + 4 + dlen)
+                job->csize = get_le(extra + at, 8), at += 8;
+            if (*offp == 0xFFFFFFFF && at + 8 <= pos + 4 + dlen)
+                *offp = get_le(extra + at, 8);
+            return;
+        }
+
+        pos += 4 + dlen;
+    }
+}
+
+
+
+
+/*
+ *  run_zip_expand(w, job) - Make a job for each entry in a zip file
+ *
+ *  Entries go on the front of this thread's deque, in order, so this
+ *  thread does them next unless someone steals them first.
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_zip_expand(Worker *w, Clzjob *job)
+{
+    Clzinput *in = job->in;
+    const unsigned char *cd, *end = in->map + in->maplen, *loc;
+    unsigned long long n, i, off;
+    size_t namelen, extralen;
+    Clzjob *jobs, **jobps;
+    char *name;
+
+    if (!zip_central(in, &cd, &n) || n > in->maplen / ZIP_CENTRAL_SIZE)
+    {
+        fprintf(stderr, "clz: %s: no zip central directory\n", in->path);
+        return 0;
+    }
+
+    jobs = calloc(n ? n : 1, sizeof(Clzjob));
+    jobps = calloc(n ? n : 1, sizeof(Clzjob *));
+
+    if (!jobs || !jobps)
+    {
+        fprintf(stderr, "clz: %s\n", strerror(errno));
+        return 0;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        Clzjob *ej = &jobs[i];
+
+        if (end - cd < ZIP_CENTRAL_SIZE || get_le(cd, 4) != ZIP_CENTRAL_SIG)
+            break;
+
+        namelen = get_le(cd + 28, 2);
+        extralen = get_le(cd + 30, 2);
+
+        if (end - cd < ZIP_CENTRAL_SIZE + namelen + extralen)
+            break;
+
+        ej->in = in;
+        ej->method = get_le(cd + 10, 2);
+        ej->crc = get_le(cd + 16, 4);
+        ej->csize = get_le(cd + 20, 4);
+        ej->usize = get_le(cd + 24, 4);
+        off = get_le(cd + 42, 4);
+
+        zip_zip64(cd + ZIP_CENTRAL_SIZE + namelen, extralen, ej, &off);
+
+        if ((name = malloc(namelen + 1)) == NULL)
+            break;
+        memcpy(name, cd + ZIP_CENTRAL_SIZE, namelen);
+        name[namelen] = 0;
+        ej->name = name;
+
+        if (get_le(cd + 8, 2) & ZIP_FLAG_ENCRYPTED)
+        {
+            fprintf(stderr, "clz: %s: %s: encrypted\n", in->path, name);
+            break;
+        }
+
+        /* The data follows the local header, whose extra field can
+           differ from the central one */
+
+        loc = in->map + off;
+
+        if (off > in->maplen - ZIP_LOCAL_SIZE ||
+            get_le(loc, 4) != ZIP_LOCAL_SIG)
+            break;
+
+        ej->data = loc + ZIP_LOCAL_SIZE + get_le(loc + 26, 2) +
+                   get_le(loc + 28, 2);
+
+        if (ej->data > end || end - ej->data < ej->csize)
+            break;
+
+        if (ej->method != ZIP_STORED && ej->method != ZIP_DEFLATED)
+        {
+            fprintf(stderr, "clz: %s: %s: unsupported method %d\n",
+                    in->path, name, ej->method);
+            break;
+        }
+
+        jobps[i] = ej;
+        cd += ZIP_CENTRAL_SIZE + namelen + extralen + get_le(cd + 32, 2);
+    }
+
+    if (i < n)
+    {
+        fprintf(stderr, "clz: %s: bad zip entry %llu\n", in->path, i + 1);
+        return 0;
+    }
+
+    /* Publish the entries, then queue them */
+
+    pthread_mutex_lock(&g_lock);
+    in->jobs = jobps;
+    in->njobs = n;
+    in->expanded = 1;
+    g_outstanding += n;
+    pthread_cond_broadcast(&g_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    while (n--)
+    {
+        if (!deque_push(&w->deque, jobps[n], 1))
+        {
+            fprintf(stderr, "clz: %s\n", strerror(ENOMEM));
+            exit(1);
+        }
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  zip_path(name) - Check a zip entry name is safe to extract to
+ *
+ *  Returns: 1 if so, 0 if absolute or it climbs out with ..
+ */
+
+static int zip_path(const char *name)
+{
+    const char *p;
+
+    if (name[0] == '/' || name[0] == 0)
+        return 0;
+
+    for (p = name; p; p = strchr(p, '/'))
+    {
+        if (*p == '/')
+            p++;
+
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == 0))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  run_stream_zip(w, job) - Extract a zip as it comes
+ *
+ *  Entries are read forward with clz_zip_next() rather than through the
+ *  central directory, so each is written out as it arrives. With -c
+ *  they all go to the one output, in order.
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int run_stream_zip(Worker *w, Clzjob *job)
+{
+    Clzinput *in = job->in;
+    clz_zip_entry entry;
+    clz_result res;
+    Output out;
+    void *zipp;
+    int one = g_test || g_stdout, ok = 1, ret = 0;
+    size_t nlen;
+
+    if ((zipp = clz_zip_create(in->fp)) == NULL)
+    {
+        fprintf(stderr, "clz: %s: %s\n", in->path, strerror(errno));
+        return 0;
+    }
+
+    if (one && !output_open(job, in->path, &out))
+    {
+        clz_zip_destroy(zipp);
+        return 0;
+    }
+
+    while (ok && (ret = clz_zip_next(zipp, &entry)) > 0)
+    {
+        nlen = strlen(entry.name);
+
+        if (!one && !zip_path(entry.name))
+        {
+            fprintf(stderr, "clz: %s: %s: unsafe name\n", in->path,
+                    entry.name);
+            ok = 0;
+            break;
+        }
+
+        if (!one)
+            make_dirs(entry.name);
+
+        if (nlen && entry.name[nlen - 1] == '/')
+            continue;
+
+        if (!one && !output_open(job, entry.name, &out))
+        {
+            ok = 0;
+            break;
+        }
+
+        memset(&res, 0, sizeof(res));
+
+        if (!clz_zip_read(zipp, out.sink ? clz_sink_put : NULL, out.sink,
+                          &res))
+        {
+            fprintf(stderr, "clz: %s: %s: %s\n", in->path, entry.name,
+                    errno == EILSEQ ? "bad data, CRC or size" :
+                    inflate_error(errno));
+            ok = 0;
+        }
+
+        job->bytesin += res.bytes_in;
+        job->bytesout += res.bytes_out;
+
+        if (!one && !output_close(&out, ok))
+            ok = 0;
+    }
+
+    if (ok && ret < 0)
+    {
+        fprintf(stderr, "clz: %s: %s\n", in->path, errno == EILSEQ ?
+                "not a zip, or a bad local header" : inflate_error(errno));
+        ok = 0;
+    }
+
+    if (one && !output_close(&out, ok))
+        ok = 0;
+
+    clz_zip_destroy(zipp);
+    return ok;
+}
+
+
+
+
+/*
+ *  job_run(w, job) - Run one job and record how it went
+ */
+
+static void job_run(Worker *w, Clzjob *job)
+{
+    Clzinput *in = job->in;
+    Output out;
+    char *name = NULL;
+    double start = now_secs();
+    int ok;
+
+    if (job->expand)
+    {
+        ok = run_zip_expand(w, job);
+    }
+    else if (in->fp && in->type == IN_ZIP)
+    {
+        ok = run_stream_zip(w, job);
+    }
+    else if (in->type == IN_ZIP)
+    {
+        size_t nlen = strlen(job->name);
+
+        if (!g_test && !g_stdout && !zip_path(job->name))
+        {
+            fprintf(stderr, "clz: %s: %s: unsafe name\n", in->path, job->name);
+            ok = 0;
+        }
+        else if (nlen && job->name[nlen - 1] == '/')
+        {
+            /* A directory */
+
+            if (!g_test && !g_stdout)
+                make_dirs(job->name);
+            ok = 1;
+        }
+        else
+        {
+            if (!g_test && !g_stdout)
+                make_dirs(job->name);
+
+            ok = output_open(job, job->name, &out);
+            ok = output_close(&out, ok && run_zip_entry(w, job, &out));
+        }
+    }
+    else
+    {
+        if ((name = output_name(in->path, in->type)) == NULL)
+        {
+            fprintf(stderr, "clz: %s\n", strerror(ENOMEM));
+            exit(1);
+        }
+
+        if ((ok = output_open(job, name, &out)) != 0)
+        {
+            if (in->fp)
+                ok = in->type == IN_GZIP ? run_stream_gzip(w, job, &out)
+                                         : run_stream_raw(w, job, &out);
+            else
+                ok = in->type == IN_GZIP ? run_gzip(w, job, &out)
+                                         : run_raw(w, job, &out);
+            ok = output_close(&out, ok);
+        }
+
+        free(name);
+    }
+
+    job->secs = now_secs() - start;
+
+    pthread_mutex_lock(&g_lock);
+
+    job->failed = !ok;
+    if (!ok)
+        in->failed = 1;
+
+    /* A zip that never expanded has no entries to wait for */
+
+    if (job->expand && !ok)
+        in->expanded = 1;
+
+    job->done = 1;
+    g_outstanding--;
+    pthread_cond_broadcast(&g_cond);
+
+    pthread_mutex_unlock(&g_lock);
+}
+
+
+
+
+/*
+ *  worker_thread(arg) - Run jobs until there are none left anywhere
+ */
+
+static void *worker_thread(void *arg)
+{
+    Worker *w = (Worker *)arg;
+    Clzjob *job;
+
+    while (1)
+    {
+        if ((job = find_job(w)) == NULL)
+        {
+            /* Nothing to take, but running jobs may add more */
+
+            pthread_mutex_lock(&g_lock);
+
+            while ((job = find_job(w)) == NULL && g_outstanding)
+                pthread_cond_wait(&g_cond, &g_lock);
+
+            pthread_mutex_unlock(&g_lock);
+
+            if (!job)
+                break;
+        }
+
+        job_run(w, job);
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+ *  Main
+ *  ----
+ */
+
+/*
+ *  input_open(in, path) - Map an input and work out what it is
+ *
+ *  Anything that can't be mapped (- for stdin, or a pipe) is read as
+ *  it comes instead, a zip with clz_zip_next(). Only a zip can be
+ *  extracted that way without -c, the others have no name to go to.
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int input_open(Clzinput *in, const char *path)
+{
+    struct stat st;
+    int c;
+
+    in->path = path;
+    in->map = NULL;
+    in->fp = NULL;
+
+    in->fd = strcmp(path, "-") ? open(path, O_RDONLY) : dup(STDIN_FILENO);
+
+    if (in->fd < 0 || fstat(in->fd, &st) != 0)
+    {
+        fprintf(stderr, "clz: %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "clz: %s: is a directory\n", path);
+        return 0;
+    }
+
+    if (!S_ISREG(st.st_mode))
+    {
+        if ((in->fp = fdopen(in->fd, "rb")) == NULL)
+        {
+            fprintf(stderr, "clz: %s: %s\n", path, strerror(errno));
+            return 0;
+        }
+
+        in->fd = -1;
+        c = getc(in->fp);
+        ungetc(c, in->fp);
+
+        in->type = c == 0x1F ? IN_GZIP : c == 'P' ? IN_ZIP : IN_RAW;
+
+        if (in->type != IN_ZIP && !g_stdout && !g_test)
+        {
+            fprintf(stderr, "clz: %s: not a file, use -c\n", path);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    in->maplen = st.st_size;
+
+    if (in->maplen)
+    {
+        void *map = mmap(NULL, in->maplen, PROT_READ, MAP_PRIVATE, in->fd, 0);
+
+        if (map == MAP_FAILED)
+        {
+            fprintf(stderr, "clz: %s: %s\n", path, strerror(errno));
+            return 0;
+        }
+
+        madvise(map, in->maplen, MADV_SEQUENTIAL);
+        in->map = map;
+    }
+
+    if (in->maplen >= 2 && in->map[0] == 0x1F && in->map[1] == 0x8B)
+        in->type = IN_GZIP;
+    else if (in->maplen >= 4 && (get_le(in->map, 4) == ZIP_LOCAL_SIG ||
+                                 get_le(in->map, 4) == ZIP_EOCD_SIG))
+        in->type = IN_ZIP;
+    else
+        in->type = IN_RAW;
+
+    return 1;
+}
+
+
+
+
+/*
+ *  copy_spool(job) - Copy a job's spooled output to stdout
+ *
+ *  Returns: 1 on success, 0 on error (already reported)
+ */
+
+static int copy_spool(Clzjob *job)
+{
+    static unsigned char *buf;
+    ssize_t n, w, done;
+    int fd = fileno(job->spool);
+
+    if (!buf && (buf = malloc(CLI_COPY_SIZE)) == NULL)
+        return 0;
+
+    if (lseek(fd, 0, SEEK_SET) != 0)
+        return 0;
+
+    while ((n = read(fd, buf, CLI_COPY_SIZE)) > 0)
+    {
+        for (done = 0; done < n; done += w)
+        {
+            if ((w = write(STDOUT_FILENO, buf + done, n - done)) < 0)
+            {
+                fprintf(stderr, "clz: stdout: %s\n", strerror(errno));
+                return 0;
+            }
+        }
+    }
+
+    return n == 0;
+}
+
+
+
+
+/*
+ *  write_in_order(inputs, ninputs) - Copy spooled output to stdout as
+ *                                    each job's turn comes
+ *
+ *  Returns: 1 on success, 0 if a copy failed
+ */
+
+static int write_in_order(Clzinput *inputs, int ninputs)
+{
+    Clzjob *job;
+    int i, j, ok = 1;
+
+    for (i = 0; i < ninputs; i++)
+    {
+        pthread_mutex_lock(&g_lock);
+        while (!inputs[i].expanded)
+            pthread_cond_wait(&g_cond, &g_lock);
+        pthread_mutex_unlock(&g_lock);
+
+        for (j = 0; j < inputs[i].njobs; j++)
+        {
+            job = inputs[i].jobs[j];
+
+            pthread_mutex_lock(&g_lock);
+            while (!job->done)
+                pthread_cond_wait(&g_cond, &g_lock);
+            pthread_mutex_unlock(&g_lock);
+
+            if (job->spool)
+            {
+                if (!job->failed && ok && !copy_spool(job))
+                    ok = 0;
+
+                fclose(job->spool);
+                job->spool = NULL;
+            }
+        }
+    }
+
+    return ok;
+}
+
+
+
+
+/*
+ *  report(inputs, ninputs, wall) - Per file and overall throughput
+ *
+ *  Per file MB/s is output over the time spent on it, overall is over
+ *  the wall clock, so shows what the threads bought.
+ */
+
+static void report(Clzinput *inputs, int ninputs, double wall)
+{
+    unsigned long long in, out, totin = 0, totout = 0;
+    double secs;
+    int i, j;
+
+    fprintf(stderr, "%14s %14s %9s  %s\n", "in", "out", "MB/s", "file");
+
+    for (i = 0; i < ninputs; i++)
+    {
+        in = out = 0;
+        secs = 0;
+
+        for (j = 0; j < inputs[i].njobs; j++)
+        {
+            in += inputs[i].jobs[j]->bytesin;
+            out += inputs[i].jobs[j]->bytesout;
+            secs += inputs[i].jobs[j]->secs;
+        }
+
+        totin += in;
+        totout += out;
+
+        fprintf(stderr, "%14llu %14llu %9.1f  %s%s\n", in, out,
+                secs > 0 ? out / secs / 1e6 : 0.0, inputs[i].path,
+                inputs[i].failed ? " (failed)" : "");
+    }
+
+    fprintf(stderr, "%14llu %14llu %9.1f  total, %.3fs on %d thread%s\n",
+            totin, totout, wall > 0 ? totout / wall / 1e6 : 0.0, wall,
+            g_nworkers, g_nworkers == 1 ? "" : "s");
+}
+
+
+
+
+static void cli_help(void)
+{
+    printf( "\n"
+            "clz usage:\n"
+            "   clz [-tckfq] [-j threads] file ...\n"
+            "\n"
+            "   Decompresses .gz, .zip and raw deflate files. A file.gz\n"
+            "   becomes file, zip entries are extracted into the current\n"
+            "   directory, anything else gets .out added. Use - to read\n"
+            "   stdin; a zip from a pipe is extracted as it arrives.\n"
+            "\n"
+            "   -t, --test          Check the files, don't write anything\n"
+            "   -c, --stdout        Write everything to stdout, in order\n"
+            "   -k, --keep          Keep .gz input files (others are kept)\n"
+            "   -f, --force         Overwrite existing output files\n"
+            "   -q, --quiet         No throughput report\n"
+            "   -j, --threads N     Threads (default one per CPU)\n"
+            "\n");
+}
+
+
+
+
+int main(int argc, char **argv)
+{
+    static const struct option longopts[] = {
+        { "test",       no_argument,        NULL,   't' },
+        { "stdout",     no_argument,        NULL,   'c' },
+        { "keep",       no_argument,        NULL,   'k' },
+        { "force",      no_argument,        NULL,   'f' },
+        { "quiet",      no_argument,        NULL,   'q' },
+        { "threads",    required_argument,  NULL,   'j' },
+        { "help",       no_argument,        NULL,   'h' },
+        { NULL,         0,                  NULL,   0   }
+    };
+    Clzinput *inputs;
+    Clzjob *jobs;
+    double start;
+    int opt, i, ninputs, failed = 0;
+
+    while ((opt = getopt_long(argc, argv, "tckfqj:h", longopts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                g_test = 1;
+                break;
+
+            case 'c':
+                g_stdout = 1;
+                break;
+
+            case 'k':
+                g_keep = 1;
+                break;
+
+            case 'f':
+                g_force = 1;
+                break;
+
+            case 'q':
+                g_quiet = 1;
+                break;
+
+            case 'j':
+                g_nworkers = atoi(optarg);
+                break;
+
+            default:
+                cli_help();
+                return 1;
+        }
+    }
+
+    if ((ninputs = argc - optind) <= 0)
+    {
+        cli_help();
+        return 1;
+    }
+
+    if (g_nworkers <= 0)
+        g_nworkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_nworkers <= 0)
+        g_nworkers = 1;
+    if (g_nworkers > CLI_MAX_THREADS)
+        g_nworkers = CLI_MAX_THREADS;
+
+    g_direct = g_stdout && !g_test && g_nworkers == 1;
+
+    if (g_direct && (g_stdout_sink = clz_sink_create(STDOUT_FILENO)) == NULL)
+    {
+        fprintf(stderr, "clz: stdout: %s\n", strerror(errno));
+        return 1;
+    }
+
+    inputs = calloc(ninputs, sizeof(Clzinput));
+    jobs = calloc(ninputs, sizeof(Clzjob));
+    g_workers = calloc(g_nworkers, sizeof(Worker));
+
+    if (!inputs || !jobs || !g_workers)
+    {
+        perror("clz");
+        return 1;
+    }
+
+    for (i = 0; i < g_nworkers; i++)
+    {
+        g_workers[i].id = i;
+        pthread_mutex_init(&g_workers[i].deque.lock, NULL);
+
+        if ((g_workers[i].state = clz_create()) == NULL ||
+            !clz_set_ringsize(g_workers[i].state, CLI_RING_SIZE))
+        {
+            perror("clz");
+            return 1;
+        }
+    }
+
+    /* One job per input to start with, dealt out round the threads.
+       Inputs that won't open are done (and failed) already */
+
+    start = now_secs();
+
+    for (i = 0; i < ninputs; i++)
+    {
+        Clzinput *in = &inputs[i];
+        Clzjob *job = &jobs[i];
+
+        job->in = in;
+
+        if (!input_open(in, argv[optind + i]))
+        {
+            in->failed = 1;
+            in->expanded = 1;
+            continue;
+        }
+
+        if (in->type == IN_ZIP && !in->fp)
+        {
+            job->expand = 1;
+        }
+        else
+        {
+            in->jobs = malloc(sizeof(Clzjob *));
+            if (!in->jobs)
+            {
+                perror("clz");
+                return 1;
+            }
+            in->jobs[0] = job;
+            in->njobs = 1;
+            in->expanded = 1;
+        }
+
+        g_outstanding++;
+
+        if (!deque_push(&g_workers[i % g_nworkers].deque, job, 0))
+        {
+            perror("clz");
+            return 1;
+        }
+    }
+
+    for (i = 0; i < g_nworkers; i++)
+    {
+        if (pthread_create(&g_workers[i].thread, NULL, worker_thread,
+                           &g_workers[i]) != 0)
+        {
+            perror("clz");
+            return 1;
+        }
+    }
+
+    if (g_stdout && !g_direct && !g_test && !write_in_order(inputs, ninputs))
+        failed = 1;
+
+    for (i = 0; i < g_nworkers; i++)
+    {
+        pthread_join(g_workers[i].thread, NULL);
+        clz_destroy(g_workers[i].state);
+    }
+
+    clz_sink_destroy(g_stdout_sink);
+
+    /* gzip style, .gz inputs go once they're safely decompressed. Zips
+       and raw deflate are kept, as unzip would */
+
+    for (i = 0; i < ninputs; i++)
+    {
+        if (inputs[i].map)
+            munmap((void *)inputs[i].map, inputs[i].maplen);
+        if (inputs[i].fd >= 0)
+            close(inputs[i].fd);
+        if (inputs[i].fp)
+            fclose(inputs[i].fp);
+
+        if (inputs[i].failed)
+            failed = 1;
+        else if (!g_keep && !g_stdout && !g_test && !inputs[i].fp &&
+                 inputs[i].type == IN_GZIP)
+            unlink(inputs[i].path);
+    }
+
+    if (!g_quiet)
+        report(inputs, ninputs, now_secs() - start);
+
+    return failed;
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
@@ -12,12 +12,29 @@
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+
+#if defined(CLZ_STATS) && (defined(__x86_64__) || defined(__i386__))
+  #include <x86intrin.h>
+#endif
+
+/* BMI2/AVX2 kernels need GCC (or clang) target attributes on x86.
+   Define CLZ_NO_X86_KERNELS to leave only the portable one */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(CLZ_NO_X86_KERNELS)
+  #define CLZ_X86_KERNELS
+  #include <immintrin.h>
+#endif
 
 #include "crc32.h"
 #include "clz.h"
 
 
 #define CLZ_WINDOW_SIZE     32 * 1024
+#define CLZ_RING_MAX        16 * 1024 * 1024
 #define CLZ_MAXHUFFBITS     16
 
 #define CLZ_MAXVALS_LL      288
@@ -27,6 +44,17 @@
 #define CLZ_CODESOK_LL      286
 #define CLZ_CODESOK_DIS     30
 
+#define CLZ_HTCACHE_SLOTS   4       /* Per stream dynamic tree cache */
+
+#define CLZ_SAVE_MAGIC      "CLZs"
+#define CLZ_SAVE_VERSION    1
+#define CLZ_SAVE_HDRSIZE    36      /* Fixed part of a saved state */
+
+#define CLZ_SRC_FILE        0       /* Input sources, see clz_setcb_get() */
+#define CLZ_SRC_CALLBACK    1
+#define CLZ_SRC_MEMORY      2
+#define CLZ_SRC_ANY         3
+
 #define CLZ_ERR_NONE        0
 #define CLZ_ERR_INTERNAL    1
 #define CLZ_ERR_INPUT       2
@@ -34,6 +62,51 @@
 #define CLZ_ERR_OUTPUT      4
 
 
+/*
+ *  Statistics collection. Compiles away to nothing unless CLZ_STATS
+ */
+
+#ifdef CLZ_STATS
+  #define STATS_ADD(statep, field, n)   ((statep)->stats.field += (n))
+  #define STATS_INC(statep, field)      ((statep)->stats.field++)
+  #define STATS_TICKS(var)              ((var) = clz_ticks())
+#else
+  #define STATS_ADD(statep, field, n)
+  #define STATS_INC(statep, field)
+  #define STATS_TICKS(var)
+#endif
+
+
+/*
+ *  USDT probes for bpftrace, perf and friends, provider "clz". These
+ *  compile away to nothing unless CLZ_USDT, which needs <sys/sdt.h>
+ *  (systemtap-sdt-dev or similar). The first argument is always the
+ *  stream's state pointer, to tell streams apart:
+ *
+ *      stream_start    (state, resumed)
+ *      stream_end      (state, bytes in, bytes out, crc32)
+ *      block_start     (state, type, final, bytes in, bytes out so far)
+ *      block_end       (state, type, block bytes in, block bytes out)
+ *      dynamic_build   (state, hlit, hdist, 1 if cached)
+ *      flush           (state, bytes, bytes out so far)
+ *      error           (state, CLZ_ERR_* code)
+ */
+
+#ifdef CLZ_USDT
+  #include <sys/sdt.h>
+  #define CLZ_PROBE2(name, a, b)          DTRACE_PROBE2(clz, name, a, b)
+  #define CLZ_PROBE3(name, a, b, c)       DTRACE_PROBE3(clz, name, a, b, c)
+  #define CLZ_PROBE4(name, a, b, c, d)    DTRACE_PROBE4(clz, name, a, b, c, d)
+  #define CLZ_PROBE5(name, a, b, c, d, e) \
+                                    DTRACE_PROBE5(clz, name, a, b, c, d, e)
+#else
+  #define CLZ_PROBE2(name, a, b)
+  #define CLZ_PROBE3(name, a, b, c)
+  #define CLZ_PROBE4(name, a, b, c, d)
+  #define CLZ_PROBE5(name, a, b, c, d, e)
+#endif
+
+
 typedef struct
 {
     int bitslo, bitshi;
@@ -47,6 +120,46 @@ typedef struct
 } Hufftbl;
 
 
+/*
+ *  A built pair of dynamic trees, keyed by the code length sequence
+ *  that made them. Kept so a repeated dynamic block header can skip
+ *  straight to inflation. The decode pointers in htll and htdis
+ *  point into this entry's own decode[] array.
+ */
+
+typedef struct Htcentry
+{
+    struct Htcentry *next;      /* Hash chain, shared cache only */
+
+    unsigned int hash;
+    int hlit, hdist;
+    unsigned char cblseq[CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS];
+
+    Hufftbl htll, htdis;
+    int decode[CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS];
+
+} Htcentry;
+
+
+/*
+ *  A cache of Htcentrys shared between states. Entries are only ever
+ *  added (never replaced) so once a state has found an entry it can
+ *  use it without holding the lock. When full, no more are added.
+ */
+
+typedef struct
+{
+    pthread_rwlock_t lock;
+
+    int nslots, nused;
+    unsigned int hmask;
+
+    Htcentry **buckets;
+    Htcentry *slots;
+
+} Htcshared;
+
+
 
 
 /*
@@ -59,6 +172,7 @@ static unsigned int g_bitmask[CLZ_MAXHUFFBITS + 1];
 
 static Hufftbl g_fixed_htll, g_fixed_htdis;
 static int g_fixed_htdecode[CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS];
+static unsigned short g_fixed_ll9[512];     /* (code length << 9) | symbol */
 
 static struct
 {
@@ -79,33 +193,131 @@ static int g_initbuilds_done;
  *  State table to allow reentrant calls to the clz routines
  */
 
-typedef struct
+typedef struct clz_state
 {
     int error;
 
     size_t (*getfn)(void *, unsigned char **);
     void *getpar;
-    size_t getnbtot;            /* running byte total for get */
+    unsigned long long getnbtot;    /* running byte total for get */
 
     unsigned char *getccbuf;    /* Use a caller created buffer */
     unsigned char *getccend;    /* End of cc buffer (one past) */
+    unsigned char *getccstart;  /* Start of the current fill */
 
     size_t (*putfn)(void *, void *, size_t);
     void *putpar;
+    unsigned long long putnbtot;    /* running byte total for put */
     uint32_t putcrc;            /* CRC32 value of all the puts */
+    int verify;                 /* No puts, just size and CRC  */
 
     unsigned int breg;
     int nbits;
 
-    unsigned char  *sw_buf;     /* 32K sliding window */
+    unsigned char  *sw_buf;     /* Output ring, last 32K is the window */
+    int             sw_size;    /* Size of sw_buf, at least 32K */
     int             sw_cpos;    /* Current write position in window */
+    int             sw_fpos;    /* Start of data not yet written out */
+    int             sw_stop;    /* Where sw_cpos must stop for a look */
     int             sw_filled;  /* Has buffer ever been filled? */
 
+    size_t outlimit;            /* Output limit per call, 0 if none */
+    size_t ckptevery;           /* Checkpoint interval, 0 if none */
+    unsigned long long ckptnext;    /* putnbtot for the next checkpoint */
+    unsigned long long outstop;     /* putnbtot to stop at on this call */
+    int suspended;              /* Stopped at the limit, can resume */
+    int pause;                  /* clz_pause(): stop after the next put */
+
+    int (*progfn)(void *, unsigned long long, unsigned long long, double);
+    void *progpar;
+    unsigned long long progevery;   /* Progress every so many bytes out */
+    unsigned long long prognext;    /* putnbtot for the next progress */
+    struct timespec progstart;      /* When the stream started */
+
+    int bk_type;                /* Current block type, -1 if none */
+    int bk_final;               /* Current block is the last one */
+    unsigned int bk_stlen;      /* Stored block bytes left to read */
+    int bk_cplen, bk_cppos;     /* Copy interrupted by the limit */
+    unsigned long long bk_in, bk_out;   /* Totals at block start */
+
     Hufftbl *htll, *htdis, *htcls;
 
+    /* The inflate kernel (index into g_kernels) and its loops for
+       the input source (CLZ_SRC_*) */
+
+    int kernel;
+    int getsrc;
+    const struct Kloops *loops;
+
+    Htcentry   *htcache;        /* CLZ_HTCACHE_SLOTS local entries */
+    int         htcnext;        /* Next local entry to replace     */
+    Htcshared  *htshared;       /* Optional shared cache           */
+
+#ifdef CLZ_STATS
+    clz_stats stats;
+#endif
+
 } clz_state;
 
 
+/*
+ *  The decode loops of an inflate kernel, see clzkernel.h. One for
+ *  any block, one for fixed Huffman blocks and one for dynamic blocks
+ *  with only literals.
+ */
+
+typedef struct Kloops
+{
+    int (*block)(clz_state *, Hufftbl *, Hufftbl *);
+    int (*fixed)(clz_state *);
+    int (*literals)(clz_state *, Hufftbl *);
+
+} Kloops;
+
+
+
+
+#ifdef CLZ_STATS
+
+/*
+ *  clz_ticks() - A cheap timestamp for the statistics
+ */
+
+static unsigned long long clz_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+
+
+/*
+ *  stats_bucket(n) - log2 histogram bucket for a byte count
+ */
+
+static int stats_bucket(unsigned long long n)
+{
+    int b = 0;
+
+    while (n > 1 && b < CLZ_STATS_SIZE_BUCKETS - 1)
+    {
+        n >>= 1;
+        b++;
+    }
+
+    return b;
+}
+
+#endif  /* CLZ_STATS */
+
+
 
 
 /*
@@ -149,7 +361,11 @@ static void ibuild_fixed_huff(void)
     htll->bl_count[8] = 152;    /* 8 bit: codes 48 to 199  */
     htll->bl_count[9] = 112;    /* 9 bit: codes 400 to 511 */
 
-    htll->decvalids = CLZ_CODESOK_LL;
+    /* All 288 codes must get past huff_decode_input() as literals
+       144 to 255 sit at the top of the table. inflate_block() turns
+       away 286 and 287 (and distances 30, 31) itself */
+
+    htll->decvalids = CLZ_MAXVALS_LL;
 
     htll->bitslo = 7;
     htll->bitshi = 9;
@@ -180,12 +396,36 @@ static void ibuild_fixed_huff(void)
        5 bit codes. RFC says 30, 31 will never occur */
 
     htdis->bl_count[5] = 32;
-    htdis->decvalids = CLZ_CODESOK_DIS;
+    htdis->decvalids = CLZ_MAXVALS_DIS;
     htdis->bitslo = 5;
     htdis->bitshi = 5;
 
     for (i = 0; i < 32; i++)
         htdis->decode[i] = i;
+
+
+    /* And a direct lookup for the literal-length codes. Indexed by the
+       next 9 bits of input as they sit in breg, so the code bits are
+       reversed and any bits beyond a shorter code can be anything */
+
+    for (i = 0; i < CLZ_MAXVALS_LL; i++)
+    {
+        int code, len, rev, k;
+
+        if (i < 144)
+            code = 0x30 + i, len = 8;
+        else if (i < 256)
+            code = 0x190 + i - 144, len = 9;
+        else if (i < 280)
+            code = i - 256, len = 7;
+        else
+            code = 0xC0 + i - 280, len = 8;
+
+        rev = (g_byterev[code & 0xFF] << 1 | (code >> 8)) >> (9 - len);
+
+        for (k = rev; k < 512; k += 1 << len)
+            g_fixed_ll9[k] = (len << 9) | i;
+    }
 }
 
 
@@ -300,96 +540,13 @@ static void ibuild_other_tables(void)
 
 
 /*
- *  breg_needbits(statep, n) - Make breg have at least n bits available
- *
- *  This function reads input as necessary to fill breg to the point
- *  requested. It is only called by breg_fetch() which does the check
- *  on the number of bits.
- *
- *  Returns:  1 on success
- *            0 on input read failure (Nothing else is set)
- */
-
-static int breg_needbits(clz_state *statep, size_t n)
-{
-    unsigned char c;
-    int ret;
-
-    while (n > statep->nbits)
-    {
-        if (!statep->getccbuf)
-        {
-            if ((ret = getc((FILE *)statep->getpar)) < 0)
-                return 0;
-
-            c = (unsigned char)ret;
-        }
-        else
-        {
-            if (statep->getccbuf == statep->getccend)
-            {
-                if (!statep->getfn)
-                {
-                    /* Buffer empty, no way to get more */
-                    return 0;
-                }
-
-                ret = statep->getfn(statep->getpar, &statep->getccbuf);
-
-                if (ret <= 0 || !statep->getccbuf)
-                    return 0;
-
-                statep->getccend = statep->getccbuf + ret;
-            }
-
-            c = *statep->getccbuf++;
-        }
-
-        statep->breg |= (unsigned int)c << statep->nbits;
-        statep->nbits += 8;
-        statep->getnbtot++;
-    }
-
-    return 1;
-}
-
-
-
-
-/*
- *  breg_fetch(statep, n) - Fetch out bits from the bitregister
- *
- *  Takes the low n bits of the bitregister, removing them from
- *  the register and returns that unsigned value.
- *
- *  On error: sets statep->error which must be checked on return
+ *  breg_fetch() and huff_decode_input() are part of the inflate
+ *  kernels, see clzkernel.h. These general ones, which work with any
+ *  input source, are for everything outside the inflate loop.
  */
 
-static unsigned int breg_fetch(clz_state *statep, size_t n)
-{
-    unsigned int bits;
-
-    if (n > CLZ_MAXHUFFBITS)
-    {
-        statep->error = CLZ_ERR_INTERNAL;
-        return 0;
-    }
-
-    if (n == 0 || statep->error)
-        return 0;
-
-    if (n > statep->nbits && !breg_needbits(statep, n))
-    {
-        statep->error = CLZ_ERR_INPUT;
-        return 0;
-    }
-
-    bits = statep->breg & g_bitmask[n];
-    statep->breg >>= n;
-    statep->nbits -= n;
-
-    return bits;
-}
+static unsigned int breg_fetch(clz_state *statep, size_t n);
+static int huff_decode_input(clz_state *statep, Hufftbl *htree);
 
 
 
@@ -510,93 +667,6 @@ static int breg_discard(clz_state *statep)
 
 
 
-/*
- *  huff_decode_input(statep, htree) - Decode input using Huffman tree
- *
- *  Fetches out enough bits from the input to get a code match in
- *  the Huffman tree htree. The Hufftbl structure stores the code
- *  length lo-hi ranges (for the fixed tree that is 7-9) so we start
- *  by reading that minimal amount of bits.
- *
- *  Note that Huffman codes are necessarily in reverse bit order as,
- *  to make longer codes, each new bit is left shifted into the LSB.
- *
- *  Returns:  The decoded value on success (value is >= 0)
- *            -1  on error and sets statep->error
- */
-
-static int huff_decode_input(clz_state *statep, Hufftbl *htree)
-{
-    unsigned int hcode, bit;
-    int n, decrange;
-
-    n = htree->bitslo;
-
-    hcode = breg_fetch(statep, n);
-    if (statep->error)
-        return -1;
-
-    /* Reverse the bit order of hcode. Given that deflate uses
-       a maximum of 16 bits, there isn't a lot of reason to
-       accommodate more than that in compiled code.
-
-       For 16 bits, shift hcode up to start at bit #15, then
-       reverse each byte using a lookup table, and swap bytes:
-            10  1111 0001 -> 1011 1100  0100 0000
-                          -> 0000 0010  0011 1101
-    */
-
-#if (CLZ_MAXHUFFBITS <= 16)
-
-    hcode <<= 16 - n;
-    hcode = g_byterev[hcode >> 8] | (g_byterev[hcode & 0xFF] << 8);
-
-#elif (CLZ_MAXHUFFBITS <= 24)
-
-    hcode <<= 24 - n;
-    hcode = (g_byterev[hcode >> 16])                 |
-            (g_byterev[((hcode >> 8) & 0xFF)] << 8)  |
-            (g_byterev[hcode & 0xFF] << 16);
-
-#else
-#error CLZ_MAXHUFFBITS is larger than 24 which is not catered for
-#endif
-
-    decrange = 0;
-
-    while (n <= htree->bitshi)
-    {
-        decrange += htree->bl_count[n];
-
-        if (hcode > htree->decvalids)
-        {
-            statep->error = CLZ_ERR_CORRUPT;
-            return -1;
-        }
-
-        if (hcode < decrange)
-            return htree->decode[hcode];
-
-        /* Above range for that number of bits. Moar bits */
-
-        bit = breg_fetch(statep, 1);
-        if (statep->error)
-            return -1;
-
-        hcode = (hcode << 1) | bit;
-        hcode -= decrange;
-        n++;
-
-    }
-
-    statep->error = CLZ_ERR_INTERNAL;
-    return -1;
-}
-
-
-
-
-
 /*
  *  cblseq_to_huff(cblenp, csize, htree) - code bit lengths to Huff-tree
  *
@@ -698,91 +768,229 @@ static int cblseq_to_huff(const unsigned char *cblseq, int cblcnt,
 
 
 /*
- *  huff_build_dynamic(statep) - Build a dynamic Huffman table
- *
- *  RFC 1951, section 3.2.7
- *
- *  Two dynamic Huffman trees follow an appropriate header in the input,
- *  defined by a sequence of code lengths. Those code lengths are in turn
- *  compressed with a Huffman code which I've called a htcls (Huffman tree
- *  for code length sequences) which is, of course, itself made up of a
- *  set of lengths read from the input. The input order of those lengths is
- *  not that of the actual order.
- *
- *  The dynamic trees are built when they are needed and stored in statep.
- *  The storage for those trees is built at clz_create() time.
+ *  htcache_hash(cblseq, hlit, hdist) - Hash a dynamic block's code lengths
  *
- *  Returns:  1 on success
- *            0 on error and sets statep->error
+ *  FNV-1a over the sequence and the two counts
  */
 
-static int huff_build_dynamic(clz_state *statep)
+static unsigned int htcache_hash(const unsigned char *cblseq,
+                                 int hlit, int hdist)
 {
-    static const unsigned char clsseqorder[19] = {
-        16, 17, 18, 0, 8, 7, 9, 6, 10, 5,
-        11, 4, 12, 3, 13, 2, 14, 1, 15
-    };
-    Hufftbl *htll, *htdis, *htcls;
-    unsigned int hlit, hdist, hclen;
-    unsigned char cblseq[CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS];
-    int i, cblavail;
-
+    unsigned int h = 2166136261U;
+    int i;
 
-    htll  = statep->htll;       /* Literal length alphabet       */
-    htdis = statep->htdis;      /* Distance alphabet             */
-    htcls = statep->htcls;      /* Code length sequence alphabet */
+    h = (h ^ hlit) * 16777619U;
+    h = (h ^ hdist) * 16777619U;
 
+    for (i = 0; i < hlit + hdist; i++)
+        h = (h ^ cblseq[i]) * 16777619U;
 
-    /* Read the code bit length counts from input, the variable names
-       used are those that are used in RFC 1951. More comprehensible */
+    return h;
+}
 
-    hlit  = breg_fetch(statep, 5) + 257;    /* # htll:  257 - 286  */
-    hdist = breg_fetch(statep, 5) + 1;      /* # htdis:   1 - 32   */
-    hclen = breg_fetch(statep, 4) + 4;      /* # htcls:   4 - 19   */
 
-    if (statep->error)
-        return 0;
 
-    if (hlit > 286 || hclen > 19)
-    {
-        statep->error = CLZ_ERR_CORRUPT;
-        return 0;
-    }
 
+/*
+ *  htcache_match(htce, hash, cblseq, hlit, hdist) - Is this the entry?
+ */
 
+static int htcache_match(const Htcentry *htce, unsigned int hash,
+                         const unsigned char *cblseq, int hlit, int hdist)
+{
+    return htce->hash  == hash  &&
+           htce->hlit  == hlit  &&
+           htce->hdist == hdist &&
+           memcmp(htce->cblseq, cblseq, hlit + hdist) == 0;
+}
 
-    /* The cblseq[] for htcls is read from input and there are hclen number
-       of 3-bit (0-7) bitlengths. However because there might be a lot of
-       zeros (unused corresponding alphabet symbols) the input is not in
-       order of alphabet. So not something like "1 1 3 2 2 0 3 ...".
 
-       The input hops about to fill the positions in cblseq. The hops are
-       specified in clsseqorder[]. Thus the first bit-length read goes into
-       cblseq[16], the second into cblseq[17]...etc. That means there may
-       be plenty of 0 slots which are never filled (so we fill them first).
 
-       The alphabet for codelengths is 19 long.
-    */
 
+/*
+ *  htcache_lookup(statep, hash, cblseq, hlit, hdist) - Find built trees
+ *
+ *  Looks in the state's own entries first and then, if there is one,
+ *  the shared cache. On a hit statep->htll and statep->htdis are set
+ *  to the cached trees.
+ *
+ *  Returns:  1 if found
+ *            0 if not (nothing is changed)
+ */
 
-    /* Zero all slots: */
+static int htcache_lookup(clz_state *statep, unsigned int hash,
+                          const unsigned char *cblseq, int hlit, int hdist)
+{
+    Htcentry *htce;
+    int i;
 
-    for (i = 0; i < 19; i++)
-        cblseq[i] = 0;
+    for (i = 0; i < CLZ_HTCACHE_SLOTS; i++)
+    {
+        htce = &statep->htcache[i];
 
-    /* Read hclen number of fixed 3 bit out-of-order code lengths */
+        if (htcache_match(htce, hash, cblseq, hlit, hdist))
+        {
+            statep->htll  = &htce->htll;
+            statep->htdis = &htce->htdis;
+            return 1;
+        }
+    }
 
-    for (i = 0; i < hclen; i++)
+    if (statep->htshared)
     {
-        cblseq[ clsseqorder[i] ] = breg_fetch(statep, 3);
-        if (statep->error)
-            return 0;
-    }
+        Htcshared *htcs = statep->htshared;
 
-    /* Build the htcls Huffman tree: */
+        pthread_rwlock_rdlock(&htcs->lock);
 
-    if (!cblseq_to_huff(cblseq, 19, htcls))
-    {
+        for (htce = htcs->buckets[hash & htcs->hmask]; htce; htce = htce->next)
+        {
+            if (htcache_match(htce, hash, cblseq, hlit, hdist))
+                break;
+        }
+
+        pthread_rwlock_unlock(&htcs->lock);
+
+        if (htce)
+        {
+            statep->htll  = &htce->htll;
+            statep->htdis = &htce->htdis;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+ *  htcache_share(htcs, htce) - Copy a newly built entry to a shared cache
+ *
+ *  Does nothing if the cache is full or already has a matching entry
+ *  (another state may have got there first)
+ */
+
+static void htcache_share(Htcshared *htcs, const Htcentry *htce)
+{
+    Htcentry *newp, **bucketp;
+
+    pthread_rwlock_wrlock(&htcs->lock);
+
+    bucketp = &htcs->buckets[htce->hash & htcs->hmask];
+
+    for (newp = *bucketp; newp; newp = newp->next)
+    {
+        if (htcache_match(newp, htce->hash, htce->cblseq,
+                          htce->hlit, htce->hdist))
+            break;
+    }
+
+    if (!newp && htcs->nused < htcs->nslots)
+    {
+        newp = &htcs->slots[htcs->nused++];
+
+        *newp = *htce;
+        newp->htll.decode  = newp->decode;
+        newp->htdis.decode = &newp->decode[CLZ_MAXVALS_LL];
+
+        newp->next = *bucketp;
+        *bucketp = newp;
+    }
+
+    pthread_rwlock_unlock(&htcs->lock);
+}
+
+
+
+
+/*
+ *  huff_build_dynamic(statep) - Build a dynamic Huffman table
+ *
+ *  RFC 1951, section 3.2.7
+ *
+ *  Two dynamic Huffman trees follow an appropriate header in the input,
+ *  defined by a sequence of code lengths. Those code lengths are in turn
+ *  compressed with a Huffman code which I've called a htcls (Huffman tree
+ *  for code length sequences) which is, of course, itself made up of a
+ *  set of lengths read from the input. The input order of those lengths is
+ *  not that of the actual order.
+ *
+ *  The dynamic trees are built when they are needed and stored in one
+ *  of the state's cache entries (allocated at clz_create() time) and
+ *  statep->htll, statep->htdis are pointed at them. If the same code
+ *  lengths have been seen before, the cached trees are used instead.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets statep->error
+ */
+
+static int huff_build_dynamic(clz_state *statep)
+{
+    static const unsigned char clsseqorder[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5,
+        11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    Hufftbl *htll, *htdis, *htcls;
+    Htcentry *htce;
+    unsigned int hlit, hdist, hclen, hash;
+    unsigned char cblseq[CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS];
+    int i, cblavail;
+
+
+    htcls = statep->htcls;      /* Code length sequence alphabet */
+
+
+    /* Read the code bit length counts from input, the variable names
+       used are those that are used in RFC 1951. More comprehensible */
+
+    hlit  = breg_fetch(statep, 5) + 257;    /* # htll:  257 - 286  */
+    hdist = breg_fetch(statep, 5) + 1;      /* # htdis:   1 - 32   */
+    hclen = breg_fetch(statep, 4) + 4;      /* # htcls:   4 - 19   */
+
+    if (statep->error)
+        return 0;
+
+    if (hlit > 286 || hclen > 19)
+    {
+        statep->error = CLZ_ERR_CORRUPT;
+        return 0;
+    }
+
+
+
+    /* The cblseq[] for htcls is read from input and there are hclen number
+       of 3-bit (0-7) bitlengths. However because there might be a lot of
+       zeros (unused corresponding alphabet symbols) the input is not in
+       order of alphabet. So not something like "1 1 3 2 2 0 3 ...".
+
+       The input hops about to fill the positions in cblseq. The hops are
+       specified in clsseqorder[]. Thus the first bit-length read goes into
+       cblseq[16], the second into cblseq[17]...etc. That means there may
+       be plenty of 0 slots which are never filled (so we fill them first).
+
+       The alphabet for codelengths is 19 long.
+    */
+
+
+    /* Zero all slots: */
+
+    for (i = 0; i < 19; i++)
+        cblseq[i] = 0;
+
+    /* Read hclen number of fixed 3 bit out-of-order code lengths */
+
+    for (i = 0; i < hclen; i++)
+    {
+        cblseq[ clsseqorder[i] ] = breg_fetch(statep, 3);
+        if (statep->error)
+            return 0;
+    }
+
+    /* Build the htcls Huffman tree: */
+
+    if (!cblseq_to_huff(cblseq, 19, htcls))
+    {
         statep->error = CLZ_ERR_CORRUPT;
         return 0;
     }
@@ -881,7 +1089,28 @@ static int huff_build_dynamic(clz_state *statep)
     }   /* while() */
 
 
-    /* Have the code lengths, build the htll and htdis trees */
+    /* Have the code lengths. Producers that emit lots of small blocks
+       tend to repeat the same header, so check for trees already built */
+
+    hash = htcache_hash(cblseq, hlit, hdist);
+
+    if (htcache_lookup(statep, hash, cblseq, hlit, hdist))
+    {
+        STATS_INC(statep, htcache_hits);
+        CLZ_PROBE4(dynamic_build, statep, hlit, hdist, 1);
+        return 1;
+    }
+
+
+    /* Not seen, build the htll and htdis trees in the next local entry */
+
+    htce = &statep->htcache[statep->htcnext];
+    statep->htcnext = (statep->htcnext + 1) % CLZ_HTCACHE_SLOTS;
+
+    htce->hlit = 0;             /* Invalid until built */
+
+    htll  = &htce->htll;        /* Literal length alphabet       */
+    htdis = &htce->htdis;       /* Distance alphabet             */
 
     if (!cblseq_to_huff(cblseq, hlit, htll))
     {
@@ -905,6 +1134,19 @@ static int huff_build_dynamic(clz_state *statep)
     if (htdis->decvalids > CLZ_CODESOK_DIS)
         htdis->decvalids = CLZ_CODESOK_DIS;
 
+    htce->hash  = hash;
+    htce->hlit  = hlit;
+    htce->hdist = hdist;
+    memcpy(htce->cblseq, cblseq, hlit + hdist);
+
+    statep->htll  = htll;
+    statep->htdis = htdis;
+
+    CLZ_PROBE4(dynamic_build, statep, hlit, hdist, 0);
+
+    if (statep->htshared)
+        htcache_share(statep->htshared, htce);
+
     return 1;
 }
 
@@ -920,43 +1162,184 @@ static int huff_build_dynamic(clz_state *statep)
 
 
 /*
- *  slwin_write(statep) - Write out the sliding window buffer
+ *  progress(statep) - Call the progress callback
+ *
+ *  If it asks to stop, the output limit is brought in to where the
+ *  output is now so the stream suspends at the next check.
+ */
+
+static void progress(clz_state *statep)
+{
+    struct timespec now;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    secs = (now.tv_sec - statep->progstart.tv_sec) +
+           (now.tv_nsec - statep->progstart.tv_nsec) / 1e9;
+
+    while (statep->prognext <= statep->putnbtot)
+        statep->prognext += statep->progevery;
+
+    if (!statep->progfn(statep->progpar, statep->getnbtot,
+                        statep->putnbtot, secs))
+        statep->outstop = statep->putnbtot;
+}
+
+
+
+
+/*
+ *  put_output(statep, buf, nbytes) - Hand nbytes of output to put
  *
- *  This function assumes that statep->sw_cpos is the amount
- *  of data to write out and zeros that value when complete.
- *  It also calls crc32 to keep a running CRC32 of the output.
+ *  Passes the data to the put callback (or writes it to file) and
+ *  keeps a running CRC32 and total of the output. In verify mode the
+ *  put is skipped entirely; the CRC is done while the data is still
+ *  hot in the cache.
  *
  *  Returns:  1 on success
  *            0 on error and sets statep->error
  */
 
-static int slwin_write(clz_state *statep)
+static int put_output(clz_state *statep, unsigned char *buf, size_t nbytes)
 {
-    size_t nbytes;
+    size_t wrbytes;
+#ifdef CLZ_STATS
+    unsigned long long t0, t1;
+#endif
 
-    if (!statep->sw_cpos)
-        return 1;
+    STATS_TICKS(t0);
 
-    if (statep->putfn)
+    if (statep->verify)
     {
-        nbytes = statep->putfn(statep->putpar,
-                               statep->sw_buf, statep->sw_cpos);
+        wrbytes = nbytes;
+    }
+    else if (statep->putfn)
+    {
+        wrbytes = statep->putfn(statep->putpar, buf, nbytes);
     }
     else
     {
-        nbytes = fwrite(statep->sw_buf, 1,
-                        statep->sw_cpos, (FILE *)statep->putpar);
+        wrbytes = fwrite(buf, 1, nbytes, (FILE *)statep->putpar);
     }
 
-    if (nbytes != statep->sw_cpos)
+    if (wrbytes != nbytes)
     {
         statep->error = CLZ_ERR_OUTPUT;
         return 0;
     }
 
-    statep->putcrc = crc32(statep->putcrc, statep->sw_buf, statep->sw_cpos);
-    statep->sw_cpos = 0;
+    statep->putcrc = crc32(statep->putcrc, buf, nbytes);
+
+    CLZ_PROBE3(flush, statep, nbytes, statep->putnbtot + nbytes);
+    statep->putnbtot += nbytes;
+
+    STATS_TICKS(t1);
+    STATS_ADD(statep, ticks_write, t1 - t0);
+
+    if (statep->progfn && statep->putnbtot >= statep->prognext)
+        progress(statep);
+
+    if (statep->pause)
+    {
+        statep->pause = 0;
+        statep->outstop = statep->putnbtot;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  slwin_write(statep) - Write out the sliding window buffer
+ *
+ *  Writes out whatever is in the window between statep->sw_fpos and
+ *  statep->sw_cpos. That's usually the whole output ring (32K unless
+ *  clz_set_ringsize() made it bigger) but can be less if the output
+ *  limit stops the stream part way. Once the write position reaches
+ *  the end of the ring, both wrap back to zero. What was written stays
+ *  in the ring as history until it's overwritten.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets statep->error
+ */
+
+static int slwin_write(clz_state *statep)
+{
+    if (statep->sw_cpos > statep->sw_fpos &&
+        !put_output(statep, statep->sw_buf + statep->sw_fpos,
+                    statep->sw_cpos - statep->sw_fpos))
+        return 0;
+
+    if (statep->sw_cpos == statep->sw_size)
+    {
+        statep->sw_cpos = 0;
+        statep->sw_filled = 1;
+    }
+
+    statep->sw_fpos = statep->sw_cpos;
+    return 1;
+}
+
+
+
+
+/*
+ *  slwin_setstop(statep) - Work out where the window write must stop
+ *
+ *  The decode loops only check the write position against sw_stop.
+ *  That's the end of the window unless the output limit falls first.
+ */
+
+static void slwin_setstop(clz_state *statep)
+{
+    unsigned long long produced, left;
+
+    statep->sw_stop = statep->sw_size;
+
+    if (!statep->outstop)
+        return;
+
+    produced = statep->putnbtot + (statep->sw_cpos - statep->sw_fpos);
+    left = statep->outstop > produced ? statep->outstop - produced : 0;
+
+    if (left < statep->sw_size - statep->sw_cpos)
+        statep->sw_stop = statep->sw_cpos + left;
+}
+
+
+
+
+/*
+ *  slwin_full(statep) - The window write position has reached sw_stop
+ *
+ *  If the window is full, write it out. If the output limit has
+ *  been reached, write out what's pending and suspend the stream.
+ *
+ *  Returns:  1 to carry on decoding
+ *            0 to stop: either on error, which sets statep->error
+ *              or at the output limit, which sets statep->suspended
+ */
+
+static int slwin_full(clz_state *statep)
+{
+    if (statep->sw_cpos == statep->sw_size && !slwin_write(statep))
+        return 0;
+
+    if (statep->outstop &&
+        statep->putnbtot + (statep->sw_cpos - statep->sw_fpos) >=
+                                                        statep->outstop)
+    {
+        if (!slwin_write(statep))
+            return 0;
+
+        statep->suspended = 1;
+        return 0;
+    }
 
+    slwin_setstop(statep);
     return 1;
 }
 
@@ -979,7 +1362,7 @@ static int slwin_read(clz_state *statep, size_t nbytes)
 {
     size_t rdbytes, inbytes;
 
-    rdbytes = CLZ_WINDOW_SIZE - (size_t)statep->sw_cpos;
+    rdbytes = (size_t)(statep->sw_stop - statep->sw_cpos);
 
     if (!nbytes || !rdbytes)
     {
@@ -1026,6 +1409,7 @@ static int slwin_read(clz_state *statep, size_t nbytes)
             }
 
             statep->getccend = statep->getccbuf + inbytes;
+            statep->getccstart = statep->getccbuf;
         }
 
         if (rdbytes > statep->getccend - statep->getccbuf)
@@ -1052,65 +1436,133 @@ static int slwin_read(clz_state *statep, size_t nbytes)
 
 
 /*
- *  process_block_stored(statep) - Process uncompressed block
+ *  stored_passthru(statep, nbytes) - Stored data straight to output
  *
- *  RFC 1951, section 3.2.4. Pretty straightforward
+ *  Hands at most nbytes of stored block data to output directly from
+ *  the caller's input buffer, without going through the window. Only
+ *  for buffered input, and the window must have been written out
+ *  first. Stops at the output limit as slwin_full() would.
  *
- *  Returns:  1 on success
- *            0 on error and sets statep->error
+ *  Returns:  the number of bytes passed through on success (> 0)
+ *            0 to stop, as per slwin_full()
  */
 
-static int process_block_stored(clz_state *statep)
+static size_t stored_passthru(clz_state *statep, size_t nbytes)
 {
-    unsigned int len, nlen;
-
+    if (statep->outstop)
+    {
+        unsigned long long left = statep->outstop - statep->putnbtot;
 
-    /* Discard up to next byte boundary */
+        if (!left)
+        {
+            statep->suspended = 1;
+            return 0;
+        }
 
-    if (breg_discard(statep) >= 8)
-    {
-        statep->error = CLZ_ERR_INTERNAL;
-        return 0;
+        if (nbytes > left)
+            nbytes = left;
     }
 
+    if (statep->getccbuf == statep->getccend)
+    {
+        size_t inbytes;
 
-    /* First 2 16-bit words are length and its complement */
+        if (!statep->getfn)
+        {
+            statep->error = CLZ_ERR_INPUT;
+            return 0;
+        }
 
-    len  = breg_fetch(statep, 16);
-    nlen = breg_fetch(statep, 16);
+        inbytes = statep->getfn(statep->getpar, &statep->getccbuf);
 
-    if (statep->error)
-        return 0;
+        if (inbytes <= 0 || !statep->getccbuf)
+        {
+            statep->error = CLZ_ERR_INPUT;
+            return 0;
+        }
 
-    if (len != (~nlen & 0xffff))
-    {
-        statep->error = CLZ_ERR_CORRUPT;
-        return 0;
+        statep->getccend = statep->getccbuf + inbytes;
+        statep->getccstart = statep->getccbuf;
     }
 
+    if (nbytes > statep->getccend - statep->getccbuf)
+        nbytes = statep->getccend - statep->getccbuf;
 
-    /* Copy len bytes of data to output. It is necessary to run input
-       through the sliding window regardless - any future block can
-       easily refer back to this one for a copy of data */
+    if (!put_output(statep, statep->getccbuf, nbytes))
+        return 0;
 
-    while (len)
-    {
-        size_t nfilled = slwin_read(statep, len);
+    statep->getccbuf += nbytes;
+    statep->getnbtot += nbytes;
 
-        if (!nfilled)
-            return 0;
+    return nbytes;
+}
 
-        assert(nfilled <= len && statep->sw_cpos <= CLZ_WINDOW_SIZE);
 
-        len -= nfilled;
 
-        if (statep->sw_cpos == CLZ_WINDOW_SIZE)
-        {
-            if (!slwin_write(statep))
+
+/*
+ *  process_stored_data(statep) - Copy a stored block's data
+ *
+ *  Copies the statep->bk_stlen bytes of a stored block that are left
+ *  from input to output. This is also where a stored block suspended
+ *  by the output limit resumes.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static int process_stored_data(clz_state *statep)
+{
+    /* With buffered input, all but the last 32K of a big stored block
+       can skip the window and go straight from the input buffer to
+       output. Only that last 32K can be referred back to. Any pending
+       window data has to go out first to keep the output in order */
+
+    if (statep->getccbuf && statep->bk_stlen > CLZ_WINDOW_SIZE)
+    {
+        if (!slwin_write(statep))
+            return 0;
+
+        while (statep->bk_stlen > CLZ_WINDOW_SIZE)
+        {
+            size_t npassed;
+
+            npassed = stored_passthru(statep,
+                                      statep->bk_stlen - CLZ_WINDOW_SIZE);
+            if (!npassed)
                 return 0;
 
-            statep->sw_filled = 1;
+            statep->bk_stlen -= npassed;
+        }
+
+        if (statep->outstop && statep->putnbtot == statep->outstop)
+        {
+            statep->suspended = 1;
+            return 0;
         }
+
+        slwin_setstop(statep);
+    }
+
+
+    /* Copy len bytes of data to output. It is necessary to run input
+       through the sliding window regardless - any future block can
+       easily refer back to this one for a copy of data */
+
+    while (statep->bk_stlen)
+    {
+        size_t nfilled = slwin_read(statep, statep->bk_stlen);
+
+        if (!nfilled)
+            return 0;
+
+        assert(nfilled <= statep->bk_stlen &&
+               statep->sw_cpos <= statep->sw_stop);
+
+        statep->bk_stlen -= nfilled;
+
+        if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+            return 0;
     }
 
     return 1;
@@ -1120,136 +1572,189 @@ static int process_block_stored(clz_state *statep)
 
 
 /*
- *  inflate_block(statep) - Decompress a block
- *
- *  RFC 1951, section 3.2.3 and 3.2.5
+ *  process_block_stored(statep) - Process uncompressed block
  *
- *  Takes two huffman trees, a literal-length tree and a distance tree,
- *  and uses those trees to deflate the input stream into the sliding
- *  window, writing it whenever it fills.
+ *  RFC 1951, section 3.2.4. Pretty straightforward
  *
  *  Returns:  1 on success
- *            0 on error and sets statep->error
+ *            0 to stop, as per slwin_full()
  */
 
-int inflate_block(clz_state *statep, Hufftbl *htll, Hufftbl *htdis)
+static int process_block_stored(clz_state *statep)
 {
-    int decsym, copylen, copydist;
+    unsigned int len, nlen;
 
-    while (1)
+
+    /* Discard up to next byte boundary */
+
+    if (breg_discard(statep) >= 8)
     {
-        /* The first decode from input is literal-length (htll) */
+        statep->error = CLZ_ERR_INTERNAL;
+        return 0;
+    }
 
-        if ((decsym = huff_decode_input(statep, htll)) < 0)
-            return 0;
 
-        /*
-         *  Decoded symbol is: End-of-block marker
-         */
+    /* First 2 16-bit words are length and its complement */
 
-        if (decsym == 256)
-            break;
+    len  = breg_fetch(statep, 16);
+    nlen = breg_fetch(statep, 16);
 
+    if (statep->error)
+        return 0;
 
-        /*
-         *  Decoded symbol is: Literal byte
-         */
+    if (len != (~nlen & 0xffff))
+    {
+        statep->error = CLZ_ERR_CORRUPT;
+        return 0;
+    }
 
-        if (decsym < 256)
-        {
-            statep->sw_buf[statep->sw_cpos++] = decsym;
+    statep->bk_stlen = len;
+    return process_stored_data(statep);
+}
 
-            if (statep->sw_cpos == CLZ_WINDOW_SIZE)
-            {
-                if (!slwin_write(statep))
-                    return 0;
 
-                statep->sw_filled = 1;
-            }
 
-            continue;
-        }
 
+#ifdef CLZ_X86_KERNELS
 
-        /*
-         *  Decoded symbol is 257 to 285: copy length and distance
-         */
+/*
+ *  kernel_has_bmi2_avx2() - Can the CPU run the bmi2+avx2 kernel?
+ *
+ *  Returns: 1 if so, 0 if not
+ */
 
+static int kernel_has_bmi2_avx2(void)
+{
+    __builtin_cpu_init();
 
-        /* copy length: Use the g_htextra lookups to fetch extra bits
-           and add those to a base length */
+    return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("avx2");
+}
 
-        decsym -= 257;
+#endif
 
-        copylen = breg_fetch(statep, g_htextra.lenbits[decsym]);
-        if (statep->error)
-            return 0;
 
-        copylen += g_htextra.lenbase[decsym];
 
 
-        /* The next decode from input is distance (htdis). Also
-           fetch extra bits and add those to a base length: */
+/*
+ *  The inflate kernels. The portable one is always there, others are
+ *  built for particular instruction sets and picked by clz_create()
+ *  if the CPU has them. Each kernel is built once per input source,
+ *  picked by clz_setcb_get(), so the loop only has the input handling
+ *  it needs. See clzkernel.h.
+ */
 
-        if ((decsym = huff_decode_input(statep, htdis)) < 0)
-            return 0;
+#define KFN(name)       name
+#define KATTR
+#define KMASK(v, n)     ((v) & g_bitmask[n])
+#define KSRC            CLZ_SRC_ANY
+#define KNOINFLATE
+#include "clzkernel.h"
+
+#define KFN(name)       name##_file
+#define KATTR
+#define KMASK(v, n)     ((v) & g_bitmask[n])
+#define KSRC            CLZ_SRC_FILE
+#include "clzkernel.h"
+
+#define KFN(name)       name##_callback
+#define KATTR
+#define KMASK(v, n)     ((v) & g_bitmask[n])
+#define KSRC            CLZ_SRC_CALLBACK
+#include "clzkernel.h"
+
+#define KFN(name)       name##_memory
+#define KATTR
+#define KMASK(v, n)     ((v) & g_bitmask[n])
+#define KSRC            CLZ_SRC_MEMORY
+#include "clzkernel.h"
+
+#ifdef CLZ_X86_KERNELS
+
+#define KFN(name)       name##_file_bmi2
+#define KATTR           __attribute__((target("bmi2,avx2")))
+#define KMASK(v, n)     _bzhi_u32(v, n)
+#define KSRC            CLZ_SRC_FILE
+#define KAVX2
+#include "clzkernel.h"
+
+#define KFN(name)       name##_callback_bmi2
+#define KATTR           __attribute__((target("bmi2,avx2")))
+#define KMASK(v, n)     _bzhi_u32(v, n)
+#define KSRC            CLZ_SRC_CALLBACK
+#define KAVX2
+#include "clzkernel.h"
+
+#define KFN(name)       name##_memory_bmi2
+#define KATTR           __attribute__((target("bmi2,avx2")))
+#define KMASK(v, n)     _bzhi_u32(v, n)
+#define KSRC            CLZ_SRC_MEMORY
+#define KAVX2
+#include "clzkernel.h"
 
-        copydist = breg_fetch(statep, g_htextra.disbits[decsym]);
-        if (statep->error)
-            return 0;
+#endif
 
-        copydist += g_htextra.disbase[decsym];
 
+/* Best first. clz_create() picks the first one the CPU supports.
+   The loops are indexed by CLZ_SRC_* */
 
-        /* Have a length and a backward distance. This is backwards
-           from 1 to 32768 into what is a sliding window of 32K
-           so can end up with a negative start point (thus sw_cpos
-           and copydist are both signed ints) */
+#define KLOOPS(sfx)     { inflate_block##sfx, inflate_fixed##sfx, \
+                          inflate_literals##sfx }
 
-        copydist = statep->sw_cpos - copydist;
-        if (copydist < 0)
-        {
-            /* Distance refers beyond the start of the buffer, wrap it */
+static const struct
+{
+    const char *name;
+    Kloops loops[3];
+    int (*supported)(void);
+
+} g_kernels[] = {
+#ifdef CLZ_X86_KERNELS
+    { "bmi2+avx2",  { KLOOPS(_file_bmi2), KLOOPS(_callback_bmi2),
+                      KLOOPS(_memory_bmi2) }, kernel_has_bmi2_avx2 },
+#endif
+    { "portable",   { KLOOPS(_file), KLOOPS(_callback),
+                      KLOOPS(_memory) }, NULL },
+};
 
-            copydist += CLZ_WINDOW_SIZE;
 
-            if (!statep->sw_filled)
-            {
-                /* Buffer cannot be wrapped as it was never filled */
-                statep->error = CLZ_ERR_CORRUPT;
-                return 0;
-            }
-        }
 
 
-        /* Copy across: This could probably be faster... */
+/*
+ *  set_inflate(statep) - Point statep->loops at the right kernel
+ *
+ *  For statep->kernel and the input source statep->getsrc
+ */
 
-        while (copylen--)
-        {
-            statep->sw_buf[statep->sw_cpos++] = statep->sw_buf[copydist++];
+static void set_inflate(clz_state *statep)
+{
+    statep->loops = &g_kernels[statep->kernel].loops[statep->getsrc];
+}
 
-            if (copydist == CLZ_WINDOW_SIZE)
-                copydist = 0;
 
-            if (statep->sw_cpos == CLZ_WINDOW_SIZE)
-            {
-                if (!slwin_write(statep))
-                    return 0;
 
-                statep->sw_filled = 1;
-            }
-        }
 
-    }   /* while (1) ... */
+/*
+ *  inflate_dynamic(statep) - Inflate a dynamic block's data
+ *
+ *  Picks the loop for the trees huff_build_dynamic() just built. With
+ *  no distance codes there can't be any copies.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
 
-    return 1;
+static int inflate_dynamic(clz_state *statep)
+{
+    if (statep->htdis->decvalids == 0)
+        return statep->loops->literals(statep, statep->htll);
+
+    return statep->loops->block(statep, statep->htll, statep->htdis);
 }
 
 
 
 
 /*
- *  inflate_fixed(statep) - Decompress with fixed Huffman tree
+ *  process_block_fixed(statep) - Decompress with fixed Huffman tree
  *
  *  Returns:  1 on success
  *            0 on error and sets statep->error
@@ -1257,17 +1762,31 @@ int inflate_block(clz_state *statep, Hufftbl *htll, Hufftbl *htdis)
 
 int process_block_fixed(clz_state *statep)
 {
-    return inflate_block(statep, &g_fixed_htll, &g_fixed_htdis);
+    int ret;
+#ifdef CLZ_STATS
+    unsigned long long t0, t1, wr0 = statep->stats.ticks_write;
+#endif
+
+    STATS_TICKS(t0);
+
+    ret = statep->loops->fixed(statep);
+
+    STATS_TICKS(t1);
+    STATS_ADD(statep, ticks_inflate,
+              (t1 - t0) - (statep->stats.ticks_write - wr0));
+
+    return ret;
 }
 
 
 
 
 /*
- *  inflate_dynamic(statep) - Decompress with dynamic Huffman tree
+ *  process_block_dynamic(statep) - Decompress with dynamic Huffman tree
  *
- *  Called huff_build_dynamic creates lit-len and distances trees
- *  in the pre-allocated store in the current state (htll, htdis)
+ *  huff_build_dynamic() builds the lit-len and distance trees (or finds
+ *  them in the tree cache) and points htll and htdis at them, then
+ *  inflate_dynamic() decodes the block's data with them.
  *
  *  Returns:  1 on success
  *            0 on error and sets statep->error
@@ -1275,10 +1794,62 @@ int process_block_fixed(clz_state *statep)
 
 int process_block_dynamic(clz_state *statep)
 {
+    int ret;
+#ifdef CLZ_STATS
+    unsigned long long t0, t1, t2, wr0 = statep->stats.ticks_write;
+#endif
+
+    STATS_TICKS(t0);
+
     if (!huff_build_dynamic(statep))
         return 0;
 
-    return inflate_block(statep, statep->htll, statep->htdis);
+    STATS_TICKS(t1);
+
+    ret = inflate_dynamic(statep);
+
+    STATS_TICKS(t2);
+    STATS_ADD(statep, ticks_build, t1 - t0);
+    STATS_ADD(statep, ticks_inflate,
+              (t2 - t1) - (statep->stats.ticks_write - wr0));
+
+    return ret;
+}
+
+
+
+
+/*
+ *  resume_block(statep) - Carry on with a block the output limit stopped
+ *
+ *  Any Huffman trees needed are still where statep->htll, statep->htdis
+ *  point (nothing else builds trees until the next block header).
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static int resume_block(clz_state *statep)
+{
+    int ret;
+#ifdef CLZ_STATS
+    unsigned long long t0, t1, wr0 = statep->stats.ticks_write;
+#endif
+
+    STATS_TICKS(t0);
+
+    if (statep->bk_type == 0)
+        ret = process_stored_data(statep);
+    else if (statep->bk_type == 1)
+        ret = statep->loops->fixed(statep);
+    else
+        ret = inflate_dynamic(statep);
+
+    STATS_TICKS(t1);
+    STATS_ADD(statep, ticks_inflate,
+              (t1 - t0) - (statep->stats.ticks_write - wr0));
+
+    return ret;
 }
 
 
@@ -1294,72 +1865,197 @@ int process_block_dynamic(clz_state *statep)
  *  be uncompressed. The RFC notes that backward references (Deflate) may
  *  reach back to refer to a string in a previous block ...
  *
+ *  If the previous call was suspended by the output limit, this carries
+ *  on from exactly where that left off instead.
+ *
  *  Returns:  1 on success
  *            0 on error and sets statep->error
+ *            0 at the output limit and sets statep->suspended
  */
 
 static int decompress_input(clz_state *statep)
 {
-    int bfinal, btype;
-
-    /* reset any state needed */
+    int ret;
 
     statep->error = 0;
 
-    statep->getnbtot = 0;
-    statep->putcrc = 0;
+    if (!statep->suspended)
+    {
+        /* reset any state needed */
+
+        statep->getnbtot = 0;
+        statep->putnbtot = 0;
+        statep->putcrc = 0;
 
-    statep->breg = 0;
-    statep->nbits = 0;
+        statep->breg = 0;
+        statep->nbits = 0;
 
-    statep->sw_cpos = 0;
-    statep->sw_filled = 0;
+        statep->sw_cpos = 0;
+        statep->sw_fpos = 0;
+        statep->sw_filled = 0;
+
+        statep->bk_type = -1;
+        statep->bk_cplen = 0;
+
+        statep->ckptnext = statep->ckptevery;
+        statep->prognext = statep->progevery;
+        clock_gettime(CLOCK_MONOTONIC, &statep->progstart);
+
+#ifdef CLZ_STATS
+        memset(&statep->stats, 0, sizeof(statep->stats));
+#endif
+    }
+
+    CLZ_PROBE2(stream_start, statep, statep->suspended);
+
+    statep->suspended = 0;
+    statep->pause = 0;
+    statep->outstop = 0;
+
+    if (statep->outlimit)
+        statep->outstop = statep->putnbtot + statep->outlimit;
+
+    slwin_setstop(statep);
 
 
     /* decompress a block at a time */
 
     do {
 
-        bfinal = breg_fetch(statep, 1);
-        btype = breg_fetch(statep, 2);
-
-        if (statep->error)
-            return 0;
+        if (statep->bk_type >= 0)
+        {
+            /* Part way through a block, carry on */
 
-        if (btype == 0)
+            ret = resume_block(statep);
+        }
+        else
         {
-            /* Uncompressed */
+            statep->bk_in  = statep->getnbtot;
+            statep->bk_out = statep->putnbtot +
+                             (statep->sw_cpos - statep->sw_fpos);
+
+            statep->bk_final = breg_fetch(statep, 1);
+            statep->bk_type = breg_fetch(statep, 2);
 
-            if (!process_block_stored(statep))
+            if (statep->error)
                 return 0;
-        }
 
-        else if (btype == 1)
-        {
-            /* Deflate, fixed Huffman tree */
+            CLZ_PROBE5(block_start, statep, statep->bk_type,
+                       statep->bk_final, statep->bk_in, statep->bk_out);
+
+            if (statep->bk_type == 0)
+            {
+                /* Uncompressed */
+
+                ret = process_block_stored(statep);
+            }
+
+            else if (statep->bk_type == 1)
+            {
+                /* Deflate, fixed Huffman tree */
+
+                ret = process_block_fixed(statep);
+            }
+
+            else if (statep->bk_type == 2)
+            {
+                /* Deflate, dynamic Huffman tree */
+
+                ret = process_block_dynamic(statep);
+            }
+
+            else
+            {
+                /* Error */
 
-            if (!process_block_fixed(statep))
+                statep->error = CLZ_ERR_CORRUPT;
                 return 0;
+            }
         }
 
-        else if (btype == 2)
+        if (!ret)
+            return 0;
+
+        CLZ_PROBE4(block_end, statep, statep->bk_type,
+                   statep->getnbtot - statep->bk_in,
+                   statep->putnbtot + (statep->sw_cpos - statep->sw_fpos) -
+                   statep->bk_out);
+
+#ifdef CLZ_STATS
         {
-            /* Deflate, dynamic Huffman tree */
+            size_t blkin, blkout;
 
-            if (!process_block_dynamic(statep))
-                return 0;
+            blkin  = statep->getnbtot - statep->bk_in;
+            blkout = statep->putnbtot + (statep->sw_cpos - statep->sw_fpos) -
+                     statep->bk_out;
+
+            statep->stats.blk_in_hist[stats_bucket(blkin)]++;
+            statep->stats.blk_out_hist[stats_bucket(blkout)]++;
+
+            if (statep->bk_type == 0)
+            {
+                statep->stats.blocks_stored++;
+                statep->stats.in_stored += blkin;
+                statep->stats.out_stored += blkout;
+            }
+            else if (statep->bk_type == 1)
+            {
+                statep->stats.blocks_fixed++;
+                statep->stats.in_fixed += blkin;
+                statep->stats.out_fixed += blkout;
+            }
+            else
+            {
+                statep->stats.blocks_dynamic++;
+                statep->stats.in_dynamic += blkin;
+                statep->stats.out_dynamic += blkout;
+            }
         }
+#endif
 
-        else
+        statep->bk_type = -1;
+
+
+        /* Stop at this block boundary if a checkpoint is due. All
+           output so far is written so clz_save_state() can be used */
+
+        if (statep->ckptevery && !statep->bk_final &&
+            statep->putnbtot + (statep->sw_cpos - statep->sw_fpos) >=
+                                                        statep->ckptnext)
         {
-            /* Error */
+            if (!slwin_write(statep))
+                return 0;
 
-            statep->error = CLZ_ERR_CORRUPT;
+            statep->ckptnext = statep->putnbtot + statep->ckptevery;
+            statep->suspended = 1;
             return 0;
         }
 
+    } while (!statep->bk_final);
+
 
-    } while (!bfinal);
+    /* Whole bytes read ahead into breg are past the end of the stream
+       so hand them back, as far as the input allows. That leaves what
+       follows (a gzip trailer, say) where the caller can find it */
+
+    while (statep->nbits >= 8)
+    {
+        unsigned int c = (statep->breg >> (statep->nbits - 8)) & 0xFF;
+
+        if (statep->getccbuf)
+        {
+            if (statep->getccbuf == statep->getccstart)
+                break;
+            statep->getccbuf--;
+        }
+        else if (statep->nbits >= 16 ||
+                 ungetc((int)c, (FILE *)statep->getpar) == EOF)
+            break;
+
+        statep->nbits -= 8;
+        statep->breg &= (1U << statep->nbits) - 1;
+        statep->getnbtot--;
+    }
 
 
     /* Write out any remaining pending output */
@@ -1367,6 +2063,9 @@ static int decompress_input(clz_state *statep)
     if (!slwin_write(statep))
         return 0;
 
+    CLZ_PROBE4(stream_end, statep, statep->getnbtot, statep->putnbtot,
+               statep->putcrc);
+
     return 1;
 }
 
@@ -1401,7 +2100,7 @@ static int decompress_input(clz_state *statep)
 void *clz_create(void)
 {
     clz_state *statep;
-    int htbytes;
+    int i;
 
     if ((statep = calloc(1, sizeof(clz_state))) == NULL)
         return 0;
@@ -1409,53 +2108,70 @@ void *clz_create(void)
     statep->getpar = stdin;
     statep->putpar = stdout;
 
-    if ((statep->sw_buf = malloc(CLZ_WINDOW_SIZE)) == NULL)
+    statep->sw_size = CLZ_WINDOW_SIZE;
+
+    if ((statep->sw_buf = malloc(statep->sw_size)) == NULL)
     {
         free(statep);
         errno = ENOMEM;
         return 0;
     }
 
-    htbytes =
-        (3 * sizeof(Hufftbl)) +
-        (CLZ_MAXVALS_LL + CLZ_MAXVALS_DIS + CLZ_MAXVALS_CLS) * sizeof(int);
+    statep->htcls = malloc(sizeof(Hufftbl) + CLZ_MAXVALS_CLS * sizeof(int));
+    statep->htcache = calloc(CLZ_HTCACHE_SLOTS, sizeof(Htcentry));
 
-    statep->htll = malloc(htbytes);
-    if (statep->htll == NULL)
+    if (statep->htcls == NULL || statep->htcache == NULL)
     {
+        free(statep->htcache);
+        free(statep->htcls);
         free(statep->sw_buf);
         free(statep);
         errno = ENOMEM;
         return 0;
     }
 
-    statep->htdis = &statep->htll[1];
-    statep->htcls = &statep->htll[2];
-
     /* Hufftbl starts with an int and must be aligned to that.
        Therefore using a Hufftbl *, the alignment is right */
 
-    statep->htll->decode     = (int *)(&statep->htll[3]);
-    statep->htll->decalloc   = CLZ_MAXVALS_LL;
-    statep->htll->decvalids  = 0;
-
-    statep->htdis->decode    = &statep->htll->decode[statep->htll->decalloc];
-    statep->htdis->decalloc  = CLZ_MAXVALS_DIS;
-    statep->htdis->decvalids = 0;
-
-    statep->htcls->decode    = &statep->htdis->decode[statep->htdis->decalloc];
+    statep->htcls->decode    = (int *)(&statep->htcls[1]);
     statep->htcls->decalloc  = CLZ_MAXVALS_CLS;
     statep->htcls->decvalids = 0;
 
+    /* The dynamic trees live in the cache entries. An hlit of zero
+       never matches a real header so calloc leaves them all invalid */
+
+    for (i = 0; i < CLZ_HTCACHE_SLOTS; i++)
+    {
+        Htcentry *htce = &statep->htcache[i];
+
+        htce->htll.decode    = htce->decode;
+        htce->htll.decalloc  = CLZ_MAXVALS_LL;
+        htce->htdis.decode   = &htce->decode[CLZ_MAXVALS_LL];
+        htce->htdis.decalloc = CLZ_MAXVALS_DIS;
+    }
+
+    statep->htll  = &statep->htcache[0].htll;
+    statep->htdis = &statep->htcache[0].htdis;
+
+    /* Use the best inflate kernel this CPU can run. The last one is
+       portable so there's always one */
+
+    for (i = 0; g_kernels[i].supported && !g_kernels[i].supported(); i++)
+        ;
+
+    statep->kernel = i;
+    statep->getsrc = CLZ_SRC_FILE;
+    set_inflate(statep);
+
 
     /* Got here without problems so if initialisation of all the
        global static lookup tables needs to be, do that now */
 
     if (!g_initbuilds_done)
     {
+        ibuild_other_tables();      /* g_byterev is used by the others */
         ibuild_fixed_huff();
         ibuild_huff_extrabits();
-        ibuild_other_tables();
 
         g_initbuilds_done = 1;
     }
@@ -1487,6 +2203,9 @@ void *clz_create(void)
  *  one off read buffer of size usemem. When that buffer is empty, there
  *  is no more input to read.
  *
+ *  Each inflate kernel has a version of its decode loop for each of
+ *  these three, which is picked here.
+ *
  *  Returns:  1 on success
  *            0 on error and sets errno (to EINVAL)
  */
@@ -1516,6 +2235,8 @@ int clz_setcb_get(void *aptr, size_t (*getfn)(void *, unsigned char **),
         }
         statep->getccbuf = 0;
         statep->getccend = 0;
+        statep->getccstart = statep->getccbuf;
+        statep->getsrc = CLZ_SRC_FILE;
     }
     else if (getfn)
     {
@@ -1523,6 +2244,8 @@ int clz_setcb_get(void *aptr, size_t (*getfn)(void *, unsigned char **),
 
         statep->getccbuf = statep->sw_buf;  /* A handy pointer! */
         statep->getccend = statep->sw_buf;  /* But empty buffer */
+        statep->getccstart = statep->getccbuf;
+        statep->getsrc = CLZ_SRC_CALLBACK;
     }
     else
     {
@@ -1535,9 +2258,14 @@ int clz_setcb_get(void *aptr, size_t (*getfn)(void *, unsigned char **),
         }
         statep->getccbuf = (unsigned char *)getpar;
         statep->getccend = getpar;
+        statep->getccstart = statep->getccbuf;
         statep->getccend += usemem;
+        statep->getsrc = CLZ_SRC_MEMORY;
     }
 
+    /* The input source is fixed now, so pick the inflate loop for it */
+
+    set_inflate(statep);
     return 1;
 }
 
@@ -1554,10 +2282,13 @@ int clz_setcb_get(void *aptr, size_t (*getfn)(void *, unsigned char **),
  *          size_t (*putfn)(void *gptr, void *buf, size_t bytes);
  *          void *putpar;
  *
- *  putfn() is used to output data, up to 32K at a time. If putfn is
- *  not set, then putpar must point to a FILE *. putfn() shall return
- *  the number of bytes written which must be that requested, or 0
- *  on an error. Called like: putfn(putpar, localbuf, 200);
+ *  putfn() is used to output data, up to the ring size at a time (32K
+ *  unless changed with clz_set_ringsize()). Stored blocks bigger than
+ *  32K can come straight from the input buffer in larger puts, up to
+ *  the whole input slice, so don't assume a maximum. If putfn is not
+ *  set, then putpar must point to a FILE *. putfn() shall return the
+ *  number of bytes written which must be that requested, or 0 on an
+ *  error. Called like: putfn(putpar, localbuf, 200);
  *
  *  Returns:  1 on success
  *            0 on error and sets errno (to EINVAL)
@@ -1602,7 +2333,8 @@ void clz_destroy_direct(void *aptr)
 
     statep = (clz_state *)aptr;
 
-    free(statep->htll);
+    free(statep->htcache);
+    free(statep->htcls);
     free(statep->sw_buf);
     free(statep);
 }
@@ -1610,36 +2342,25 @@ void clz_destroy_direct(void *aptr)
 
 
 
-/**
- *  clz_decompress(aptr, cbusedp) - Decompress stream from get to put
- *
- *  Using the get and put callback functions (if set) this routine
- *  takes an input stream and decompresses it to an output stream.
- *  The total number of bytes read from input is returned.
+/*
+ *  decompress_stream(statep, cbusedp) - Common part of clz_decompress()
  *
- *  Any provided fill buffers may be left half empty. As it may be
- *  useful to know how much was consumed *cbusedp, if supplied, will
- *  update to that value.
+ *  Runs decompress_input(), turns any error into errno and tidies
+ *  up the caller's fill buffer.
  *
- *  Returns:  total bytes read on success
+ *  Returns:  1 on success (which includes stopping at the output limit)
  *            0 on error and sets errno
  */
 
-int clz_decompress(void *aptr, int *cbusedp, unsigned int *crc32p)
+static int decompress_stream(clz_state *statep, int *cbusedp)
 {
-    clz_state *statep = (clz_state *)aptr;
-
-    if (aptr == NULL)
-    {
-        errno = EINVAL;
-        return 0;
-    }
-
-    if (!decompress_input(statep))
+    if (!decompress_input(statep) && !statep->suspended)
     {
         if (!statep->error)
             statep->error = CLZ_ERR_INTERNAL;
 
+        CLZ_PROBE2(error, statep, statep->error);
+
         switch (statep->error)
         {
             case CLZ_ERR_INPUT:     errno = EIO;    break;
@@ -1654,6 +2375,11 @@ int clz_decompress(void *aptr, int *cbusedp, unsigned int *crc32p)
         if (cbusedp)
             *cbusedp = statep->getccend - statep->getccbuf;
 
+        /* A suspended stream carries on with what's left next time */
+
+        if (statep->suspended)
+            return 1;
+
         /* Invalidate the buffer: If getfn is supplied, it will
            be called on first read, if not it will fail until
            clz_setcb_get() is called to set up a new buffer.
@@ -1661,15 +2387,753 @@ int clz_decompress(void *aptr, int *cbusedp, unsigned int *crc32p)
 
         statep->getccbuf = statep->sw_buf;
         statep->getccend = statep->sw_buf;
+        statep->getccstart = statep->getccbuf;
     }
 
-    if (statep->error)
-        return 0;
+    return !statep->error;
+}
+
 
-    if (crc32p)
-        *crc32p = (unsigned int)statep->putcrc;
 
-    return (int)statep->getnbtot;
+
+/**
+ *  clz_decompress(aptr, cbusedp) - Decompress stream from get to put
+ *
+ *  Using the get and put callback functions (if set) this routine
+ *  takes an input stream and decompresses it to an output stream.
+ *  The total number of bytes read from input is returned.
+ *
+ *  Any provided fill buffers may be left half empty. As it may be
+ *  useful to know how much was consumed *cbusedp, if supplied, will
+ *  update to that value.
+ *
+ *  If an output limit is set with clz_setlimit(), decompression stops
+ *  once that many bytes have been output. clz_suspended() will then
+ *  return true and calling clz_decompress() again carries on where it
+ *  stopped (with any fill buffer left as it was). The return value and
+ *  *crc32p are then for the stream so far.
+ *
+ *  Returns:  total bytes read on success
+ *            0 on error and sets errno
+ */
+
+int clz_decompress(void *aptr, int *cbusedp, unsigned int *crc32p)
+{
+    clz_state *statep = (clz_state *)aptr;
+
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    statep->verify = 0;
+
+    if (!decompress_stream(statep, cbusedp))
+        return 0;
+
+    if (crc32p)
+        *crc32p = (unsigned int)statep->putcrc;
+
+    /* Beyond 2GB only clz_get_result() has the real total */
+
+    return statep->getnbtot > INT_MAX ? INT_MAX : (int)statep->getnbtot;
+}
+
+
+
+
+/**
+ *  clz_verify(aptr, outsizep, crc32p) - Check a stream decompresses
+ *
+ *  As clz_decompress() but the output is never handed to the put
+ *  callback (or written to file). It's only counted and checksummed,
+ *  which is all an integrity check (gzip -t) needs. The history is
+ *  still kept so back references work. The uncompressed size goes to
+ *  *outsizep and the CRC32 to *crc32p, if supplied.
+ *
+ *  Returns:  total bytes read on success
+ *            0 on error and sets errno
+ */
+
+int clz_verify(void *aptr, size_t *outsizep, unsigned int *crc32p)
+{
+    clz_state *statep = (clz_state *)aptr;
+    int ret;
+
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    statep->verify = 1;
+    ret = decompress_stream(statep, 0);
+    statep->verify = 0;
+
+    if (!ret)
+        return 0;
+
+    if (outsizep)
+        *outsizep = statep->putnbtot;
+
+    if (crc32p)
+        *crc32p = (unsigned int)statep->putcrc;
+
+    /* Beyond 2GB only clz_get_result() has the real total */
+
+    return statep->getnbtot > INT_MAX ? INT_MAX : (int)statep->getnbtot;
+}
+
+
+
+
+/**
+ *  clz_get_stats(aptr, statsp) - Get decode statistics
+ *
+ *  Copies out the statistics for the most recent clz_decompress()
+ *  on this state. They are reset at the start of each stream.
+ *  Collection has to be compiled in with CLZ_STATS defined.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (EINVAL or ENOSYS)
+ */
+
+int clz_get_stats(void *aptr, clz_stats *statsp)
+{
+    if (aptr == NULL || statsp == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+#ifdef CLZ_STATS
+    *statsp = ((clz_state *)aptr)->stats;
+    return 1;
+#else
+    errno = ENOSYS;
+    return 0;
+#endif
+}
+
+
+
+
+/**
+ *  clz_htcache_create(nentries) - Create a shared dynamic tree cache
+ *
+ *  Each state keeps a few recently built dynamic Huffman trees of its
+ *  own. A shared cache, attached with clz_set_htcache(), adds up to
+ *  nentries more that are visible to every state using it, which may
+ *  be in different threads. Entries are added as they're built until
+ *  the cache is full and are then kept for the life of the cache.
+ *  Each entry is a little under 2K.
+ *
+ *  Returns:  Allocated cache pointer as anonymous pointer
+ *            NULL on error and sets errno
+ */
+
+void *clz_htcache_create(int nentries)
+{
+    Htcshared *htcs;
+    unsigned int nbuckets;
+
+    if (nentries <= 0)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if ((htcs = calloc(1, sizeof(Htcshared))) == NULL)
+        return 0;
+
+    for (nbuckets = 16; nbuckets < nentries; nbuckets *= 2)
+        ;
+
+    htcs->nslots  = nentries;
+    htcs->hmask   = nbuckets - 1;
+    htcs->buckets = calloc(nbuckets, sizeof(Htcentry *));
+    htcs->slots   = malloc(nentries * sizeof(Htcentry));
+
+    if (!htcs->buckets || !htcs->slots ||
+         pthread_rwlock_init(&htcs->lock, NULL) != 0)
+    {
+        free(htcs->slots);
+        free(htcs->buckets);
+        free(htcs);
+        errno = ENOMEM;
+        return 0;
+    }
+
+    return (void *)htcs;
+}
+
+
+
+
+/**
+ *  clz_set_htcache(aptr, cptr) - Attach a shared dynamic tree cache
+ *
+ *  cptr is from clz_htcache_create() or NULL to detach. The cache must
+ *  outlive every state attached to it.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_set_htcache(void *aptr, void *cptr)
+{
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    ((clz_state *)aptr)->htshared = (Htcshared *)cptr;
+    return 1;
+}
+
+
+
+
+/*
+ *  clz_htcache_destroy(cptr) - Free a shared dynamic tree cache
+ */
+
+void clz_htcache_destroy(void *cptr)
+{
+    Htcshared *htcs = (Htcshared *)cptr;
+
+    if (!htcs)
+        return;
+
+    pthread_rwlock_destroy(&htcs->lock);
+    free(htcs->slots);
+    free(htcs->buckets);
+    free(htcs);
+}
+
+
+
+
+/**
+ *  clz_setlimit(aptr, outmax) - Limit the output of each decompress call
+ *
+ *  Each following clz_decompress() or clz_verify() call will stop
+ *  cleanly once it has output outmax bytes, leaving the stream
+ *  suspended so another call can carry on. outmax of 0 removes the
+ *  limit (the default). Handy for peeking at the start of a file
+ *  without decompressing the lot.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_setlimit(void *aptr, size_t outmax)
+{
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    ((clz_state *)aptr)->outlimit = outmax;
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_suspended(aptr) - Did the last call stop at the output limit?
+ *
+ *  Returns:  1 if the stream is suspended and can be resumed
+ *            0 if it finished, failed or never started
+ */
+
+int clz_suspended(void *aptr)
+{
+    if (aptr == NULL)
+        return 0;
+
+    return ((clz_state *)aptr)->suspended;
+}
+
+
+
+
+/**
+ *  clz_pause(aptr) - Suspend the stream once the current put is done
+ *
+ *  For put callbacks that want to hand each chunk on before any more is
+ *  decoded: the call returns as if at the output limit (see
+ *  clz_suspended()) and the chunk stays as it is in the output ring
+ *  until the next call resumes the stream.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_pause(void *aptr)
+{
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    ((clz_state *)aptr)->pause = 1;
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_reset(aptr) - Abandon a suspended stream
+ *
+ *  The next clz_decompress() starts a new stream rather than
+ *  resuming. Call clz_setcb_get() too if the input has changed.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_reset(void *aptr)
+{
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    ((clz_state *)aptr)->suspended = 0;
+    return 1;
+}
+
+
+
+
+
+/**
+ *  clz_set_ringsize(aptr, size) - Set the size of the output ring
+ *
+ *  Output builds up in a ring buffer which is written out (to the put
+ *  callback or file) each time it fills, and its last 32K doubles as
+ *  the history for back references. The default is just that 32K. A
+ *  bigger ring, say 1 to 16MB, means far fewer and larger writes. Not
+ *  allowed while a stream is suspended.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (EINVAL, EBUSY or ENOMEM)
+ */
+
+int clz_set_ringsize(void *aptr, size_t size)
+{
+    clz_state *statep = (clz_state *)aptr;
+    unsigned char *newbuf;
+
+    if (aptr == NULL || size < CLZ_WINDOW_SIZE || size > CLZ_RING_MAX)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (statep->suspended)
+    {
+        errno = EBUSY;
+        return 0;
+    }
+
+    if (size == (size_t)statep->sw_size)
+        return 1;
+
+    if ((newbuf = malloc(size)) == NULL)
+    {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    /* An empty fill buffer points at sw_buf, so move that too */
+
+    if (statep->getccbuf == statep->sw_buf)
+    {
+        statep->getccbuf = newbuf;
+        statep->getccend = newbuf;
+        statep->getccstart = statep->getccbuf;
+    }
+
+    free(statep->sw_buf);
+    statep->sw_buf = newbuf;
+    statep->sw_size = (int)size;
+
+    return 1;
+}
+
+
+
+
+
+/**
+ *  clz_get_kernel(aptr) - Name the inflate kernel a state uses
+ *
+ *  clz_create() picks the best kernel the CPU can run, eg:
+ *  "bmi2+avx2" on recent x86, otherwise "portable".
+ *
+ *  Returns:  the kernel name on success
+ *            NULL on error and sets errno (to EINVAL)
+ */
+
+const char *clz_get_kernel(void *aptr)
+{
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return g_kernels[((clz_state *)aptr)->kernel].name;
+}
+
+
+
+
+/**
+ *  clz_set_kernel(aptr, name) - Use a particular inflate kernel
+ *
+ *  Mainly for testing and benchmarking each kernel against the
+ *  portable one. name is as clz_get_kernel() returns.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (EINVAL for an unknown name,
+ *              ENOTSUP if the CPU can't run it)
+ */
+
+int clz_set_kernel(void *aptr, const char *name)
+{
+    clz_state *statep = (clz_state *)aptr;
+    int i;
+
+    if (aptr == NULL || name == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    for (i = 0; i < sizeof(g_kernels) / sizeof(g_kernels[0]); i++)
+    {
+        if (strcmp(g_kernels[i].name, name) != 0)
+            continue;
+
+        if (g_kernels[i].supported && !g_kernels[i].supported())
+        {
+            errno = ENOTSUP;
+            return 0;
+        }
+
+        statep->kernel = i;
+        set_inflate(statep);
+        return 1;
+    }
+
+    errno = EINVAL;
+    return 0;
+}
+
+
+
+
+
+/**
+ *  clz_set_checkpoint(aptr, every) - Stop at block boundaries to save
+ *
+ *  Makes clz_decompress() (or clz_verify()) stop at the first block
+ *  boundary after each every bytes of output, leaving the stream
+ *  suspended (see clz_suspended()) so clz_save_state() can be called.
+ *  Calling clz_decompress() again carries on. 0 turns it off.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_set_checkpoint(void *aptr, size_t every)
+{
+    clz_state *statep = (clz_state *)aptr;
+
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    statep->ckptevery = every;
+    statep->ckptnext = statep->putnbtot + every;
+    return 1;
+}
+
+
+
+
+/*
+ *  save_le(p, val, nbytes) - Store val little endian at p
+ *  load_le(p, nbytes)      - And get it back again
+ */
+
+static void save_le(unsigned char *p, unsigned long long val, int nbytes)
+{
+    while (nbytes--)
+    {
+        *p++ = (unsigned char)val;
+        val >>= 8;
+    }
+}
+
+
+static unsigned long long load_le(const unsigned char *p, int nbytes)
+{
+    unsigned long long val = 0;
+
+    while (nbytes--)
+        val = (val << 8) | p[nbytes];
+
+    return val;
+}
+
+
+
+
+/**
+ *  clz_save_state(aptr, buf, buflen) - Save a stream to carry on later
+ *
+ *  The stream must be suspended at a block boundary, which is where
+ *  clz_set_checkpoint() stops it. Everything needed to carry on is
+ *  saved to buf: input and output totals, the running CRC32, the bits
+ *  read ahead into the bit register and as much of the history as
+ *  back references can reach (32K at most). Pass a NULL buf to find
+ *  the size needed. The saved state is portable between machines.
+ *
+ *  Returns:  the size of the saved state on success
+ *            0 on error and sets errno (EINVAL, or ENOSPC if buflen
+ *              is too small, or EBUSY if not at a block boundary)
+ */
+
+size_t clz_save_state(void *aptr, void *buf, size_t buflen)
+{
+    clz_state *statep = (clz_state *)aptr;
+    unsigned char *p = (unsigned char *)buf;
+    size_t histlen, savelen;
+    int histpos;
+
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (!statep->suspended || statep->bk_type >= 0 ||
+        statep->sw_fpos != statep->sw_cpos)
+    {
+        errno = EBUSY;
+        return 0;
+    }
+
+    histlen = statep->putnbtot < CLZ_WINDOW_SIZE ? statep->putnbtot
+                                                 : CLZ_WINDOW_SIZE;
+    savelen = CLZ_SAVE_HDRSIZE + histlen;
+
+    if (buf == NULL)
+        return savelen;
+
+    if (buflen < savelen)
+    {
+        errno = ENOSPC;
+        return 0;
+    }
+
+    memcpy(p, CLZ_SAVE_MAGIC, 4);
+    save_le(p + 4, CLZ_SAVE_VERSION, 4);
+    save_le(p + 8, statep->getnbtot, 8);
+    save_le(p + 16, statep->putnbtot, 8);
+    save_le(p + 24, statep->putcrc, 4);
+    save_le(p + 28, statep->breg, 4);
+    save_le(p + 32, statep->nbits, 2);
+    save_le(p + 34, 0, 2);
+    p += CLZ_SAVE_HDRSIZE;
+
+    /* The history is the histlen bytes before sw_cpos, which may
+       wrap back around the end of the ring */
+
+    histpos = statep->sw_cpos - (int)histlen;
+
+    if (histpos < 0)
+    {
+        memcpy(p, statep->sw_buf + statep->sw_size + histpos, -histpos);
+        p -= histpos;
+        histpos = 0;
+    }
+
+    memcpy(p, statep->sw_buf + histpos, statep->sw_cpos - histpos);
+
+    return savelen;
+}
+
+
+
+
+/**
+ *  clz_load_state(aptr, buf, buflen, inoffsetp) - Carry on a saved stream
+ *
+ *  Loads a state saved by clz_save_state(), leaving the stream
+ *  suspended. Position the input at *inoffsetp, the number of bytes
+ *  of input consumed before the save, set it with clz_setcb_get() and
+ *  call clz_decompress() to carry on from there. The output, its
+ *  totals and CRC32 carry on as if the stream had never stopped.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (EINVAL, or EILSEQ if buf
+ *              isn't a saved state)
+ */
+
+int clz_load_state(void *aptr, const void *buf, size_t buflen,
+                   size_t *inoffsetp)
+{
+    clz_state *statep = (clz_state *)aptr;
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t histlen;
+    int nbits;
+
+    if (aptr == NULL || buf == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    if (buflen < CLZ_SAVE_HDRSIZE || memcmp(p, CLZ_SAVE_MAGIC, 4) != 0 ||
+        load_le(p + 4, 4) != CLZ_SAVE_VERSION)
+    {
+        errno = EILSEQ;
+        return 0;
+    }
+
+    histlen = buflen - CLZ_SAVE_HDRSIZE;
+    nbits = (int)load_le(p + 32, 2);
+
+    if (histlen > CLZ_WINDOW_SIZE || nbits > 8 * sizeof(statep->breg) ||
+        histlen > load_le(p + 16, 8))
+    {
+        errno = EILSEQ;
+        return 0;
+    }
+
+    statep->getnbtot = load_le(p + 8, 8);
+    statep->putnbtot = load_le(p + 16, 8);
+    statep->putcrc = (uint32_t)load_le(p + 24, 4);
+    statep->breg = (unsigned int)load_le(p + 28, 4);
+    statep->nbits = nbits;
+
+    /* History goes at the start of the ring */
+
+    memcpy(statep->sw_buf, p + CLZ_SAVE_HDRSIZE, histlen);
+
+    statep->sw_cpos = (int)histlen;
+    statep->sw_filled = 0;
+
+    if (statep->sw_cpos == statep->sw_size)
+    {
+        statep->sw_cpos = 0;
+        statep->sw_filled = 1;
+    }
+
+    statep->sw_fpos = statep->sw_cpos;
+
+    statep->bk_type = -1;
+    statep->bk_cplen = 0;
+    statep->ckptnext = statep->putnbtot + statep->ckptevery;
+    statep->suspended = 1;
+
+#ifdef CLZ_STATS
+    memset(&statep->stats, 0, sizeof(statep->stats));
+#endif
+
+    if (inoffsetp)
+        *inoffsetp = statep->getnbtot;
+
+    return 1;
+}
+
+
+
+
+
+/**
+ *  clz_get_result(aptr, resultp) - Get the stream's totals so far
+ *
+ *  Fills in *resultp with the 64 bit input and output totals, the CRC32
+ *  of the output and whether the stream is suspended. Valid after
+ *  clz_decompress() or clz_verify(), or from a progress callback.
+ *  clz_decompress() returns at most INT_MAX, so use this for streams
+ *  of 2GB or more.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_get_result(void *aptr, clz_result *resultp)
+{
+    clz_state *statep = (clz_state *)aptr;
+
+    if (aptr == NULL || resultp == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    resultp->bytes_in = statep->getnbtot;
+    resultp->bytes_out = statep->putnbtot;
+    resultp->crc32 = (unsigned int)statep->putcrc;
+    resultp->suspended = statep->suspended;
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_set_progress(aptr, every, progfn, progpar) - Report progress
+ *
+ *  Calls progfn each time another every bytes have been output:
+ *
+ *      int progfn(void *progpar, unsigned long long bytesin,
+ *                 unsigned long long bytesout, double secs);
+ *
+ *  with the totals so far and the seconds since the stream started.
+ *  It's checked as output is written, so comes up to one ring's worth
+ *  (see clz_set_ringsize()) late. progfn returns 1 to carry on or 0 to
+ *  suspend the stream, as the output limit would (see clz_suspended()).
+ *  A NULL progfn or an every of 0 turns it off.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL)
+ */
+
+int clz_set_progress(void *aptr, size_t every,
+                     int (*progfn)(void *, unsigned long long,
+                                   unsigned long long, double),
+                     void *progpar)
+{
+    clz_state *statep = (clz_state *)aptr;
+
+    if (aptr == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    statep->progfn = every ? progfn : NULL;
+    statep->progpar = progpar;
+    statep->progevery = every;
+    statep->prognext = statep->putnbtot + every;
+    return 1;
 }
 
 
@@ -0,0 +1,626 @@
+/*
+ *  clzkernel.h - Inflate kernel template for clzinflate.c
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  This is only ever included by clzinflate.c, once per kernel. The
+ *  hot loop functions below are compiled for each with these defined:
+ *
+ *      KFN(name)   Kernel's function name, eg: name##_bmi2
+ *      KATTR       Function attributes, eg: target("bmi2")
+ *      KMASK(v, n) The low n bits of v
+ *      KAVX2       Defined to use AVX2 for match copies
+ *      KSRC        Input source (CLZ_SRC_*) breg_needbits() handles
+ *      KNOINFLATE  Defined to leave out slwin_copy(), inflate_block()
+ *
+ *  They're all undefined again at the end, ready for the next one.
+ */
+
+
+
+
+/*
+ *  breg_needbits(statep, n) - Make breg have at least n bits available
+ *
+ *  This function reads input as necessary to fill breg to the point
+ *  requested. It is only called by breg_fetch() which does the check
+ *  on the number of bits. Only the input source KSRC is handled,
+ *  unless that's CLZ_SRC_ANY.
+ *
+ *  Returns:  1 on success
+ *            0 on input read failure (Nothing else is set)
+ */
+
+static KATTR int KFN(breg_needbits)(clz_state *statep, size_t n)
+{
+    unsigned char c;
+#if KSRC != CLZ_SRC_MEMORY
+    int ret;
+#endif
+
+    while (n > statep->nbits)
+    {
+#if KSRC == CLZ_SRC_ANY
+        if (!statep->getccbuf)
+#endif
+#if KSRC == CLZ_SRC_ANY || KSRC == CLZ_SRC_FILE
+        {
+            if ((ret = getc((FILE *)statep->getpar)) < 0)
+                return 0;
+
+            c = (unsigned char)ret;
+        }
+#endif
+#if KSRC == CLZ_SRC_ANY
+        else
+#endif
+#if KSRC != CLZ_SRC_FILE
+        {
+            if (statep->getccbuf == statep->getccend)
+            {
+  #if KSRC == CLZ_SRC_MEMORY
+                /* Buffer empty, no way to get more */
+                return 0;
+  #else
+                if (!statep->getfn)
+                {
+                    /* Buffer empty, no way to get more */
+                    return 0;
+                }
+
+                ret = statep->getfn(statep->getpar, &statep->getccbuf);
+
+                if (ret <= 0 || !statep->getccbuf)
+                    return 0;
+
+                statep->getccend = statep->getccbuf + ret;
+                statep->getccstart = statep->getccbuf;
+  #endif
+            }
+
+            c = *statep->getccbuf++;
+        }
+#endif
+
+        statep->breg |= (unsigned int)c << statep->nbits;
+        statep->nbits += 8;
+        statep->getnbtot++;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  breg_fetch(statep, n) - Fetch out bits from the bitregister
+ *
+ *  Takes the low n bits of the bitregister, removing them from
+ *  the register and returns that unsigned value.
+ *
+ *  On error: sets statep->error which must be checked on return
+ */
+
+static KATTR unsigned int KFN(breg_fetch)(clz_state *statep, size_t n)
+{
+    unsigned int bits;
+
+    if (n > CLZ_MAXHUFFBITS)
+    {
+        statep->error = CLZ_ERR_INTERNAL;
+        return 0;
+    }
+
+    if (n == 0 || statep->error)
+        return 0;
+
+    if (n > statep->nbits && !KFN(breg_needbits)(statep, n))
+    {
+        statep->error = CLZ_ERR_INPUT;
+        return 0;
+    }
+
+    bits = KMASK(statep->breg, n);
+    statep->breg >>= n;
+    statep->nbits -= n;
+
+    return bits;
+}
+
+
+
+
+/*
+ *  huff_decode_input(statep, htree) - Decode input using Huffman tree
+ *
+ *  Fetches out enough bits from the input to get a code match in
+ *  the Huffman tree htree. The Hufftbl structure stores the code
+ *  length lo-hi ranges (for the fixed tree that is 7-9) so we start
+ *  by reading that minimal amount of bits.
+ *
+ *  Note that Huffman codes are necessarily in reverse bit order as,
+ *  to make longer codes, each new bit is left shifted into the LSB.
+ *
+ *  Returns:  The decoded value on success (value is >= 0)
+ *            -1  on error and sets statep->error
+ */
+
+static KATTR int KFN(huff_decode_input)(clz_state *statep, Hufftbl *htree)
+{
+    unsigned int hcode, bit;
+    int n, decrange;
+
+    n = htree->bitslo;
+
+    hcode = KFN(breg_fetch)(statep, n);
+    if (statep->error)
+        return -1;
+
+    /* Reverse the bit order of hcode. Given that deflate uses
+       a maximum of 16 bits, there isn't a lot of reason to
+       accommodate more than that in compiled code.
+
+       For 16 bits, shift hcode up to start at bit #15, then
+       reverse each byte using a lookup table, and swap bytes:
+            10  1111 0001 -> 1011 1100  0100 0000
+                          -> 0000 0010  0011 1101
+    */
+
+#if (CLZ_MAXHUFFBITS <= 16)
+
+    hcode <<= 16 - n;
+    hcode = g_byterev[hcode >> 8] | (g_byterev[hcode & 0xFF] << 8);
+
+#elif (CLZ_MAXHUFFBITS <= 24)
+
+    hcode <<= 24 - n;
+    hcode = (g_byterev[hcode >> 16])                 |
+            (g_byterev[((hcode >> 8) & 0xFF)] << 8)  |
+            (g_byterev[hcode & 0xFF] << 16);
+
+#else
+#error CLZ_MAXHUFFBITS is larger than 24 which is not catered for
+#endif
+
+    decrange = 0;
+
+    while (n <= htree->bitshi)
+    {
+        decrange += htree->bl_count[n];
+
+        if (hcode > htree->decvalids)
+        {
+            statep->error = CLZ_ERR_CORRUPT;
+            return -1;
+        }
+
+        if (hcode < decrange)
+            return htree->decode[hcode];
+
+        /* Above range for that number of bits. Moar bits */
+
+        bit = KFN(breg_fetch)(statep, 1);
+        if (statep->error)
+            return -1;
+
+        hcode = (hcode << 1) | bit;
+        hcode -= decrange;
+        n++;
+
+    }
+
+    statep->error = CLZ_ERR_INTERNAL;
+    return -1;
+}
+
+
+
+
+#ifndef KNOINFLATE
+
+/*
+ *  slwin_copy(statep, copylen, copypos) - Copy back from the window
+ *
+ *  Copies copylen bytes from copypos in the window to the current
+ *  write position. If stopped by the output limit, the remainder of
+ *  the copy is kept in statep to be finished on resume.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(slwin_copy)(clz_state *statep, int copylen, int copypos)
+{
+    /* A distance of 1 is a run of the last byte, so memset() it up
+       to sw_stop at a time */
+
+    if (copypos + 1 == statep->sw_cpos ||
+        (statep->sw_cpos == 0 && copypos == statep->sw_size - 1))
+    {
+        unsigned char c = statep->sw_buf[copypos];
+
+        while (copylen)
+        {
+            int nrun = statep->sw_stop - statep->sw_cpos;
+
+            if (nrun > copylen)
+                nrun = copylen;
+
+            memset(statep->sw_buf + statep->sw_cpos, c, nrun);
+            statep->sw_cpos += nrun;
+            copylen -= nrun;
+
+            if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+            {
+                statep->bk_cplen = copylen;
+                statep->bk_cppos = (statep->sw_cpos ? statep->sw_cpos
+                                                    : statep->sw_size) - 1;
+                return 0;
+            }
+        }
+
+        return 1;
+    }
+
+#ifdef KAVX2
+    /* Whole 32 byte chunks, as long as they don't run past the end
+       of the ring or sw_stop, and the source isn't within 32 bytes
+       behind the write position (it's fine ahead of it) */
+
+    if (copypos + copylen <= statep->sw_size &&
+        statep->sw_cpos + copylen <= statep->sw_stop &&
+        (copypos > statep->sw_cpos || statep->sw_cpos - copypos >= 32))
+    {
+        unsigned char *dst = statep->sw_buf + statep->sw_cpos;
+        unsigned char *src = statep->sw_buf + copypos;
+        int nchunk = copylen & ~31;
+
+        while (copylen >= 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)src);
+            _mm256_storeu_si256((__m256i *)dst, v);
+
+            src += 32;
+            dst += 32;
+            copylen -= 32;
+        }
+
+        statep->sw_cpos += nchunk;
+        copypos += nchunk;
+
+        if (copypos == statep->sw_size)
+            copypos = 0;
+
+        if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+        {
+            statep->bk_cplen = copylen;
+            statep->bk_cppos = copypos;
+            return 0;
+        }
+    }
+#endif
+
+    /* Copy across a byte at a time */
+
+    while (copylen--)
+    {
+        statep->sw_buf[statep->sw_cpos++] = statep->sw_buf[copypos++];
+
+        if (copypos == statep->sw_size)
+            copypos = 0;
+
+        if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+        {
+            statep->bk_cplen = copylen;
+            statep->bk_cppos = copypos;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  inflate_match(statep, decsym, htdis) - Copy for a length symbol
+ *
+ *  RFC 1951, section 3.2.5
+ *
+ *  decsym is a decoded length symbol, 257 and up. Fetches its extra
+ *  bits, then the distance using htdis (or the fixed 5 bit distance
+ *  codes if htdis is NULL) and does the copy.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(inflate_match)(clz_state *statep, int decsym,
+                                    Hufftbl *htdis)
+{
+    int copylen, copydist;
+
+    /* copy length: Use the g_htextra lookups to fetch extra bits
+       and add those to a base length */
+
+    if (decsym >= CLZ_CODESOK_LL)
+    {
+        statep->error = CLZ_ERR_CORRUPT;
+        return 0;
+    }
+
+    decsym -= 257;
+
+    STATS_INC(statep, matches);
+    STATS_INC(statep, len_hist[decsym]);
+
+    copylen = KFN(breg_fetch)(statep, g_htextra.lenbits[decsym]);
+    if (statep->error)
+        return 0;
+
+    copylen += g_htextra.lenbase[decsym];
+
+
+    /* The next decode from input is distance (htdis). Also
+       fetch extra bits and add those to a base length. Fixed
+       distance codes are just 5 bits, reversed: */
+
+    if (!htdis)
+    {
+        decsym = g_byterev[KFN(breg_fetch)(statep, 5)] >> 3;
+        if (statep->error)
+            return 0;
+    }
+    else if ((decsym = KFN(huff_decode_input)(statep, htdis)) < 0)
+        return 0;
+
+    if (decsym >= CLZ_CODESOK_DIS)
+    {
+        statep->error = CLZ_ERR_CORRUPT;
+        return 0;
+    }
+
+    STATS_INC(statep, dist_hist[decsym]);
+
+    copydist = KFN(breg_fetch)(statep, g_htextra.disbits[decsym]);
+    if (statep->error)
+        return 0;
+
+    copydist += g_htextra.disbase[decsym];
+
+
+    /* Have a length and a backward distance. This is backwards
+       from 1 to 32768 into what is an output ring of at least 32K
+       so can end up with a negative start point (thus sw_cpos
+       and copydist are both signed ints) */
+
+    copydist = statep->sw_cpos - copydist;
+    if (copydist < 0)
+    {
+        /* Distance refers beyond the start of the buffer, wrap it */
+
+        copydist += statep->sw_size;
+
+        if (!statep->sw_filled)
+        {
+            /* Buffer cannot be wrapped as it was never filled */
+            statep->error = CLZ_ERR_CORRUPT;
+            return 0;
+        }
+    }
+
+    return KFN(slwin_copy)(statep, copylen, copydist);
+}
+
+
+
+
+/*
+ *  finish_copy(statep) - Finish a copy the output limit interrupted
+ *
+ *  Returns:  1 on success (or if there wasn't one)
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(finish_copy)(clz_state *statep)
+{
+    int copylen = statep->bk_cplen;
+
+    statep->bk_cplen = 0;
+
+    return !copylen || KFN(slwin_copy)(statep, copylen, statep->bk_cppos);
+}
+
+
+
+
+/*
+ *  inflate_block(statep) - Decompress a block
+ *
+ *  RFC 1951, section 3.2.3 and 3.2.5
+ *
+ *  Takes two huffman trees, a literal-length tree and a distance tree,
+ *  and uses those trees to deflate the input stream into the sliding
+ *  window, writing it whenever it fills. If the output limit stopped
+ *  the block part way through a copy, that copy is finished first.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(inflate_block)(clz_state *statep, Hufftbl *htll,
+                                    Hufftbl *htdis)
+{
+    int decsym;
+
+    if (!KFN(finish_copy)(statep))
+        return 0;
+
+    while (1)
+    {
+        /* The first decode from input is literal-length (htll) */
+
+        if ((decsym = KFN(huff_decode_input)(statep, htll)) < 0)
+            return 0;
+
+        /*
+         *  Decoded symbol is: End-of-block marker
+         */
+
+        if (decsym == 256)
+            break;
+
+
+        /*
+         *  Decoded symbol is: Literal byte
+         */
+
+        if (decsym < 256)
+        {
+            STATS_INC(statep, literals);
+
+            statep->sw_buf[statep->sw_cpos++] = decsym;
+
+            if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+                return 0;
+
+            continue;
+        }
+
+
+        /*
+         *  Decoded symbol is 257 to 285: copy length and distance
+         */
+
+        if (!KFN(inflate_match)(statep, decsym, htdis))
+            return 0;
+
+    }   /* while (1) ... */
+
+    return 1;
+}
+
+
+
+
+/*
+ *  inflate_fixed(statep) - Decompress a fixed Huffman block
+ *
+ *  RFC 1951, section 3.2.6
+ *
+ *  As inflate_block() but with the fixed codes. Instead of walking
+ *  a tree a bit at a time, 9 bits of input index g_fixed_ll9 which
+ *  gives the symbol and its code length at once. Only at the very end
+ *  of the input might there not be 9 bits, then it's the tree.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(inflate_fixed)(clz_state *statep)
+{
+    unsigned int entry;
+    int decsym;
+
+    if (!KFN(finish_copy)(statep))
+        return 0;
+
+    while (1)
+    {
+        if (statep->nbits >= 9 || KFN(breg_needbits)(statep, 9))
+        {
+            entry = g_fixed_ll9[statep->breg & 0x1FF];
+            decsym = entry & 0x1FF;
+
+            statep->breg >>= entry >> 9;
+            statep->nbits -= entry >> 9;
+        }
+        else if ((decsym = KFN(huff_decode_input)(statep, &g_fixed_htll)) < 0)
+            return 0;
+
+        if (decsym == 256)
+            break;
+
+        if (decsym < 256)
+        {
+            STATS_INC(statep, literals);
+
+            statep->sw_buf[statep->sw_cpos++] = decsym;
+
+            if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+                return 0;
+
+            continue;
+        }
+
+        if (!KFN(inflate_match)(statep, decsym, NULL))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  inflate_literals(statep, htll) - Decompress a literals only block
+ *
+ *  For a dynamic block with an empty distance tree, which can't have
+ *  any copies. A length symbol is an error.
+ *
+ *  Returns:  1 on success
+ *            0 to stop, as per slwin_full()
+ */
+
+static KATTR int KFN(inflate_literals)(clz_state *statep, Hufftbl *htll)
+{
+    int decsym;
+
+    while (1)
+    {
+        if ((decsym = KFN(huff_decode_input)(statep, htll)) < 0)
+            return 0;
+
+        if (decsym == 256)
+            break;
+
+        if (decsym > 256)
+        {
+            statep->error = CLZ_ERR_CORRUPT;
+            return 0;
+        }
+
+        STATS_INC(statep, literals);
+
+        statep->sw_buf[statep->sw_cpos++] = decsym;
+
+        if (statep->sw_cpos == statep->sw_stop && !slwin_full(statep))
+            return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+#endif  /* KNOINFLATE */
+
+
+#undef KFN
+#undef KATTR
+#undef KMASK
+#undef KAVX2
+#undef KSRC
+#undef KNOINFLATE
+
+
+/* vi:set ts=4 sw=4 expandtab: */
@@ -0,0 +1,534 @@
+/*
+ *  clzrecord - Split clz output into records, with an optional filter
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/* clz_records_put() is a put callback which splits the output into
+   newline or length delimited records and hands each to a record
+   callback. Records are passed as pointers into the output ring, so
+   nothing is copied except the odd record that straddles two puts,
+   which is gathered in a carry buffer. The bigger the ring (see
+   clz_set_ringsize()) the fewer of those there are.
+
+   With a filter set, only records containing the filter string are
+   passed on. For lines the search runs over the whole put first and
+   only then finds the line around each hit, so lines that don't match
+   are never even split out. Delimiter and substring searches use SSE2
+   where available. */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+#include "clz.h"
+
+
+#define CLZ_REC_CARRY_MIN   4096
+
+
+typedef struct
+{
+    int format;                 /* CLZ_REC_LINES or CLZ_REC_LEN32 */
+    int (*recfn)(void *, const void *, size_t);
+    void *recpar;
+
+    unsigned char *needle;      /* Filter string, NULL if none */
+    size_t needlelen;
+
+    unsigned char *carry;       /* Record straddling two puts */
+    size_t carrylen;
+    size_t carrymax;
+
+} clz_records;
+
+
+
+
+/*
+ *  find_byte(p, end, c) - Find the first c in [p, end)
+ *
+ *  Returns:  pointer to it, or NULL if there isn't one
+ */
+
+static const unsigned char *find_byte(const unsigned char *p,
+                                      const unsigned char *end, int c)
+{
+#ifdef __SSE2__
+    __m128i cv = _mm_set1_epi8((char)c);
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cv));
+
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+
+    return p < end ? memchr(p, c, end - p) : NULL;
+}
+
+
+
+
+/*
+ *  rfind_byte(p, end, c) - Find the last c in [p, end)
+ *
+ *  Returns:  pointer to it, or NULL if there isn't one
+ */
+
+static const unsigned char *rfind_byte(const unsigned char *p,
+                                       const unsigned char *end, int c)
+{
+#ifdef __SSE2__
+    __m128i cv = _mm_set1_epi8((char)c);
+
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(end - 16));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cv));
+
+        if (mask)
+            return end - 16 + (31 - __builtin_clz(mask));
+        end -= 16;
+    }
+#endif
+
+    while (end > p)
+    {
+        if (*--end == c)
+            return end;
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+ *  find_substr(p, end, needle, nlen) - Find needle in [p, end)
+ *
+ *  The SSE2 search compares 16 candidate positions at a time against
+ *  both the first and last bytes of the needle, and only checks the
+ *  rest where both agree.
+ *
+ *  Returns:  pointer to the first match, or NULL if there isn't one
+ */
+
+static const unsigned char *find_substr(const unsigned char *p,
+                                        const unsigned char *end,
+                                        const unsigned char *needle,
+                                        size_t nlen)
+{
+    if (nlen == 1)
+        return find_byte(p, end, needle[0]);
+
+    if (p >= end || (size_t)(end - p) < nlen)
+        return NULL;
+
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8((char)needle[0]);
+        __m128i last = _mm_set1_epi8((char)needle[nlen - 1]);
+
+        while ((size_t)(end - p) >= nlen - 1 + 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)p);
+            __m128i b = _mm_loadu_si128((const __m128i *)(p + nlen - 1));
+            int mask = _mm_movemask_epi8(_mm_and_si128(
+                                _mm_cmpeq_epi8(a, first),
+                                _mm_cmpeq_epi8(b, last)));
+
+            while (mask)
+            {
+                int bit = __builtin_ctz(mask);
+
+                if (memcmp(p + bit + 1, needle + 1, nlen - 2) == 0)
+                    return p + bit;
+                mask &= mask - 1;
+            }
+            p += 16;
+        }
+    }
+#endif
+
+    for (end -= nlen - 1; p < end; p++)
+    {
+        if ((p = find_byte(p, end, needle[0])) == NULL)
+            return NULL;
+
+        if (memcmp(p + 1, needle + 1, nlen - 1) == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+
+
+
+/*
+ *  carry_add(recp, buf, nbytes) - Add to the straddling record
+ *
+ *  Returns:  1 on success
+ *            0 on error (out of memory)
+ */
+
+static int carry_add(clz_records *recp, const unsigned char *buf,
+                     size_t nbytes)
+{
+    if (recp->carrylen + nbytes > recp->carrymax)
+    {
+        size_t newmax = recp->carrymax ? recp->carrymax : CLZ_REC_CARRY_MIN;
+        unsigned char *newbuf;
+
+        while (newmax < recp->carrylen + nbytes)
+            newmax *= 2;
+
+        if ((newbuf = realloc(recp->carry, newmax)) == NULL)
+            return 0;
+
+        recp->carry = newbuf;
+        recp->carrymax = newmax;
+    }
+
+    memcpy(recp->carry + recp->carrylen, buf, nbytes);
+    recp->carrylen += nbytes;
+    return 1;
+}
+
+
+
+
+/*
+ *  emit(recp, rec, len) - Pass a record on, if it passes the filter
+ *
+ *  Returns:  1 to carry on
+ *            0 to stop (the record callback said so)
+ */
+
+static int emit(clz_records *recp, const unsigned char *rec, size_t len)
+{
+    if (recp->needle &&
+        !find_substr(rec, rec + len, recp->needle, recp->needlelen))
+        return 1;
+
+    return recp->recfn(recp->recpar, rec, len);
+}
+
+
+
+
+/*
+ *  put_lines(recp, p, end) - Split [p, end) into lines
+ *
+ *  Returns:  1 to carry on
+ *            0 to stop
+ */
+
+static int put_lines(clz_records *recp, const unsigned char *p,
+                     const unsigned char *end)
+{
+    const unsigned char *nl, *last;
+    size_t len;
+
+    /* Finish off the line left over from the last put */
+
+    if (recp->carrylen)
+    {
+        if ((nl = find_byte(p, end, '\n')) == NULL)
+            return carry_add(recp, p, end - p);
+
+        if (!carry_add(recp, p, nl - p))
+            return 0;
+
+        len = recp->carrylen;
+        recp->carrylen = 0;
+        if (!emit(recp, recp->carry, len))
+            return 0;
+
+        p = nl + 1;
+    }
+
+    if ((last = rfind_byte(p, end, '\n')) == NULL)
+        return carry_add(recp, p, end - p);
+
+    if (!recp->needle)
+    {
+        while (p <= last)
+        {
+            nl = find_byte(p, last + 1, '\n');
+
+            if (!recp->recfn(recp->recpar, p, nl - p))
+                return 0;
+            p = nl + 1;
+        }
+    }
+    else
+    {
+        const unsigned char *hit, *start;
+
+        /* Search for the filter first, then find the line around it.
+           The filter has no newlines, so a hit is within one line */
+
+        while ((hit = find_substr(p, last, recp->needle,
+                                  recp->needlelen)) != NULL)
+        {
+            start = rfind_byte(p, hit, '\n');
+            start = start ? start + 1 : p;
+            nl = find_byte(hit, last + 1, '\n');
+
+            if (!recp->recfn(recp->recpar, start, nl - start))
+                return 0;
+            p = nl + 1;
+        }
+    }
+
+    p = last + 1;
+    return carry_add(recp, p, end - p);
+}
+
+
+
+
+/*
+ *  put_len32(recp, p, end) - Split [p, end) into length prefixed records
+ *
+ *  Returns:  1 to carry on
+ *            0 to stop
+ */
+
+static int put_len32(clz_records *recp, const unsigned char *p,
+                     const unsigned char *end)
+{
+    size_t reclen, want;
+
+    if (recp->carrylen)
+    {
+        /* The length itself may have been split */
+
+        if (recp->carrylen < 4)
+        {
+            want = 4 - recp->carrylen;
+            if (want > end - p)
+                want = end - p;
+
+            if (!carry_add(recp, p, want))
+                return 0;
+            p += want;
+
+            if (recp->carrylen < 4)
+                return 1;
+        }
+
+        reclen = recp->carry[0] | recp->carry[1] << 8 |
+                 recp->carry[2] << 16 | (size_t)recp->carry[3] << 24;
+
+        want = 4 + reclen - recp->carrylen;
+        if (want > end - p)
+            want = end - p;
+
+        if (!carry_add(recp, p, want))
+            return 0;
+        p += want;
+
+        if (recp->carrylen < 4 + reclen)
+            return 1;
+
+        recp->carrylen = 0;
+        if (!emit(recp, recp->carry + 4, reclen))
+            return 0;
+    }
+
+    while (end - p >= 4)
+    {
+        reclen = p[0] | p[1] << 8 | p[2] << 16 | (size_t)p[3] << 24;
+
+        if (end - p - 4 < reclen)
+            break;
+
+        if (!emit(recp, p + 4, reclen))
+            return 0;
+        p += 4 + reclen;
+    }
+
+    return carry_add(recp, p, end - p);
+}
+
+
+
+
+/**
+ *  clz_records_create(format, recfn, recpar) - Create a record splitter
+ *
+ *  format is CLZ_REC_LINES for newline terminated records (the newline
+ *  isn't passed on) or CLZ_REC_LEN32 for records each prefixed by a 32
+ *  bit little endian length. The splitter is a put callback for
+ *  clz_setcb_put(), with the splitter as putpar:
+ *
+ *      clz_setcb_put(gzstate, clz_records_put, recs);
+ *
+ *  Each record is passed on like: recfn(recpar, rec, reclen); rec only
+ *  lasts until recfn() returns. recfn() returns 1 to carry on, or 0 to
+ *  stop, in which case decompression stops with an output error.
+ *
+ *  Returns:  pointer to the splitter on success
+ *            NULL on error and sets errno
+ */
+
+void *clz_records_create(int format, int (*recfn)(void *, const void *, size_t),
+                         void *recpar)
+{
+    clz_records *recp;
+
+    if ((format != CLZ_REC_LINES && format != CLZ_REC_LEN32) || !recfn)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((recp = calloc(1, sizeof(clz_records))) == NULL)
+        return NULL;
+
+    recp->format = format;
+    recp->recfn = recfn;
+    recp->recpar = recpar;
+    return recp;
+}
+
+
+
+
+/**
+ *  clz_records_filter(recp, needle, nlen) - Only pass on matching records
+ *
+ *  Only records containing the nlen bytes at needle are passed on. A
+ *  NULL needle removes the filter. For CLZ_REC_LINES the needle can't
+ *  contain a newline.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno (to EINVAL or ENOMEM)
+ */
+
+int clz_records_filter(void *recp_, const void *needle, size_t nlen)
+{
+    clz_records *recp = (clz_records *)recp_;
+
+    if (recp == NULL || (needle && !nlen) ||
+        (needle && recp->format == CLZ_REC_LINES && memchr(needle, '\n', nlen)))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    free(recp->needle);
+    recp->needle = NULL;
+    recp->needlelen = 0;
+
+    if (!needle)
+        return 1;
+
+    if ((recp->needle = malloc(nlen)) == NULL)
+        return 0;
+
+    memcpy(recp->needle, needle, nlen);
+    recp->needlelen = nlen;
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_records_put(recp, buf, nbytes) - Put callback splitting records
+ *
+ *  Returns:  nbytes on success
+ *            0 if stopped by the record callback or out of memory
+ */
+
+size_t clz_records_put(void *recp_, void *buf, size_t nbytes)
+{
+    clz_records *recp = (clz_records *)recp_;
+    const unsigned char *p = (const unsigned char *)buf;
+    int ret;
+
+    if (recp->format == CLZ_REC_LINES)
+        ret = put_lines(recp, p, p + nbytes);
+    else
+        ret = put_len32(recp, p, p + nbytes);
+
+    return ret ? nbytes : 0;
+}
+
+
+
+
+/**
+ *  clz_records_finish(recp) - Pass on the last, unterminated, record
+ *
+ *  Call once the output is complete. A last line without a newline is
+ *  passed on as a record. The splitter is then ready for a new stream.
+ *
+ *  Returns:  1 on success
+ *            0 if stopped by the record callback, or on error and sets
+ *              errno (EILSEQ if a length prefixed record was cut short)
+ */
+
+int clz_records_finish(void *recp_)
+{
+    clz_records *recp = (clz_records *)recp_;
+    size_t len;
+
+    if (recp == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    len = recp->carrylen;
+    recp->carrylen = 0;
+
+    if (!len)
+        return 1;
+
+    if (recp->format == CLZ_REC_LEN32)
+    {
+        errno = EILSEQ;
+        return 0;
+    }
+
+    return emit(recp, recp->carry, len);
+}
+
+
+
+
+/*
+ *  clz_records_destroy(recp) - Free a record splitter
+ */
+
+void clz_records_destroy(void *recp_)
+{
+    clz_records *recp = (clz_records *)recp_;
+
+    if (recp == NULL)
+        return;
+
+    free(recp->needle);
+    free(recp->carry);
+    free(recp);
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
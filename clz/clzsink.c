@@ -0,0 +1,323 @@
+/*
+ *  clzsink - Output sink for clz put callbacks, zero copy to pipes
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/* When the output is a pipe (clz in a shell pipeline), full buffers
+   are handed to the kernel with vmsplice() and SPLICE_F_GIFT rather
+   than write(), so the pipe references our pages instead of copying
+   them again. A gifted page mustn't be touched while the pipe may
+   still reference it, so the buffers rotate: each is the size of the
+   pipe and there are CLZ_SINK_BUFS of them, so a buffer is only
+   reused after the pipe has been drained of it at least twice over.
+   Pipes too big for that (over CLZ_SINK_MAXBUF) aren't spliced to.
+   Buffers are mmap()ed, never from the heap, so once the sink is gone
+   the pipe's references keep the old pages alive and nothing else
+   can be given them. Anything else (files, terminals, or no
+   vmsplice) gets write(). */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+#include "clz.h"
+
+
+#define CLZ_SINK_BUFS       4
+#define CLZ_SINK_MINBUF     64 * 1024
+#define CLZ_SINK_MAXBUF     1024 * 1024
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS       MAP_ANON
+#endif
+
+
+typedef struct
+{
+    int fd;
+    int splice;                 /* Output is a pipe, use vmsplice() */
+    size_t bufsize;             /* Size of each buffer, page multiple */
+    unsigned char *bufs[CLZ_SINK_BUFS];
+    int cur;                    /* Buffer being filled */
+    size_t fill;                /* Bytes in it so far */
+
+} clz_sink;
+
+
+
+
+/*
+ *  sink_write(sinkp, buf, nbytes) - write() all of buf to the sink fd
+ *
+ *  Returns:  1 on success
+ *            0 on error (errno set by write())
+ */
+
+static int sink_write(clz_sink *sinkp, const unsigned char *buf, size_t nbytes)
+{
+    ssize_t ret;
+
+    while (nbytes)
+    {
+        ret = write(sinkp->fd, buf, nbytes);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+
+        buf += ret;
+        nbytes -= ret;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  sink_push(sinkp) - Hand the current buffer over and move to the next
+ *
+ *  Pipes get the buffer with vmsplice(), as a gift, looping until the
+ *  pipe has taken all of it. If the kernel won't have it (no
+ *  vmsplice() support) the sink drops back to write() for good.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno
+ */
+
+static int sink_push(clz_sink *sinkp)
+{
+    unsigned char *buf = sinkp->bufs[sinkp->cur];
+    size_t nbytes = sinkp->fill;
+
+    if (!nbytes)
+        return 1;
+
+#ifdef __linux__
+    while (sinkp->splice && nbytes)
+    {
+        struct iovec iov;
+        ssize_t ret;
+
+        iov.iov_base = buf;
+        iov.iov_len = nbytes;
+
+        ret = vmsplice(sinkp->fd, &iov, 1, SPLICE_F_GIFT);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EINVAL && errno != ENOSYS)
+                return 0;
+
+            sinkp->splice = 0;
+            break;
+        }
+
+        buf += ret;
+        nbytes -= ret;
+    }
+#endif
+
+    if (nbytes && !sink_write(sinkp, buf, nbytes))
+        return 0;
+
+    sinkp->fill = 0;
+
+    if (sinkp->splice)
+        sinkp->cur = (sinkp->cur + 1) % CLZ_SINK_BUFS;
+
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_sink_create(fd) - Create an output sink writing to fd
+ *
+ *  The sink is a put callback for clz_setcb_put(), with the sink as
+ *  putpar: clz_setcb_put(gzstate, clz_sink_put, sink); Output is
+ *  gathered into page aligned buffers which go to a pipe with
+ *  vmsplice(), or to anything else with write(). Call
+ *  clz_sink_flush() once the output is complete.
+ *
+ *  Returns:  pointer to the sink on success
+ *            NULL on error and sets errno
+ */
+
+void *clz_sink_create(int fd)
+{
+    clz_sink *sinkp;
+    struct stat st;
+    long pagesize;
+    int i;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if ((sinkp = calloc(1, sizeof(clz_sink))) == NULL)
+        return NULL;
+
+    sinkp->fd = fd;
+    sinkp->bufsize = CLZ_SINK_MINBUF;
+
+#ifdef __linux__
+    if (S_ISFIFO(st.st_mode))
+    {
+        int pipesize = fcntl(fd, F_GETPIPE_SZ);
+
+        /* A buffer smaller than the pipe could be refilled while the
+           pipe still has it, so a huge pipe just gets write() */
+
+        if (pipesize <= CLZ_SINK_MAXBUF)
+        {
+            sinkp->splice = 1;
+
+            if (pipesize > CLZ_SINK_MINBUF)
+                sinkp->bufsize = pipesize;
+        }
+    }
+#endif
+
+    /* Whole pages, so gifts don't share a page with the next buffer */
+
+    pagesize = sysconf(_SC_PAGESIZE);
+
+    if (pagesize <= 0)
+        pagesize = 4096;
+
+    sinkp->bufsize = (sinkp->bufsize + pagesize - 1) / pagesize * pagesize;
+
+    for (i = 0; i < (sinkp->splice ? CLZ_SINK_BUFS : 1); i++)
+    {
+        void *buf = mmap(NULL, sinkp->bufsize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (buf == MAP_FAILED)
+        {
+            clz_sink_destroy(sinkp);
+            errno = ENOMEM;
+            return NULL;
+        }
+        sinkp->bufs[i] = buf;
+    }
+
+    return sinkp;
+}
+
+
+
+
+/**
+ *  clz_sink_put(sinkp, buf, nbytes) - Put callback writing to a sink
+ *
+ *  Copies into the current buffer, pushing it out each time it fills.
+ *  When not splicing, writes at least a buffer in size skip the copy.
+ *
+ *  Returns:  nbytes on success
+ *            0 on error (errno set)
+ */
+
+size_t clz_sink_put(void *sinkp_, void *buf, size_t nbytes)
+{
+    clz_sink *sinkp = (clz_sink *)sinkp_;
+    unsigned char *src = (unsigned char *)buf;
+    size_t left = nbytes;
+
+    if (!sinkp->splice && !sinkp->fill && nbytes >= sinkp->bufsize)
+        return sink_write(sinkp, src, nbytes) ? nbytes : 0;
+
+    while (left)
+    {
+        size_t room = sinkp->bufsize - sinkp->fill;
+
+        if (room > left)
+            room = left;
+
+        memcpy(sinkp->bufs[sinkp->cur] + sinkp->fill, src, room);
+        sinkp->fill += room;
+        src += room;
+        left -= room;
+
+        if (sinkp->fill == sinkp->bufsize && !sink_push(sinkp))
+            return 0;
+    }
+
+    return nbytes;
+}
+
+
+
+
+/**
+ *  clz_sink_flush(sinkp) - Push out anything still buffered
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno
+ */
+
+int clz_sink_flush(void *sinkp)
+{
+    if (sinkp == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    return sink_push((clz_sink *)sinkp);
+}
+
+
+
+
+/*
+ *  clz_sink_destroy(sinkp) - Free a sink, without flushing it
+ *
+ *  The fd is left open. It's fine to destroy a sink while a pipe still
+ *  holds what was spliced to it: the buffers are unmapped, not freed
+ *  to the heap, so the pipe keeps those pages to itself.
+ */
+
+void clz_sink_destroy(void *sinkp_)
+{
+    clz_sink *sinkp = (clz_sink *)sinkp_;
+    int i;
+
+    if (sinkp == NULL)
+        return;
+
+    for (i = 0; i < CLZ_SINK_BUFS; i++)
+        if (sinkp->bufs[i])
+            munmap(sinkp->bufs[i], sinkp->bufsize);
+
+    free(sinkp);
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
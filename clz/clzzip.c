@@ -0,0 +1,483 @@
+/*
+ *  clzzip - Forward only zip reader on top of clz
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/* This reads a zip from the front, local header by local header, so
+   it works on pipes and sockets and entries are available as soon as
+   they arrive, with no need for the central directory at the end.
+
+   The catch is entries written with bit 3 set, whose sizes and CRC
+   aren't known until a data descriptor after the data. For deflated
+   entries that's fine: the deflate stream says where it ends (the
+   bfinal block), and clz hands back any bytes it read past the end, so
+   the descriptor is next in the input. Stored entries with bit 3 have
+   nothing to say where they end and can't be read this way. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "clz.h"
+
+
+#define CLZ_ZIP_LOCAL_SIG   0x04034B50
+#define CLZ_ZIP_DESC_SIG    0x08074B50
+#define CLZ_ZIP_CENTRAL_SIG 0x02014B50
+#define CLZ_ZIP_EOCD_SIG    0x06054B50
+#define CLZ_ZIP_EOCD64_SIG  0x06064B50
+
+#define CLZ_ZIP_ENCRYPTED   0x0001
+#define CLZ_ZIP_DESCRIPTOR  0x0008
+
+#define CLZ_ZIP_COPYBUF     64 * 1024
+
+
+typedef struct
+{
+    FILE *fp;
+    void *state;                /* clz state, reused for every entry */
+    unsigned char *copybuf;     /* For stored entries */
+
+    clz_zip_entry entry;        /* Current entry */
+    int pending;                /* Its data hasn't been read yet */
+    int zip64;                  /* Its descriptor has 64 bit sizes */
+    int done;                   /* Reached the central directory */
+
+    char *name;
+    size_t namemax;
+
+} clz_zip;
+
+
+
+
+/*
+ *  zip_read(zipp, buf, nbytes) - Read exactly nbytes
+ *
+ *  Returns:  1 on success
+ *            0 on error or end of input and sets errno
+ */
+
+static int zip_read(clz_zip *zipp, unsigned char *buf, size_t nbytes)
+{
+    if (fread(buf, 1, nbytes, zipp->fp) != nbytes)
+    {
+        errno = ferror(zipp->fp) ? errno : EIO;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  zip_skip(zipp, nbytes) - Read and discard nbytes
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno
+ */
+
+static int zip_skip(clz_zip *zipp, unsigned long long nbytes)
+{
+    size_t n;
+
+    while (nbytes)
+    {
+        n = nbytes < CLZ_ZIP_COPYBUF ? nbytes : CLZ_ZIP_COPYBUF;
+
+        if (!zip_read(zipp, zipp->copybuf, n))
+            return 0;
+
+        nbytes -= n;
+    }
+
+    return 1;
+}
+
+
+
+
+static unsigned long long get_le(const unsigned char *p, int nbytes)
+{
+    unsigned long long val = 0;
+
+    while (nbytes--)
+        val = (val << 8) | p[nbytes];
+
+    return val;
+}
+
+
+
+
+/*
+ *  zip_extra(zipp, extra, len) - Pick up zip64 sizes from an extra field
+ *
+ *  Returns:  1 on success
+ *            0 if a size is all ones and there's no zip64 field with it
+ */
+
+static int zip_extra(clz_zip *zipp, const unsigned char *extra, size_t len)
+{
+    clz_zip_entry *entryp = &zipp->entry;
+    size_t pos = 0, dlen;
+
+    while (pos + 4 <= len)
+    {
+        dlen = get_le(extra + pos + 2, 2);
+
+        if (get_le(extra + pos, 2) == 1 && pos + 4 + dlen <= len)
+        {
+            /* The local header's zip64 field has both sizes */
+
+            zipp->zip64 = 1;
+
+            if (dlen >= 16)
+            {
+                entryp->usize = get_le(extra + pos + 4, 8);
+                entryp->csize = get_le(extra + pos + 12, 8);
+            }
+            break;
+        }
+
+        pos += 4 + dlen;
+    }
+
+    return entryp->usize != 0xFFFFFFFF && entryp->csize != 0xFFFFFFFF;
+}
+
+
+
+
+/**
+ *  clz_zip_create(fp) - Create a reader for the zip coming in on fp
+ *
+ *  fp is a FILE * (void * as for clz_setcb_get()) positioned at the
+ *  start of the zip. It's only read forward, so can be a pipe. Call
+ *  clz_zip_next() for each entry in turn.
+ *
+ *  Returns:  pointer to the reader on success
+ *            NULL on error and sets errno
+ */
+
+void *clz_zip_create(void *fp)
+{
+    clz_zip *zipp;
+
+    if (fp == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((zipp = calloc(1, sizeof(clz_zip))) == NULL)
+        return NULL;
+
+    zipp->fp = (FILE *)fp;
+
+    if ((zipp->state = clz_create()) == NULL ||
+        (zipp->copybuf = malloc(CLZ_ZIP_COPYBUF)) == NULL ||
+        !clz_setcb_get(zipp->state, NULL, fp, 0))
+    {
+        clz_zip_destroy(zipp);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return zipp;
+}
+
+
+
+
+/**
+ *  clz_zip_next(zipp, entryp) - Move on to the next entry
+ *
+ *  Reads the next local header into entryp. If the previous entry's
+ *  data wasn't read, it's skipped. With bit 3 set in flags, crc32,
+ *  csize and usize aren't known until the entry has been read.
+ *  entryp->name is good until the next call.
+ *
+ *  Returns:  1 with the next entry
+ *            0 when there are no more (the central directory is next)
+ *           -1 on error and sets errno
+ */
+
+int clz_zip_next(void *zipp_, clz_zip_entry *entryp)
+{
+    clz_zip *zipp = (clz_zip *)zipp_;
+    clz_zip_entry *cur;
+    unsigned char hdr[26], *extra;
+    unsigned long sig;
+    size_t namelen, extralen;
+
+    if (zipp == NULL || entryp == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Skip an unread entry. Only fail if that lost our place */
+
+    if (zipp->pending && !clz_zip_read(zipp, NULL, NULL, NULL) && zipp->done)
+        return -1;
+
+    if (zipp->done)
+        return 0;
+
+    if (!zip_read(zipp, hdr, 4))
+        return -1;
+
+    sig = get_le(hdr, 4);
+
+    /* A split archive marker can come first, it looks like a descriptor */
+
+    if (sig == CLZ_ZIP_DESC_SIG)
+    {
+        if (!zip_read(zipp, hdr, 4))
+            return -1;
+        sig = get_le(hdr, 4);
+    }
+
+    if (sig == CLZ_ZIP_CENTRAL_SIG || sig == CLZ_ZIP_EOCD_SIG ||
+        sig == CLZ_ZIP_EOCD64_SIG)
+    {
+        zipp->done = 1;
+        return 0;
+    }
+
+    if (sig != CLZ_ZIP_LOCAL_SIG)
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    if (!zip_read(zipp, hdr, sizeof(hdr)))
+        return -1;
+
+    cur = &zipp->entry;
+    cur->flags = get_le(hdr + 2, 2);
+    cur->method = get_le(hdr + 4, 2);
+    cur->crc32 = get_le(hdr + 10, 4);
+    cur->csize = get_le(hdr + 14, 4);
+    cur->usize = get_le(hdr + 18, 4);
+    namelen = get_le(hdr + 22, 2);
+    extralen = get_le(hdr + 24, 2);
+    zipp->zip64 = 0;
+
+    if (namelen + 1 > zipp->namemax)
+    {
+        char *name = realloc(zipp->name, namelen + 1);
+
+        if (name == NULL)
+            return -1;
+
+        zipp->name = name;
+        zipp->namemax = namelen + 1;
+    }
+
+    if (!zip_read(zipp, (unsigned char *)zipp->name, namelen))
+        return -1;
+
+    zipp->name[namelen] = 0;
+    cur->name = zipp->name;
+
+    /* The extra field goes through copybuf, it's at most 64K */
+
+    extra = zipp->copybuf;
+
+    if (!zip_read(zipp, extra, extralen))
+        return -1;
+
+    if (!zip_extra(zipp, extra, extralen))
+    {
+        errno = EILSEQ;
+        return -1;
+    }
+
+    zipp->pending = 1;
+    *entryp = *cur;
+    return 1;
+}
+
+
+
+
+/*
+ *  zip_descriptor(zipp) - Read the data descriptor after an entry
+ *
+ *  Its signature is optional, which is why a CRC that happens to match
+ *  it can't be told apart - the same guess every reader has to make.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno
+ */
+
+static int zip_descriptor(clz_zip *zipp)
+{
+    clz_zip_entry *entryp = &zipp->entry;
+    unsigned char desc[20];
+    int sizelen = zipp->zip64 ? 8 : 4;
+
+    if (!zip_read(zipp, desc, 4))
+        return 0;
+
+    if (get_le(desc, 4) == CLZ_ZIP_DESC_SIG && !zip_read(zipp, desc, 4))
+        return 0;
+
+    if (!zip_read(zipp, desc + 4, 2 * sizelen))
+        return 0;
+
+    entryp->crc32 = get_le(desc, 4);
+    entryp->csize = get_le(desc + 4, sizelen);
+    entryp->usize = get_le(desc + 4 + sizelen, sizelen);
+    return 1;
+}
+
+
+
+
+/**
+ *  clz_zip_read(zipp, putfn, putpar, resultp) - Read the current entry
+ *
+ *  Deflated entries are inflated with clz_decompress(), to putfn as
+ *  for clz_setcb_put(), or only checked if putfn is NULL. Stored
+ *  entries are copied. Reading stops exactly at the end of the data,
+ *  so a following data descriptor can be read, then the sizes and CRC
+ *  are checked. resultp (optional) gets bytes in and out and the CRC.
+ *
+ *  Returns:  1 on success
+ *            0 on error and sets errno: EILSEQ for bad data, a bad CRC
+ *              or size, EIO for a truncated zip, ENOTSUP for entries
+ *              that are encrypted, use other methods, or are stored
+ *              with a data descriptor
+ */
+
+int clz_zip_read(void *zipp_, size_t (*putfn)(void *, void *, size_t),
+                 void *putpar, clz_result *resultp)
+{
+    clz_zip *zipp = (clz_zip *)zipp_;
+    clz_zip_entry *entryp;
+    clz_result res;
+
+    if (zipp == NULL || !zipp->pending)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+
+    zipp->pending = 0;
+    entryp = &zipp->entry;
+
+    if ((entryp->flags & CLZ_ZIP_ENCRYPTED) ||
+        (entryp->method != CLZ_ZIP_STORED &&
+         entryp->method != CLZ_ZIP_DEFLATED) ||
+        (entryp->method == CLZ_ZIP_STORED &&
+         (entryp->flags & CLZ_ZIP_DESCRIPTOR)))
+    {
+        /* Can skip it if its size is known, but not read it */
+
+        if (!(entryp->flags & CLZ_ZIP_DESCRIPTOR))
+            zip_skip(zipp, entryp->csize);
+        else
+            zipp->done = 1;
+
+        errno = ENOTSUP;
+        return 0;
+    }
+
+    if (entryp->method == CLZ_ZIP_STORED)
+    {
+        unsigned long long left = entryp->csize;
+        size_t n;
+
+        memset(&res, 0, sizeof(res));
+
+        while (left)
+        {
+            n = left < CLZ_ZIP_COPYBUF ? left : CLZ_ZIP_COPYBUF;
+
+            if (!zip_read(zipp, zipp->copybuf, n))
+                return 0;
+
+            if (putfn && putfn(putpar, zipp->copybuf, n) != n)
+            {
+                errno = ERANGE;
+                return 0;
+            }
+
+            res.crc32 = crc32(res.crc32, zipp->copybuf, n);
+            res.bytes_in += n;
+            left -= n;
+        }
+
+        res.bytes_out = res.bytes_in;
+    }
+    else
+    {
+        int ok;
+
+        if (putfn)
+        {
+            clz_setcb_put(zipp->state, putfn, putpar);
+            ok = clz_decompress(zipp->state, NULL, NULL);
+        }
+        else
+            ok = clz_verify(zipp->state, NULL, NULL);
+
+        /* Stop here on error, the end of the entry isn't known */
+
+        if (!ok || !clz_get_result(zipp->state, &res))
+        {
+            zipp->done = 1;
+            return 0;
+        }
+    }
+
+    if ((entryp->flags & CLZ_ZIP_DESCRIPTOR) && !zip_descriptor(zipp))
+        return 0;
+
+    if (resultp)
+        *resultp = res;
+
+    if (res.crc32 != entryp->crc32 || res.bytes_in != entryp->csize ||
+        res.bytes_out != entryp->usize)
+    {
+        errno = EILSEQ;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  clz_zip_destroy(zipp) - Free a reader. The FILE * is left open
+ */
+
+void clz_zip_destroy(void *zipp_)
+{
+    clz_zip *zipp = (clz_zip *)zipp_;
+
+    if (zipp == NULL)
+        return;
+
+    clz_destroy(zipp->state);
+    free(zipp->copybuf);
+    free(zipp->name);
+    free(zipp);
+}
+
+
+/* vi:set ts=4 sw=4 expandtab: */
@@ -14,9 +14,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <ctype.h>
-#include <math.h>
-#include <errno.h>
+#include <string.h>
 
 #include "imginf.h"
 
@@ -24,12 +22,49 @@
 
 
 /*
- *  read_ifd_exif(fp, clen) - Read an EXIF Tiff IFD section
+ *  read_ifd_ascii(ctx, ifd, ent) - Read an ASCII (type 2) IFD value
+ *
+ *  A string of length ent->cnt including terminator. This string can
+ *  be terminated early (generally to stop having to pack it into bytes
+ *  inside the value). The caller checks ent->cnt fits first. The item
+ *  is kept even when the value is cut short, as it still gets shown.
+ *
+ *  Returns: number of bytes absorbed from input if ok
+ *           0 if corrupt (or unterminated)
+ */
+
+int read_ifd_ascii(imginf_ctx *ctx, int ifd, const struct ifdentry *ent)
+{
+    imginf_item *item;
+    int ret;
+
+    item = imginf_add_tag(ctx, ifd, ent->tag, ent->type, ent->cnt);
+    if (item == NULL)
+        return 0;
+
+    ret = imginf_read_str(ctx, &item->str, &item->len, ent->cnt, 1);
+    if (ret < 0)
+    {
+        item->partial = 1;
+        return 0;
+    }
+
+    if (ret == 0)
+        return 0;       /* Unterminated */
+
+    return item->len + 1;
+}
+
+
+
+
+/*
+ *  read_ifd_exif(ctx, clen) - Read an EXIF Tiff IFD section
  *
  *  Within APP1, lies a TIFF section and within that section
  *  lies a number of IFDs, one of which is an Exif IFD.
- *  This function reads that section and dumps data (does
- *  not read g_verbose, check that before calling routine!
+ *  This function reads that section and adds its fields as
+ *  items (does not check IMGINF_DETAIL, do that before calling!)
  *
  *  All IFD entry references are relative to the very start of
  *  the TIFF header. The entries are stored on the stack as all
@@ -39,8 +74,9 @@
  *           0 if corrupt
  */
 
-int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
+int read_ifd_exif(imginf_ctx *ctx, int clen, int tiffoff, int isle)
 {
+    imginf_item *item;
     unsigned char buf[20];
     struct ifdentry ifdent[20];         /* 400 bytes */
     int exifoff, nents, nfields, i;
@@ -55,7 +91,7 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
     if (clen < 6)
         return 0;
 
-    if (fread(buf, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, buf, 2))
         return 0;
 
     clen -=2; exifoff += 2;
@@ -66,9 +102,9 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
         return 0;
 
 
-    printf("\n"
-           "    Camera\n"
-           "    ------\n");
+    if ((item = imginf_add(ctx, IMGINF_ITEM_IFD)) == NULL)
+        return 0;
+    item->ifd = IFD_TN_EXIF;
 
 
     /* Read fields */
@@ -77,7 +113,7 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
     {
         unsigned int tag, type, cnt, dval, wval;
 
-        if (fread(buf, 1, 12, fp) != 12)
+        if (!imginf_get(ctx, buf, 12))
             return 0;
 
         clen -= 12; exifoff += 12;
@@ -111,7 +147,7 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
 
                 if (nents >= NELEMS(ifdent))
                 {
-                    printf("Internal error, out of space in exif parser\n");
+                    ctx->res->overflow = "exif";
                     return 0;
                 }
 
@@ -125,287 +161,26 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
             break;
 
 
-            case 0xA001:
-                printf("    Color space: ");
-                if (wval == 1)
-                    printf("sRGB\n");
-                else if (wval == 0xFFFF)
-                    printf("Uncalibrated\n");
-                else
-                    printf("Reserved\n");
-            break;
-
-
-            case 0x8822:
-                printf("    Exposure program: ");
-                switch (wval)
-                {
-                    case 1: printf("Manual\n");
-                            break;
-                    case 2: printf("Normal\n");
-                            break;
-                    case 3: printf("Aperture priority\n");
-                            break;
-                    case 4: printf("Shutter priority\n");
-                            break;
-                    case 5: printf("Creative (depth of field bias)\n");
-                            break;
-                    case 6: printf("Action (shutter speed bias)\n");
-                            break;
-                    case 7: printf("Portrait mode\n");
-                            break;
-                    case 8: printf("Landscape mode\n");
-                            break;
-                    default:
-                            printf("Not defined\n");
-                }
-            break;
-
-
-            case 0x8827:
-                printf("    Speed rating: ISO-%u\n", wval);
-            break;
-
-
-            case 0x9207:
-                printf("    Metering mode: ");
-                switch (wval)
-                {
-                    case 0: printf("Unknown\n");
-                            break;
-                    case 1: printf("Average\n");
-                            break;
-                    case 2: printf("Center weighted average\n");
-                            break;
-                    case 3: printf("Spot\n");
-                            break;
-                    case 4: printf("MultiSpot\n");
-                            break;
-                    case 5: printf("Pattern\n");
-                            break;
-                    case 6: printf("Partial\n");
-                            break;
-                    default:
-                            printf("Other\n");
-                }
-            break;
-
-
-            case 0x9208:
-                printf("    Light source: ");
-                switch (wval)
-                {
-                    case  0: printf("Unknown\n");
-                             break;
-                    case  1: printf("Daylight\n");
-                             break;
-                    case  2: printf("Fluorescent\n");
-                             break;
-                    case  3: printf("Incandescent\n");
-                             break;
-                    case  4: printf("Flash\n");
-                             break;
-                    case  9: printf("Fine weather\n");
-                             break;
-                    case 10: printf("Cloudy weather\n");
-                             break;
-                    case 11: printf("Shade\n");
-                             break;
-                    case 12: printf("Daylight fluorescent\n");
-                             break;
-                    case 13: printf("Day white fluorescent\n");
-                             break;
-                    case 14: printf("Cool white fluorescent\n");
-                             break;
-                    case 15: printf("White fluorescent\n");
-                             break;
-                    case 17: printf("Standard light A\n");
-                             break;
-                    case 18: printf("Standard light B\n");
-                             break;
-                    case 19: printf("Standard light C\n");
-                             break;
-                    case 20: printf("D55\n");
-                             break;
-                    case 21: printf("D65\n");
-                             break;
-                    case 22: printf("D75\n");
-                             break;
-                    case 23: printf("D50\n");
-                             break;
-                    case 24: printf("ISO studio tungsten\n");
-                             break;
-                    default:
-                                printf("Other\n");
-                }
-            break;
-
-
-            case 0x9209:
-                printf("    Flash: ");
-                switch (wval)
-                {
-                    case 0x00: printf("No flash\n");
-                               break;
-                    case 0x01: printf("Flash\n");
-                               break;
-                    case 0x05: printf("Flash,No detect\n");
-                               break;
-                    case 0x07: printf("Flash,Detected\n");
-                               break;
-                    case 0x09: printf("Flash,Compulsory\n");
-                               break;
-                    case 0x0D: printf("Flash,Compulsory,No detect\n");
-                               break;
-                    case 0x0F: printf("Flash,Compulsory,Detected\n");
-                               break;
-                    case 0x10: printf("No flash,Compulsory\n");
-                               break;
-                    case 0x18: printf("No flash,Auto\n");
-                               break;
-                    case 0x19: printf("Flash,Auto\n");
-                               break;
-                    case 0x1D: printf("Flash,Auto,No detect\n");
-                               break;
-                    case 0x1F: printf("Flash,Auto,Detected\n");
-                               break;
-                    case 0x20: printf("No flash function\n");
-                               break;
-                    case 0x41: printf("Flash,Red-eye\n");
-                               break;
-                    case 0x45: printf("Flash,Red-eye,No detect\n");
-                               break;
-                    case 0x47: printf("Flash,Red-eye,Detected\n");
-                               break;
-                    case 0x49: printf("Flash,Compulsory,Red-eye\n");
-                               break;
-                    case 0x4D: printf("Flash,Compulsory,Red-eye,No detect\n");
-                               break;
-                    case 0x4F: printf("Flash,Compulsory,Red-eye,Detected\n");
-                               break;
-                    case 0x59: printf("Flash,Auto,Red-eye\n");
-                               break;
-                    case 0x5D: printf("Flash,Auto,Red-eye,No detect\n");
-                               break;
-                    case 0x5F: printf("Flash,Auto,Red-eye,Detected\n");
-                               break;
-                    default:
-                               printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA402:
-                printf("    Exposure mode: ");
-                switch (wval)
-                {
-                    case 0: printf("Auto exposure\n");
-                            break;
-                    case 1: printf("Manual exposure\n");
-                            break;
-                    case 2: printf("Auto bracket\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA403:
-                printf("    White balance: ");
-                switch (wval)
-                {
-                    case 0: printf("Auto white balance\n");
-                            break;
-                    case 1: printf("Manual white balance\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA406:
-                printf("    Scene capture type: ");
-                switch (wval)
-                {
-                    case 0: printf("Standard\n");
-                            break;
-                    case 1: printf("Landscape\n");
-                            break;
-                    case 2: printf("Portrait\n");
-                            break;
-                    case 3: printf("Night scene\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA408:
-                printf("    Contrast: ");
-                switch (wval)
-                {
-                    case 0: printf("Normal\n");
-                            break;
-                    case 1: printf("Soft\n");
-                            break;
-                    case 2: printf("Hard\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA409:
-                printf("    Saturation: ");
-                switch (wval)
-                {
-                    case 0: printf("Normal\n");
-                            break;
-                    case 1: printf("Low\n");
-                            break;
-                    case 2: printf("High\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA40A:
-                printf("    Sharpness: ");
-                switch (wval)
-                {
-                    case 0: printf("Normal\n");
-                            break;
-                    case 1: printf("Soft\n");
-                            break;
-                    case 2: printf("Hard\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
-            break;
-
-
-            case 0xA40C:
-                printf("    Subject distance range: ");
-                switch (wval)
-                {
-                    case 0: printf("Unknown\n");
-                            break;
-                    case 1: printf("Macro\n");
-                            break;
-                    case 2: printf("Close\n");
-                            break;
-                    case 3: printf("Distant\n");
-                            break;
-                    default:
-                            printf("Reserved\n");
-                }
+            case 0xA001:        /* ColorSpace */
+            case 0x8822:        /* ExposureProgram */
+            case 0x8827:        /* ISOSpeedRatings */
+            case 0x9207:        /* MeteringMode */
+            case 0x9208:        /* LightSource */
+            case 0x9209:        /* Flash */
+            case 0xA402:        /* ExposureMode */
+            case 0xA403:        /* WhiteBalance */
+            case 0xA406:        /* SceneCaptureType */
+            case 0xA408:        /* Contrast */
+            case 0xA409:        /* Saturation */
+            case 0xA40A:        /* Sharpness */
+            case 0xA40C:        /* SubjectDistanceRange */
+
+                /* Short values, right there in the field */
+
+                item = imginf_add_tag(ctx, IFD_TN_EXIF, tag, type, cnt);
+                if (item == NULL)
+                    return 0;
+                item->val[0] = wval;
             break;
 
 
@@ -422,7 +197,7 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
     qsort(ifdent, nents, sizeof(ifdent[0]), ifdcompare);
 
 
-    /* Scan the rest of the IFD block and dump the rest of the info */
+    /* Scan the rest of the IFD block for the rest of the info */
 
     for (i = 0; i < nents; i++)
     {
@@ -434,7 +209,7 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
         if (bhop > clen)
             return 0;
 
-        if (!fp_move_forward(fp, bhop))
+        if (!imginf_skip(ctx, bhop))
             return 0;
 
         clen -= bhop; exifoff += bhop;
@@ -452,35 +227,15 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
                having to pack it into bytes inside the dword value)
             */
 
-            int ch, k;
+            int ret;
 
             if (clen < ifdent[i].cnt)
                 return 0;
 
-            printf("    %s: ", ifdent[i].name);
-
-            for (k = 0; k < ifdent[i].cnt; k++)
-            {
-                ch = getc(fp);
-                if (ch < 0)
-                    return 0;
-
-                clen--; exifoff++;
-
-                if (ch == 0)
-                    break;
-                else if (isprint(ch))
-                    printf("%c", ch);
-                else
-                    printf("?");
-            }
-
-            if (k == 0)
-                printf("(no value)");
-            printf("\n");
+            if ((ret = read_ifd_ascii(ctx, IFD_TN_EXIF, &ifdent[i])) == 0)
+                return 0;
 
-            if (k >= ifdent[i].cnt)
-                return 0;       /* Unterminated */
+            clen -= ret; exifoff += ret;
         }
 
 
@@ -490,68 +245,28 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
                use those for which .cnt is 1 and I attempt not
                to do stupid things like divide by zero! */
 
-            uint32_t num, den, tag;
-            double frac;
+            uint32_t num, den;
 
             if (clen < 8)
                 return 0;
 
-            if (fread(buf, 1, 8, fp) != 8)
+            if (!imginf_get(ctx, buf, 8))
                 return 0;
 
             clen -= 8; exifoff += 8;
 
             num = str_to_dword(buf + 0, isle);
             den = str_to_dword(buf + 4, isle);
-            tag = ifdent[i].tag;
-
-            printf("    %s: ", ifdent[i].name);
 
             if (den == 0)
                 den = 1;        /* Yes, I've seen this done... */
 
-            frac = (double)num/(double)den;
-
-            if (tag == 0x829A)          /* ExposureTime */
-            {
-                if (frac >= 1.0 || frac == 0.0)
-                    printf("%.1f\n", frac);
-                else
-                    printf("1/%.0f\n", 1.0/frac);
-            }
-
-            else if (tag == 0x829D)     /* F-stop */
-            {
-                printf("f/%.1f\n", frac);
-            }
-
-            else if (tag == 0x9202 ||   /* Aperture */
-                     tag == 0x9205  )   /* Max aperture */
-            {
-                errno = 0;
-                frac = pow(2, frac/2.0);
-                if (errno)
-                    printf("Unknown\n");
-                else
-                    printf("f/%.1f\n", frac);
-            }
-
-            else if (tag == 0x9206)     /* Distance */
-            {
-                if (num == 0xFFFFFFFF)
-                    printf("Infinity\n");
-
-                else if (num == 0)
-                    printf("Unknown\n");
-
-                else
-                    printf("%.2f\n", frac);
-            }
-
-            else
-            {
-                printf("%.1f\n", frac);
-            }
+            item = imginf_add_tag(ctx, IFD_TN_EXIF, ifdent[i].tag,
+                                  ifdent[i].type, ifdent[i].cnt);
+            if (item == NULL)
+                return 0;
+            item->num[0] = num;
+            item->den[0] = den;
         }
 
 
@@ -561,56 +276,27 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
                Only: 0x9201, 0x9203, 0x9204 */
 
             int32_t snum, sden;
-            unsigned int tag;
-            double frac;
 
             if (clen < 8)
                 return 0;
 
-            if (fread(buf, 1, 8, fp) != 8)
+            if (!imginf_get(ctx, buf, 8))
                 return 0;
 
             clen -= 8; exifoff += 8;
 
             snum = (int32_t)str_to_dword(buf + 0, isle);
             sden = (int32_t)str_to_dword(buf + 4, isle);
-            tag  = ifdent[i].tag;
-
-            printf("    %s: ", ifdent[i].name);
 
             if (sden == 0)
                 sden = 1;
 
-            frac = (double)snum/(double)sden;
-
-            if (tag == 0x9201)          /* Shutter Speed */
-            {
-                errno = 0;
-                frac = pow(2, -frac);
-                if (errno)
-                    printf("Unknown\n");
-                else
-                {
-                    if (frac >= 1.0 || frac == 0.0)
-                        printf("%.1f\n", frac);
-                    else
-                        printf("1/%.0f\n", 1.0/frac);
-                }
-            }
-
-            else if (tag == 0x9203)     /* Brightness */
-            {
-                if ((uint32_t)snum == 0xFFFFFFFF)
-                    printf("Unknown\n");
-                else
-                    printf("%.2f\n", frac);
-            }
-
-            else if (tag == 0x9204)     /* Exposure Bias */
-            {
-                printf("%.2f step\n", frac);
-            }
-
+            item = imginf_add_tag(ctx, IFD_TN_EXIF, ifdent[i].tag,
+                                  ifdent[i].type, ifdent[i].cnt);
+            if (item == NULL)
+                return 0;
+            item->num[0] = (uint32_t)snum;
+            item->den[0] = (uint32_t)sden;
         }
 
     }   /* end for() */
@@ -623,18 +309,21 @@ int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle)
 
 
 /*
- *  read_ifd_gps(fp, clen) - Read a GPS IFD section
+ *  read_ifd_gps(ctx, clen) - Read a GPS IFD section
  *
  *  The Tiff section may point to a GPS IFD. This function reads
- *  that section and dumps data (does not use g_verbose).
+ *  that section and adds its fields as items (does not check
+ *  IMGINF_DETAIL). The references all come before the values
+ *  they go with, so each item gets its reference in ref.
  *  As per read_ifd_exif for the most part...
  *
  *  Returns: number of bytes absorbed from input if ok
  *           0 if corrupt
  */
 
-int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
+int read_ifd_gps(imginf_ctx *ctx, int clen, int tiffoff, int isle)
 {
+    imginf_item *item;
     unsigned char buf[20];
     struct ifdentry ifdent[10];
     int gpsoff, nents, nfields, i;
@@ -658,7 +347,7 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
     if (clen < 6)
         return 0;
 
-    if (fread(buf, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, buf, 2))
         return 0;
 
     clen -=2; gpsoff += 2;
@@ -669,9 +358,9 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
         return 0;
 
 
-    printf("\n"
-           "    GPS Data\n"
-           "    --------\n");
+    if ((item = imginf_add(ctx, IMGINF_ITEM_IFD)) == NULL)
+        return 0;
+    item->ifd = IFD_TN_GPS;
 
 
     /* Read fields */
@@ -680,7 +369,7 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
     {
         unsigned int tag, type, cnt, dval;
 
-        if (fread(buf, 1, 12, fp) != 12)
+        if (!imginf_get(ctx, buf, 12))
             return 0;
 
         clen -= 12; gpsoff += 12;
@@ -704,7 +393,7 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
 
                 if (nents >= NELEMS(ifdent))
                 {
-                    printf("Internal error, out of space in gps parser\n");
+                    ctx->res->overflow = "gps";
                     return 0;
                 }
 
@@ -719,8 +408,13 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
 
 
             case 0x00:      /* GPSVersionID */
-                printf("    GPS Version ID: %u.%u.%u.%u\n",
-                        buf[8], buf[9], buf[10], buf[11]);
+                item = imginf_add_tag(ctx, IFD_TN_GPS, tag, type, cnt);
+                if (item == NULL)
+                    return 0;
+                item->val[0] = buf[8];
+                item->val[1] = buf[9];
+                item->val[2] = buf[10];
+                item->val[3] = buf[11];
             break;
 
 
@@ -764,7 +458,7 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
     qsort(ifdent, nents, sizeof(ifdent[0]), ifdcompare);
 
 
-    /* Scan IFD blocks and dump info */
+    /* Scan IFD blocks for the values */
 
     for (i = 0; i < nents; i++)
     {
@@ -776,7 +470,7 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
         if (bhop > clen)
             return 0;
 
-        if (!fp_move_forward(fp, bhop))
+        if (!imginf_skip(ctx, bhop))
             return 0;
 
         clen -= bhop; gpsoff += bhop;
@@ -794,35 +488,15 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
                having to pack it into bytes inside the value)
             */
 
-            int ch, k;
+            int ret;
 
             if (clen < ifdent[i].cnt)
                 return 0;
 
-            printf("    %s: ", ifdent[i].name);
-
-            for (k = 0; k < ifdent[i].cnt; k++)
-            {
-                ch = getc(fp);
-                if (ch < 0)
-                    return 0;
-
-                clen--; gpsoff++;
-
-                if (ch == 0)
-                    break;
-                else if (isprint(ch))
-                    printf("%c", ch);
-                else
-                    printf("?");
-            }
-
-            if (k == 0)
-                printf("(no value)");
-            printf("\n");
+            if ((ret = read_ifd_ascii(ctx, IFD_TN_GPS, &ifdent[i])) == 0)
+                return 0;
 
-            if (k >= ifdent[i].cnt)
-                return 0;       /* Unterminated */
+            clen -= ret; gpsoff += ret;
         }
 
 
@@ -836,14 +510,13 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
 
             int k;
             uint32_t num[3], den[3];
-            double frac[3];
 
             if (clen < 8 * 3)
                 return 0;
 
             for (k = 0; k < 3; k++)
             {
-                if (fread(buf, 1, 8, fp) != 8)
+                if (!imginf_get(ctx, buf, 8))
                     return 0;
 
                 clen -= 8; gpsoff += 8;
@@ -852,50 +525,16 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
                 den[k] = str_to_dword(buf + 4, isle);
                 if (den[k] == 0)
                     den[k] = 1;
-
-                frac[k] = (double)num[k]/(double)den[k];
             }
 
-            printf("    %s: ", ifdent[i].name);
-
-            if (ifdent[i].tag == 0x07)
-            {
-                /* Time stamp */
-                printf("%.0f:%.0f:%.2f\n", frac[0], frac[1], frac[2]);
-            }
-            else
-            {
-                /* Lat/lon */
-
-                printf("%.0f", frac[0]);
-
-                if (den[1] == 1)
-                {
-                    /* DD MM SS */
-                    printf(" %.0f %.2f", frac[1], frac[2]);
-                }
-                else
-                {
-                    /* DD MM.MMMM [sss?] */
-
-                    if (den[1] == 10)
-                        printf(" %.1f", frac[1]);
-                    else if (den[1] == 100)
-                        printf(" %.2f", frac[1]);
-                    else if (den[1] == 1000)
-                        printf(" %.3f", frac[1]);
-                    else
-                        printf(" %.4f", frac[1]);
-
-                    if (num[2] != 0)
-                        printf("%.2f", frac[2]);
-                }
+            item = imginf_add_tag(ctx, IFD_TN_GPS, ifdent[i].tag,
+                                  ifdent[i].type, ifdent[i].cnt);
+            if (item == NULL)
+                return 0;
 
-                if (ifdent[i].tag == 0x02)
-                    printf(" %c\n", ref_lat);
-                else
-                    printf(" %c\n", ref_lon);
-            }
+            memcpy(item->num, num, sizeof(num));
+            memcpy(item->den, den, sizeof(den));
+            item->ref = ifdent[i].tag == 0x02 ? ref_lat : ref_lon;
         }
 
 
@@ -904,12 +543,11 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
             /* Rational: Two ulongs in a fraction. One of these */
 
             uint32_t num, den;
-            double frac;
 
             if (clen < 8)
                 return 0;
 
-            if (fread(buf, 1, 8, fp) != 8)
+            if (!imginf_get(ctx, buf, 8))
                 return 0;
 
             clen -= 8; gpsoff += 8;
@@ -919,52 +557,19 @@ int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle)
             if (den == 0)
                 den = 1;
 
-            frac = (double)num/(double)den;
-
-            printf("    %s: ", ifdent[i].name);
+            item = imginf_add_tag(ctx, IFD_TN_GPS, ifdent[i].tag,
+                                  ifdent[i].type, ifdent[i].cnt);
+            if (item == NULL)
+                return 0;
+            item->num[0] = num;
+            item->den[0] = den;
 
             switch (ifdent[i].tag)
             {
-                case 0x06:      /* GPSAltitude */
-                    if (ref_alt)
-                        printf("-");
-                    printf("%.1f m\n", frac);
-                break;
-
-                case 0x0D:      /* GPSSpeed */
-                    printf("%.1f", frac);
-
-                    if (ref_speed == 'K' || ref_speed == 'k')
-                        printf(" kph");
-                    else if (ref_speed == 'M' || ref_speed == 'm')
-                        printf(" mph");
-                    else if (ref_speed == 'N' || ref_speed == 'n')
-                        printf(" knots");
-
-                    printf("\n");
-                break;
-
-                case 0x0F:      /* GPSTrack */
-                    printf("%.0f", frac);
-
-                    if (ref_track == 'T' || ref_track == 't')
-                        printf(" (deg true)");
-                    else if (ref_track == 'M' || ref_track == 'm')
-                        printf(" (deg magnetic)");
-
-                    printf("\n");
-                break;
-
-                case 0x11:      /* GPSImgDirection */
-                    printf("%.0f", frac);
-
-                    if (ref_imgdir == 'T' || ref_imgdir == 't')
-                        printf(" (deg true)");
-                    else if (ref_imgdir == 'M' || ref_imgdir == 'm')
-                        printf(" (deg magnetic)");
-
-                    printf("\n");
-                break;
+                case 0x06: item->ref = ref_alt;     break;
+                case 0x0D: item->ref = ref_speed;   break;
+                case 0x0F: item->ref = ref_track;   break;
+                case 0x11: item->ref = ref_imgdir;  break;
             }
         }
 
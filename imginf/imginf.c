@@ -13,6 +13,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 
@@ -31,33 +32,21 @@ int _CRT_glob = 0;  /* Mingw glob expands argv[] by default */
 
 
 int g_verbose;
+int g_recurse;
+int g_flags;
+imginf_pool *g_pool;
 
 
-void status_line(const char *fname, int status)
-{
-    switch (status)
-    {
-        case 1:  status = 'F'; break;
-        case 2:  status = 'E'; break;
-        default: status = 'C';
-    }
-
-    printf("%c%48s", status, " ");
-
-    if (strlen(fname) >= 30)
-        printf("%.26s...\n", fname);
-    else
-        printf("%s\n", fname);
-}
-
-
-
+/*
+ *  process_image(fname, format) - Parse and print one image
+ *
+ *  With -j, the printing happens later, but always in the same order
+ */
 
-void status_header(void)
+void process_image(const char *fname, int format)
 {
-    printf("   width  height  depth  colour  dpi  print(mm)  filename\n"
-           "---------------------------------------------------------"
-           "----------------------\n");
+    if (!imginf_pool_add(g_pool, fname, format))
+        printf("imginf: Out of memory for %s\n", fname);
 }
 
 
@@ -69,7 +58,7 @@ void process_img_all(void)
 {
     WIN32_FIND_DATA finddata;
     HANDLE hFind;
-    int len, ret, nfiles = 0;
+    int len, nfiles = 0;
     char *ext;
 
     hFind = FindFirstFile("*", &finddata);
@@ -99,21 +88,17 @@ void process_img_all(void)
         if (strcasecmp(ext, "png") == 0)
         {
             if (nfiles++ == 0 && !g_verbose)
-                status_header();
+                imginf_print_header(stdout);
 
-            ret = process_image_png(finddata.cFileName);
-            if (!g_verbose && ret)
-                status_line(finddata.cFileName, ret);
+            process_image(finddata.cFileName, IMGINF_PNG);
         }
         else if (strcasecmp(ext, "jpg") == 0 ||
                  strcasecmp(ext, "jpeg") == 0)
         {
             if (nfiles++ == 0 && !g_verbose)
-                status_header();
+                imginf_print_header(stdout);
 
-            ret = process_image_jpg(finddata.cFileName);
-            if (!g_verbose && ret)
-                status_line(finddata.cFileName, ret);
+            process_image(finddata.cFileName, IMGINF_JPG);
         }
 
     } while (FindNextFile(hFind, &finddata));
@@ -131,7 +116,7 @@ void process_img_all(void)
     DIR *dp;
     struct dirent *dentp;
     struct stat sb;
-    int len, ret, nfiles = 0;
+    int len, nfiles = 0;
     char *ext;
 
     if ((dp = opendir(".")) == NULL)
@@ -163,21 +148,17 @@ void process_img_all(void)
         if (strcasecmp(ext, "png") == 0)
         {
             if (nfiles++ == 0 && !g_verbose)
-                status_header();
+                imginf_print_header(stdout);
 
-            ret = process_image_png(dentp->d_name);
-            if (!g_verbose && ret)
-                status_line(dentp->d_name, ret);
+            process_image(dentp->d_name, IMGINF_PNG);
         }
         else if (strcasecmp(ext, "jpg") == 0 ||
                  strcasecmp(ext, "jpeg") == 0)
         {
             if (nfiles++ == 0 && !g_verbose)
-                status_header();
+                imginf_print_header(stdout);
 
-            ret = process_image_jpg(dentp->d_name);
-            if (!g_verbose && ret)
-                status_line(dentp->d_name, ret);
+            process_image(dentp->d_name, IMGINF_JPG);
         }
 
     }
@@ -195,10 +176,19 @@ void imginf_help(void)
 {
     printf( "\n"
             "imginf usage:\n"
-            "   imginf [-v] [file1] [file2] ...\n"
+            "   imginf [-v] [-m] [-j threads] [file1] [file2] ...\n"
+#ifndef _WIN32
+            "   imginf -r [-v] [-m] [-j threads] [dir1] [dir2] ...\n"
+#endif
             "\n"
             "   With no files given, imginf scans the current directory\n"
             "   Files given cannot be wildcards or directories\n"
+            "   -j parses that many files at once, output stays in order\n"
+            "   -m maps each file into memory rather than reading it\n"
+#ifndef _WIN32
+            "   -r scans the directories given (or the current one) and\n"
+            "      everything under them, in no particular order with -j\n"
+#endif
             "\n");
 }
 
@@ -256,9 +246,13 @@ int file_seems_valid(const char *fname)
 
 int main(int argc, char **argv)
 {
-    int i, opt, ret;
+    int i, opt, ret, nthreads = 1;
 
-    while ((opt = gumbo_getopt(argc, argv, ":h?v")) != -1)
+#ifdef _WIN32
+    while ((opt = gumbo_getopt(argc, argv, ":h?vmj:")) != -1)
+#else
+    while ((opt = gumbo_getopt(argc, argv, ":h?vmrj:")) != -1)
+#endif
     {
         switch (opt)
         {
@@ -271,6 +265,23 @@ int main(int argc, char **argv)
                 g_verbose = 1;
                 break;
 
+            case 'm':
+                g_flags |= IMGINF_MMAP;
+                break;
+
+            case 'r':
+                g_recurse = 1;
+                break;
+
+            case 'j':
+                nthreads = atoi(Optarg);
+                if (nthreads < 1)
+                {
+                    printf("imginf: Bad thread count (%s)\n", Optarg);
+                    return 2;
+                }
+                break;
+
             default:
                 printf("imginf: Incorrect usage (%c)\n", Optopt);
                 imginf_help();
@@ -278,6 +289,26 @@ int main(int argc, char **argv)
     }
 
 
+#ifndef _WIN32
+    if (g_recurse)
+    {
+        static char *dot[] = { "." };
+
+        if (Optind == argc)
+            ret = imginf_walk(dot, 1, nthreads, stdout, g_verbose,
+                              g_flags);
+        else
+            ret = imginf_walk(argv + Optind, argc - Optind, nthreads,
+                              stdout, g_verbose, g_flags);
+
+        if (ret < 0)
+            printf("imginf: Out of memory\n");
+        else if (ret == 0)
+            printf("No files found\n");
+        return 0;
+    }
+#endif
+
     for (i = Optind; i < argc; i++)
     {
         ret = file_seems_valid(argv[i]);
@@ -289,35 +320,36 @@ int main(int argc, char **argv)
     }
 
 
+    g_pool = imginf_pool_create(nthreads, stdout, g_verbose, g_flags);
+    if (g_pool == NULL)
+    {
+        printf("imginf: Cannot start %d threads\n", nthreads);
+        return 2;
+    }
+
     if (Optind == argc)
     {
         process_img_all();
+        imginf_pool_finish(g_pool);
         return 0;
     }
 
     /* Process each image on the command line. No wildcards are allowed */
 
     if (!g_verbose)
-        status_header();
+        imginf_print_header(stdout);
 
     for (i = Optind; i < argc; i++)
     {
         ret = file_seems_valid(argv[i]);
 
         if (ret == 1)
-        {
-            ret = process_image_png(argv[i]);
-            if (!g_verbose && ret)
-                status_line(argv[i], ret);
-        }
+            process_image(argv[i], IMGINF_PNG);
         else if (ret == 2)
-        {
-            ret = process_image_jpg(argv[i]);
-            if (!g_verbose && ret)
-                status_line(argv[i], ret);
-        }
+            process_image(argv[i], IMGINF_JPG);
     }
 
+    imginf_pool_finish(g_pool);
     return 0;
 }
 
@@ -3,6 +3,9 @@
  */
 
 
+#include <stdint.h>
+
+
 #ifndef NELEMS
 #define NELEMS(a)  (sizeof(a) / sizeof((a)[0]))
 #endif
@@ -53,16 +56,208 @@ extern __inline__ unsigned int str_to_dword(const unsigned char *str, int isle)
 }
 
 
-extern int g_verbose;
+/*
+ *  libimginf: imginf_parse() fills in an imginf_result with everything
+ *  found in one image and keeps no state of its own, so any number of
+ *  threads can parse at once. Printing is imgprint.c's job.
+ */
+
+#define IMGINF_PNG      1
+#define IMGINF_JPG      2
+
+#define IMGINF_DETAIL   0x01        /* Exif, GPS and text too, not just size */
+#define IMGINF_MMAP     0x02        /* Map the file rather than read it */
+
+
+/* Why parsing stopped, if it did */
+
+#define IMGINF_E_OPEN       1       /* Cannot open file */
+#define IMGINF_E_NOTPNG     2       /* Not a PNG file */
+#define IMGINF_E_NOTJPG     3       /* Not a JPG file (too short) */
+#define IMGINF_E_NOTJPEG    4       /* Not a JPEG file (no SOI) */
+#define IMGINF_E_CORRUPT    5       /* Corrupt in some way */
+#define IMGINF_E_NOFRAME    6       /* JPG with no frame (SOF) */
+
+
+/* What an imginf_item holds */
+
+#define IMGINF_ITEM_IHDR    1       /* PNG size: val[] w, h, depth, colour */
+#define IMGINF_ITEM_PHYS    2       /* PNG pHYs: val[] x, y, spec, dpi x, y,
+                                       mm x, y */
+#define IMGINF_ITEM_TEXT    3       /* PNG tEXt: str is the key, value */
+#define IMGINF_ITEM_SOF     4       /* JPG frame: val[] w, h, depth, comps */
+#define IMGINF_ITEM_JFIF    5       /* JPG JFIF: val[] unit, x, y */
+#define IMGINF_ITEM_IFD     6       /* Start of a TIFF, Exif or GPS IFD */
+#define IMGINF_ITEM_TAG     7       /* A TIFF, Exif or GPS field */
+
+
+/*
+ *  One thing found in the image, in the order found. Tags keep the raw
+ *  field: val[0] is a short value, num/den up to three rationals (cast
+ *  srationals to int32_t), str an ASCII value. GPS fields carry their
+ *  reference letter in ref.
+ */
+
+typedef struct imginf_item
+{
+    struct imginf_item *next;
+
+    int kind;                       /* IMGINF_ITEM_* */
+    int ifd;                        /* IFD_TN_* for IFD and TAG */
+    unsigned int tag;
+    unsigned int type;              /* TIFF field type */
+    unsigned int cnt;
+
+    unsigned int val[7];
+    uint32_t num[3], den[3];
+    int ref;
+
+    const char *str;                /* In the arena or the mapped file, so
+                                       not NUL terminated: use len */
+    unsigned int len;
+    const char *value;              /* tEXt value */
+    unsigned int valuelen;
+    unsigned int valuemax;          /* tEXt value length in the chunk */
+
+    int partial;                    /* File ended part way through */
+
+} imginf_item;
+
+
+/*
+ *  Per-call memory for items and strings, freed all at once. The first
+ *  block is part of the result so most images need no malloc at all.
+ */
+
+#define IMGINF_ARENA_FIRST  4096
+
+typedef struct imginf_block
+{
+    struct imginf_block *next;
+    size_t used, size;
+
+} imginf_block;
+
+typedef struct
+{
+    imginf_block *cur;
+    imginf_block *extra;            /* malloc()ed blocks */
+    union
+    {
+        imginf_block blk;
+        double align;
+        unsigned char space[IMGINF_ARENA_FIRST];
+    } first;
+
+} imginf_arena;
+
+
+typedef struct
+{
+    int format;                     /* IMGINF_PNG or IMGINF_JPG */
+    int error;                      /* IMGINF_E_*, 0 if parsed ok */
+    const char *overflow;           /* Parser that ran out of tag space */
+
+    unsigned int width, height, depth;
+    unsigned int colortype;         /* PNG */
+    unsigned int components;        /* JPG */
+
+    unsigned int ppu_x, ppu_y;      /* PNG pHYs */
+    unsigned int dpi_x, dpi_y;
+    unsigned int mm_x, mm_y;
+    unsigned int ppu_spec;
+
+    unsigned int res_x, res_y, res_unit;    /* JPG Exif */
+    unsigned int den_x, den_y, den_unit;    /* JPG JFIF */
+
+    imginf_item *items;             /* In the order found */
+    imginf_item **itemtail;
+
+    imginf_arena arena;
 
+    void *map;                      /* Mapped file (IMGINF_MMAP) that */
+    size_t maplen;                  /* strings may point into */
+
+} imginf_result;
+
+
+typedef struct
+{
+    const char *fname;
+    int format;                     /* IMGINF_PNG, IMGINF_JPG, 0 to look */
+    int flags;                      /* IMGINF_DETAIL, IMGINF_MMAP */
+
+} imginf_source;
+
+
+/*
+ *  Parsing state, one per imginf_parse() call. The parsers see the file
+ *  through a window: the first IMGINF_PREFIX bytes from one read, which
+ *  is usually all the headers there are. A read past the window moves
+ *  it on with another read from there; skips read nothing. Mapped,
+ *  the window is the whole file and strings are read in place.
+ */
+
+#define IMGINF_PREFIX   (64 * 1024)
+
+typedef struct
+{
+    int fd;
+    unsigned char *buf;             /* Window on the file */
+    long long base;                 /* File offset of buf[0] */
+    unsigned int len;               /* Bytes in buf */
+    int eof;                        /* File ends at base + len */
+    long long pos;                  /* Where the parser is up to */
+    int mapped;                     /* buf is the whole file, mapped */
+
+    int flags;
+    imginf_result *res;
+
+} imginf_ctx;
+
+
+extern int imginf_parse(const imginf_source *src, imginf_result *resp);
+extern void imginf_free(imginf_result *resp);
+
+/* imgpool.c: parse on worker threads, print in order */
+
+typedef struct imginf_pool imginf_pool;
+
+extern imginf_pool *imginf_pool_create(int nthreads, FILE *out, int verbose,
+                                       int flags);
+extern int imginf_pool_add(imginf_pool *pool, const char *fname, int format);
+extern void imginf_pool_finish(imginf_pool *pool);
+
+/* imgwalk.c: parse whole trees on threads (not on Windows) */
+
+extern int imginf_walk(char **roots, int nroots, int nthreads, FILE *out,
+                       int verbose, int flags);
+
+extern void imginf_print(FILE *out, const char *fname,
+                         const imginf_result *resp, int ret, int verbose);
+extern void imginf_print_header(FILE *out);
+extern void imginf_print_status(FILE *out, const char *fname, int ret);
+
+
+/* Internal to the parsers */
+
+extern int imginf_get(imginf_ctx *ctx, void *dst, unsigned int nbytes);
+extern int imginf_getc(imginf_ctx *ctx);
+extern int imginf_skip(imginf_ctx *ctx, int hop);
+extern void *imginf_alloc(imginf_result *resp, size_t nbytes);
+extern imginf_item *imginf_add(imginf_ctx *ctx, int kind);
+extern imginf_item *imginf_add_tag(imginf_ctx *ctx, int ifd,
+                        unsigned int tag, unsigned int type, unsigned int cnt);
+extern int imginf_read_str(imginf_ctx *ctx, const char **strp,
+                           unsigned int *lenp, unsigned int max, int nul);
 
 extern int ifdcompare(const void *a, const void *b);
 extern const char *getifdname(unsigned int tag, int tntype);
-extern int fp_move_forward(FILE *fp, int hop);
-
-extern int read_ifd_exif(FILE *fp, int clen, int tiffoff, int isle);
-extern int read_ifd_gps(FILE *fp, int clen, int tiffoff, int isle);
 
-extern int process_image_png(const char *fname);
-extern int process_image_jpg(const char *fname);
+extern int read_ifd_ascii(imginf_ctx *ctx, int ifd,
+                          const struct ifdentry *ent);
+extern int read_ifd_exif(imginf_ctx *ctx, int clen, int tiffoff, int isle);
+extern int read_ifd_gps(imginf_ctx *ctx, int clen, int tiffoff, int isle);
 
+extern int parse_png(imginf_ctx *ctx);
+extern int parse_jpg(imginf_ctx *ctx);
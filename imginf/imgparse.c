@@ -0,0 +1,502 @@
+/*
+ *  libimginf - Parse an image into an imginf_result
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <unistd.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+#endif
+
+#include "imginf.h"
+
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+
+#define ARENA_ALIGN     sizeof(double)
+#define ARENA_HDR       ((sizeof(imginf_block) + ARENA_ALIGN - 1) & \
+                                                        ~(ARENA_ALIGN - 1))
+#define ARENA_BLOCK     16384
+
+#define SKIP_CHECKED    256     /* Skips up to this must stay in the file */
+#define MAP_MAX         0x7fffffff      /* Bigger files are read instead */
+
+
+
+
+/*
+ *  read_at(fd, buf, nbytes, off) - Read nbytes at off, or to the end
+ *
+ *  Returns: bytes read, short only at the end of the file
+ */
+
+static unsigned int read_at(int fd, unsigned char *buf, unsigned int nbytes,
+                            long long off)
+{
+    unsigned int got = 0;
+    long n;
+
+#ifdef _WIN32
+    if (_lseeki64(fd, off, SEEK_SET) < 0)
+        return 0;
+#endif
+
+    while (got < nbytes)
+    {
+#ifdef _WIN32
+        n = _read(fd, buf + got, nbytes - got);
+#else
+        n = pread(fd, buf + got, nbytes - got, (off_t)(off + got));
+#endif
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        got += n;
+    }
+
+    return got;
+}
+
+
+
+
+/*
+ *  src_fill(ctx, need) - Have the need bytes at pos in the window
+ *
+ *  If they're not all there already, the window moves to start at pos
+ *  with a read of IMGINF_PREFIX bytes. need can't be more than that.
+ *
+ *  Returns: how many of them there are (less than need at the end)
+ */
+
+static unsigned int src_fill(imginf_ctx *ctx, unsigned int need)
+{
+    long long off = ctx->pos - ctx->base;
+
+    if (off + need <= ctx->len)
+        return need;
+
+    if (ctx->eof)
+        return off < ctx->len ? ctx->len - off : 0;
+
+    ctx->base = ctx->pos;
+    ctx->len = read_at(ctx->fd, ctx->buf, IMGINF_PREFIX, ctx->pos);
+    ctx->eof = ctx->len < IMGINF_PREFIX;
+
+    return need < ctx->len ? need : ctx->len;
+}
+
+
+
+
+#ifndef _WIN32
+
+/*
+ *  src_map(ctx) - Make the window the whole file, mapped
+ *
+ *  The mapping belongs to the result, as strings point into it, and
+ *  goes in imginf_free(). Only regular files are mapped. Should the
+ *  file shrink while it's mapped, touching the lost pages is SIGBUS,
+ *  which is why this is asked for and not the default.
+ *
+ *  Returns: 1 if mapped, 0 to read the file as usual
+ */
+
+static int src_map(imginf_ctx *ctx)
+{
+    struct stat st;
+    void *map;
+
+    if (fstat(ctx->fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_size == 0 || st.st_size > MAP_MAX)
+        return 0;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ctx->fd, 0);
+    if (map == MAP_FAILED)
+        return 0;
+
+    ctx->res->map = map;
+    ctx->res->maplen = st.st_size;
+
+    ctx->buf = map;
+    ctx->base = 0;
+    ctx->len = st.st_size;
+    ctx->eof = 1;
+    ctx->mapped = 1;
+    return 1;
+}
+
+#endif
+
+
+
+
+/*
+ *  imginf_get(ctx, dst, nbytes) - Read nbytes from the file
+ *
+ *  Returns: 1 if ok, 0 if the file ended first
+ */
+
+int imginf_get(imginf_ctx *ctx, void *dst, unsigned int nbytes)
+{
+    unsigned char *p = dst;
+    unsigned int n;
+
+    while (nbytes)
+    {
+        n = src_fill(ctx, nbytes < IMGINF_PREFIX ? nbytes : IMGINF_PREFIX);
+        if (!n)
+            return 0;
+
+        memcpy(p, ctx->buf + (ctx->pos - ctx->base), n);
+        p += n;
+        ctx->pos += n;
+        nbytes -= n;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  imginf_getc(ctx) - Read a byte
+ *
+ *  Returns: the byte, or -1 if the file ended
+ */
+
+int imginf_getc(imginf_ctx *ctx)
+{
+    if (ctx->pos - ctx->base >= ctx->len && !src_fill(ctx, 1))
+        return -1;
+
+    return ctx->buf[ctx->pos++ - ctx->base];
+}
+
+
+
+
+/*
+ *  imginf_skip(ctx, hop) - Move forward by hop bytes
+ *
+ *  Short skips have to land inside the file, as they always have, so
+ *  they're checked (which is free when they're within the window).
+ *  Longer ones are taken on trust, like an fseek(), and read nothing.
+ *
+ *  Returns: 1 on success, 0 on error
+ */
+
+int imginf_skip(imginf_ctx *ctx, int hop)
+{
+    if (hop < 0)
+        return 0;
+
+    if (hop <= SKIP_CHECKED && src_fill(ctx, hop) < hop)
+        return 0;
+
+    ctx->pos += hop;
+    return 1;
+}
+
+
+
+
+/*
+ *  imginf_alloc(resp, nbytes) - Allocate from the result's arena
+ *
+ *  Memory is zeroed and lasts until imginf_free(). Blocks are carved up
+ *  in order; anything too big for the current block gets a new one.
+ *
+ *  Returns: pointer to the memory, or NULL if out of memory
+ */
+
+void *imginf_alloc(imginf_result *resp, size_t nbytes)
+{
+    imginf_block *blk = resp->arena.cur;
+    unsigned char *mem;
+
+    nbytes = (nbytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if (blk->size - blk->used < nbytes)
+    {
+        size_t size = nbytes > ARENA_BLOCK ? nbytes : ARENA_BLOCK;
+
+        if ((blk = malloc(ARENA_HDR + size)) == NULL)
+            return NULL;
+
+        blk->size = size;
+        blk->used = 0;
+        blk->next = resp->arena.extra;
+        resp->arena.extra = blk;
+        resp->arena.cur = blk;
+    }
+
+    mem = (unsigned char *)blk + ARENA_HDR + blk->used;
+    blk->used += nbytes;
+
+    memset(mem, 0, nbytes);
+    return mem;
+}
+
+
+
+
+/*
+ *  imginf_add(ctx, kind) - Add an item to the end of the result
+ *
+ *  Returns: the new (zeroed) item, or NULL if out of memory
+ */
+
+imginf_item *imginf_add(imginf_ctx *ctx, int kind)
+{
+    imginf_item *item;
+
+    if ((item = imginf_alloc(ctx->res, sizeof(imginf_item))) == NULL)
+        return NULL;
+
+    item->kind = kind;
+
+    *ctx->res->itemtail = item;
+    ctx->res->itemtail = &item->next;
+    return item;
+}
+
+
+
+
+/*
+ *  imginf_add_tag(ctx, ifd, tag, type, cnt) - Add an IFD field item
+ *
+ *  Returns: the new item, or NULL if out of memory
+ */
+
+imginf_item *imginf_add_tag(imginf_ctx *ctx, int ifd, unsigned int tag,
+                            unsigned int type, unsigned int cnt)
+{
+    imginf_item *item;
+
+    if ((item = imginf_add(ctx, IMGINF_ITEM_TAG)) == NULL)
+        return NULL;
+
+    item->ifd = ifd;
+    item->tag = tag;
+    item->type = type;
+    item->cnt = cnt;
+    return item;
+}
+
+
+
+
+/*
+ *  imginf_read_str(ctx, strp, lenp, max, nul) - Read a string into the arena
+ *
+ *  Reads up to max bytes, stopping after a NUL if nul is set, and puts
+ *  what was read in *strp and *lenp (not counting any NUL). The buffer
+ *  grows as the bytes turn up, so a silly length in a corrupt file
+ *  costs no more than the file itself. When the file is mapped there's
+ *  no buffer: *strp points into the mapping.
+ *
+ *  Returns:  1 if a NUL was found (*lenp + 1 bytes were read)
+ *            0 if max bytes were read (with no NUL)
+ *           -1 if the file ended first (or out of memory)
+ */
+
+int imginf_read_str(imginf_ctx *ctx, const char **strp, unsigned int *lenp,
+                    unsigned int max, int nul)
+{
+    unsigned int len, size;
+    char *str, *bigger, *end;
+    int ch;
+
+    if (ctx->mapped)
+    {
+        if (ctx->pos > ctx->len)
+            ctx->pos = ctx->len;        /* Skipped off the end */
+
+        str = (char *)ctx->buf + ctx->pos;
+        len = ctx->len - ctx->pos;
+        if (len > max)
+            len = max;
+
+        *strp = str;
+
+        if (nul && (end = memchr(str, 0, len)) != NULL)
+        {
+            *lenp = end - str;
+            ctx->pos += *lenp + 1;
+            return 1;
+        }
+
+        *lenp = len;
+        ctx->pos += len;
+        return len == max ? 0 : -1;
+    }
+
+    size = max < 256 ? max : 256;
+
+    if ((str = imginf_alloc(ctx->res, size + 1)) == NULL)
+        return -1;
+
+    *strp = str;
+    *lenp = 0;
+
+    for (len = 0; len < max; len++)
+    {
+        if ((ch = imginf_getc(ctx)) < 0)
+            return -1;
+
+        if (ch == 0 && nul)
+            return 1;
+
+        if (len == size)
+        {
+            size = max - size < size ? max : size * 2;
+
+            if ((bigger = imginf_alloc(ctx->res, size + 1)) == NULL)
+                return -1;
+
+            memcpy(bigger, str, len);
+            *strp = str = bigger;
+        }
+
+        str[len] = ch;
+        *lenp = len + 1;
+    }
+
+    return 0;
+}
+
+
+
+
+/**
+ *  imginf_parse(src, resp) - Parse an image file into resp
+ *
+ *  src says which file, PNG or JPG (or 0 to tell from the first bytes)
+ *  and with IMGINF_DETAIL in flags, that Exif, GPS and text are wanted
+ *  too. Without, only what the summary needs is parsed. IMGINF_MMAP
+ *  maps the file (if it can) and leaves strings in the mapping rather
+ *  than copying them, so it stays mapped until imginf_free(). On
+ *  Windows, files are always read. resp is filled in from scratch and
+ *  must be given to imginf_free() afterwards, whatever the return.
+ *  Nothing is printed and nothing is kept between calls.
+ *
+ *  Returns: 0 on success
+ *           1 on open failure
+ *           2 if not a PNG/JPG file
+ *           3 if a PNG/JPG file but corrupt
+ *           with resp->error saying more
+ */
+
+int imginf_parse(const imginf_source *src, imginf_result *resp)
+{
+    imginf_ctx ctx;
+    int ret;
+
+    memset(resp, 0, sizeof(*resp));
+    resp->itemtail = &resp->items;
+    resp->arena.cur = &resp->arena.first.blk;
+    resp->arena.cur->size = IMGINF_ARENA_FIRST - ARENA_HDR;
+    resp->format = src->format;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.flags = src->flags;
+    ctx.res = resp;
+
+    ctx.fd = open(src->fname, O_RDONLY | O_BINARY | O_CLOEXEC);
+    if (ctx.fd < 0)
+    {
+        resp->error = IMGINF_E_OPEN;
+        return 1;
+    }
+
+#ifndef _WIN32
+    if ((src->flags & IMGINF_MMAP) && src_map(&ctx))
+    {
+        close(ctx.fd);
+        ctx.fd = -1;
+    }
+#endif
+
+    if (!ctx.mapped && (ctx.buf = malloc(IMGINF_PREFIX)) == NULL)
+    {
+        close(ctx.fd);
+        resp->error = IMGINF_E_OPEN;
+        return 1;
+    }
+
+    /* The one read most files need */
+
+    if (!resp->format)
+    {
+        src_fill(&ctx, 1);
+        resp->format = ctx.len && ctx.buf[0] == 0x89 ? IMGINF_PNG
+                                                      : IMGINF_JPG;
+    }
+
+    if (resp->format == IMGINF_PNG)
+        ret = parse_png(&ctx);
+    else
+        ret = parse_jpg(&ctx);
+
+    if (!ctx.mapped)
+    {
+        close(ctx.fd);
+        free(ctx.buf);
+    }
+
+    return ret;
+}
+
+
+
+
+/*
+ *  imginf_free(resp) - Free what imginf_parse() allocated for resp
+ */
+
+void imginf_free(imginf_result *resp)
+{
+    imginf_block *blk, *next;
+
+    for (blk = resp->arena.extra; blk; blk = next)
+    {
+        next = blk->next;
+        free(blk);
+    }
+
+#ifndef _WIN32
+    if (resp->map)
+        munmap(resp->map, resp->maplen);
+#endif
+
+    resp->map = NULL;
+    resp->maplen = 0;
+    resp->arena.extra = NULL;
+    resp->arena.cur = &resp->arena.first.blk;
+    resp->items = NULL;
+    resp->itemtail = &resp->items;
+}
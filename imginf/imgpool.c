@@ -0,0 +1,297 @@
+/*
+ *  Parse images on worker threads, print them in order
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  Files go into a ring of slots in the order given. Workers parse the
+ *  oldest unparsed slot into its imginf_result; the thread adding files
+ *  prints finished slots from the front of the ring, so the output is
+ *  exactly as it would be one file at a time, and nothing printed ever
+ *  interleaves. The ring is the reorder buffer: when it's full, adding
+ *  waits for the front file to be done. A slow file holds up printing
+ *  but not parsing, until the ring fills.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "imginf.h"
+
+
+#define SLOTS_PER_THREAD    32
+
+
+typedef struct
+{
+    char *fname;
+    int format;
+    int done;
+    int ret;
+    imginf_result res;
+
+} pool_slot;
+
+
+struct imginf_pool
+{
+    FILE *out;
+    int verbose;
+    int flags;
+
+    int nthreads;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;            /* Workers wait for a file or quit */
+    pthread_cond_t done;            /* Adder waits for the front file */
+
+    pool_slot *slots;
+    unsigned int nslots;
+    unsigned int head;              /* Next to print */
+    unsigned int next;              /* Next to parse */
+    unsigned int tail;              /* Next to fill */
+    int quit;
+};
+
+
+
+
+/*
+ *  pool_worker(arg) - Parse slots until told to quit
+ */
+
+static void *pool_worker(void *arg)
+{
+    imginf_pool *pool = arg;
+    imginf_source src;
+    pool_slot *slot;
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;)
+    {
+        while (pool->next == pool->tail && !pool->quit)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        if (pool->next == pool->tail)
+            break;
+
+        slot = &pool->slots[pool->next++ % pool->nslots];
+        pthread_mutex_unlock(&pool->lock);
+
+        src.fname = slot->fname;
+        src.format = slot->format;
+        src.flags = pool->flags;
+        slot->ret = imginf_parse(&src, &slot->res);
+
+        pthread_mutex_lock(&pool->lock);
+        slot->done = 1;
+        pthread_cond_signal(&pool->done);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+
+
+/*
+ *  pool_flush(pool) - Print and free finished slots from the front
+ *
+ *  Called with the lock held. Only the adding thread touches a slot
+ *  once it's done, so printing happens with the lock dropped.
+ */
+
+static void pool_flush(imginf_pool *pool)
+{
+    pool_slot *slot;
+
+    while (pool->head != pool->tail)
+    {
+        slot = &pool->slots[pool->head % pool->nslots];
+        if (!slot->done)
+            break;
+
+        pthread_mutex_unlock(&pool->lock);
+
+        imginf_print(pool->out, slot->fname, &slot->res, slot->ret,
+                     pool->verbose);
+        imginf_free(&slot->res);
+        free(slot->fname);
+        slot->fname = NULL;
+        slot->done = 0;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->head++;
+    }
+}
+
+
+
+
+/**
+ *  imginf_pool_create(nthreads, out, verbose, flags) - Start nthreads workers
+ *
+ *  Results go to out as imginf_print() has them. flags are any more
+ *  imginf_source flags to parse with (IMGINF_MMAP). With nthreads of 1 or
+ *  less there are no threads at all: each file is parsed and printed
+ *  as it's added.
+ *
+ *  Returns: the pool, or NULL if out of memory or threads
+ */
+
+imginf_pool *imginf_pool_create(int nthreads, FILE *out, int verbose,
+                                int flags)
+{
+    imginf_pool *pool;
+    int i;
+
+    if ((pool = calloc(1, sizeof(*pool))) == NULL)
+        return NULL;
+
+    pool->out = out;
+    pool->verbose = verbose;
+    pool->flags = flags | (verbose ? IMGINF_DETAIL : 0);
+
+    if (nthreads <= 1)
+        return pool;
+
+    pool->nslots = nthreads * SLOTS_PER_THREAD;
+    pool->slots = calloc(pool->nslots, sizeof(pool_slot));
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+
+    if (pool->slots == NULL || pool->threads == NULL)
+    {
+        imginf_pool_finish(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, pool) != 0)
+            break;
+        pool->nthreads++;
+    }
+
+    if (pool->nthreads < nthreads)
+    {
+        imginf_pool_finish(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+
+
+
+/**
+ *  imginf_pool_add(pool, fname, format) - Parse and print a file
+ *
+ *  fname is copied. If the ring is full this waits for the oldest file
+ *  and prints it, along with anything else finished behind it.
+ *
+ *  Returns: 1 if added, 0 if out of memory
+ */
+
+int imginf_pool_add(imginf_pool *pool, const char *fname, int format)
+{
+    imginf_source src;
+    imginf_result res;
+    pool_slot *slot;
+    char *name;
+    int ret;
+
+    if (!pool->nthreads)
+    {
+        src.fname = fname;
+        src.format = format;
+        src.flags = pool->flags;
+
+        ret = imginf_parse(&src, &res);
+        imginf_print(pool->out, fname, &res, ret, pool->verbose);
+        imginf_free(&res);
+        return 1;
+    }
+
+    if ((name = malloc(strlen(fname) + 1)) == NULL)
+        return 0;
+    strcpy(name, fname);
+
+    pthread_mutex_lock(&pool->lock);
+
+    for (;;)
+    {
+        pool_flush(pool);
+
+        if (pool->tail - pool->head < pool->nslots)
+            break;
+
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    slot = &pool->slots[pool->tail++ % pool->nslots];
+    slot->fname = name;
+    slot->format = format;
+
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+
+
+
+/**
+ *  imginf_pool_finish(pool) - Print what's left, stop and free the pool
+ */
+
+void imginf_pool_finish(imginf_pool *pool)
+{
+    int i;
+
+    if (pool->nthreads)
+    {
+        pthread_mutex_lock(&pool->lock);
+
+        for (;;)
+        {
+            pool_flush(pool);
+
+            if (pool->head == pool->tail)
+                break;
+
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+
+        pool->quit = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < pool->nthreads; i++)
+            pthread_join(pool->threads[i], NULL);
+    }
+
+    if (pool->threads && pool->slots)
+    {
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->done);
+    }
+
+    free(pool->threads);
+    free(pool->slots);
+    free(pool);
+}
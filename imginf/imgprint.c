@@ -0,0 +1,1010 @@
+/*
+ *  Print out what imginf_parse() found
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+
+#include "imginf.h"
+
+
+
+
+/*
+ *  print_chars(out, str, len) - Print a string, '?' for the unprintable
+ */
+
+static void print_chars(FILE *out, const char *str, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (isprint((unsigned char)str[i]))
+            putc(str[i], out);
+        else
+            putc('?', out);
+    }
+}
+
+
+
+
+/*
+ *  print_ascii(out, item) - Print an ASCII IFD field
+ *
+ *  If the file ended part way through, what there was is printed with
+ *  no newline, just as it came before the error.
+ */
+
+static void print_ascii(FILE *out, const imginf_item *item)
+{
+    fprintf(out, "    %s: ", getifdname(item->tag, item->ifd));
+
+    if (item->len == 0 && !item->partial)
+        fprintf(out, "(no value)");
+
+    print_chars(out, item->str, item->len);
+
+    if (!item->partial)
+        fprintf(out, "\n");
+}
+
+
+
+
+/*
+ *  print_text(out, item) - Print a PNG tEXt
+ *
+ *  The key is cut at 60 characters and the value wrapped at 60
+ */
+
+static void print_text(FILE *out, const imginf_item *item)
+{
+    const char *s;
+    int avail, clen, ch;
+
+    fprintf(out, "    \"");
+    avail = 60;
+
+    for (s = item->str; s < item->str + item->len; s++)
+    {
+        if (avail)
+        {
+            putc(isprint((unsigned char)*s) ? *s : '?', out);
+            if (!--avail)
+                fprintf(out, " ... ");
+        }
+    }
+
+    if (item->value == NULL)
+        return;             /* File ended in the key */
+
+    clen = item->valuemax;
+
+    if ( (clen && avail >= clen) || (!clen && avail >= 10) )
+        fprintf(out, "\" = ");
+    else
+        fprintf(out, "\" = \n        ");
+
+    if (!clen)
+    {
+        fprintf(out, "(no value)");
+        return;
+    }
+
+    fprintf(out, "\"");
+
+    avail = 60;
+
+    for (s = item->value; s < item->value + item->valuelen; s++)
+    {
+        ch = (unsigned char)*s;
+
+        if (ch == '\n')
+            fprintf(out, "\n        ");
+        else if (isprint(ch))
+            putc(ch, out);
+        else
+            putc('?', out);
+
+        if (!--avail)
+        {
+            avail = 60;
+            if (ch != '\n')
+                fprintf(out, "\n        ");
+        }
+    }
+
+    if (!item->partial)
+        fprintf(out, "\"\n");
+}
+
+
+
+
+/*
+ *  print_tiff(out, item) - Print a TIFF IFD field
+ */
+
+static void print_tiff(FILE *out, const imginf_item *item)
+{
+    switch (item->tag)
+    {
+        case 0x0128:        /* ResolutionUnit */
+
+            fprintf(out, "    Resolution Unit: ");
+            if (item->val[0] == 1)
+                fprintf(out, "pixels per inch\n");
+            else if (item->val[0] == 2)
+                fprintf(out, "pixels per cm\n");
+        break;
+
+        case 0x011A:        /* Xresolution */
+        case 0x011B:        /* Y resolution */
+
+            fprintf(out, "    %s: %.0f\n", getifdname(item->tag, IFD_TN_TIFF),
+                    (double)item->num[0]/(double)item->den[0]);
+        break;
+
+        default:
+            print_ascii(out, item);
+    }
+}
+
+
+
+
+/*
+ *  print_exif_short(out, item) - Print a short valued Exif field
+ *
+ *  Returns: 1 if it was one, 0 if not
+ */
+
+static int print_exif_short(FILE *out, const imginf_item *item)
+{
+    unsigned int wval = item->val[0];
+
+    switch (item->tag)
+    {
+        case 0xA001:
+            fprintf(out, "    Color space: ");
+            if (wval == 1)
+                fprintf(out, "sRGB\n");
+            else if (wval == 0xFFFF)
+                fprintf(out, "Uncalibrated\n");
+            else
+                fprintf(out, "Reserved\n");
+        break;
+
+
+        case 0x8822:
+            fprintf(out, "    Exposure program: ");
+            switch (wval)
+            {
+                case 1: fprintf(out, "Manual\n");
+                        break;
+                case 2: fprintf(out, "Normal\n");
+                        break;
+                case 3: fprintf(out, "Aperture priority\n");
+                        break;
+                case 4: fprintf(out, "Shutter priority\n");
+                        break;
+                case 5: fprintf(out, "Creative (depth of field bias)\n");
+                        break;
+                case 6: fprintf(out, "Action (shutter speed bias)\n");
+                        break;
+                case 7: fprintf(out, "Portrait mode\n");
+                        break;
+                case 8: fprintf(out, "Landscape mode\n");
+                        break;
+                default:
+                        fprintf(out, "Not defined\n");
+            }
+        break;
+
+
+        case 0x8827:
+            fprintf(out, "    Speed rating: ISO-%u\n", wval);
+        break;
+
+
+        case 0x9207:
+            fprintf(out, "    Metering mode: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Unknown\n");
+                        break;
+                case 1: fprintf(out, "Average\n");
+                        break;
+                case 2: fprintf(out, "Center weighted average\n");
+                        break;
+                case 3: fprintf(out, "Spot\n");
+                        break;
+                case 4: fprintf(out, "MultiSpot\n");
+                        break;
+                case 5: fprintf(out, "Pattern\n");
+                        break;
+                case 6: fprintf(out, "Partial\n");
+                        break;
+                default:
+                        fprintf(out, "Other\n");
+            }
+        break;
+
+
+        case 0x9208:
+            fprintf(out, "    Light source: ");
+            switch (wval)
+            {
+                case  0: fprintf(out, "Unknown\n");
+                         break;
+                case  1: fprintf(out, "Daylight\n");
+                         break;
+                case  2: fprintf(out, "Fluorescent\n");
+                         break;
+                case  3: fprintf(out, "Incandescent\n");
+                         break;
+                case  4: fprintf(out, "Flash\n");
+                         break;
+                case  9: fprintf(out, "Fine weather\n");
+                         break;
+                case 10: fprintf(out, "Cloudy weather\n");
+                         break;
+                case 11: fprintf(out, "Shade\n");
+                         break;
+                case 12: fprintf(out, "Daylight fluorescent\n");
+                         break;
+                case 13: fprintf(out, "Day white fluorescent\n");
+                         break;
+                case 14: fprintf(out, "Cool white fluorescent\n");
+                         break;
+                case 15: fprintf(out, "White fluorescent\n");
+                         break;
+                case 17: fprintf(out, "Standard light A\n");
+                         break;
+                case 18: fprintf(out, "Standard light B\n");
+                         break;
+                case 19: fprintf(out, "Standard light C\n");
+                         break;
+                case 20: fprintf(out, "D55\n");
+                         break;
+                case 21: fprintf(out, "D65\n");
+                         break;
+                case 22: fprintf(out, "D75\n");
+                         break;
+                case 23: fprintf(out, "D50\n");
+                         break;
+                case 24: fprintf(out, "ISO studio tungsten\n");
+                         break;
+                default:
+                         fprintf(out, "Other\n");
+            }
+        break;
+
+
+        case 0x9209:
+            fprintf(out, "    Flash: ");
+            switch (wval)
+            {
+                case 0x00: fprintf(out, "No flash\n");
+                           break;
+                case 0x01: fprintf(out, "Flash\n");
+                           break;
+                case 0x05: fprintf(out, "Flash,No detect\n");
+                           break;
+                case 0x07: fprintf(out, "Flash,Detected\n");
+                           break;
+                case 0x09: fprintf(out, "Flash,Compulsory\n");
+                           break;
+                case 0x0D: fprintf(out, "Flash,Compulsory,No detect\n");
+                           break;
+                case 0x0F: fprintf(out, "Flash,Compulsory,Detected\n");
+                           break;
+                case 0x10: fprintf(out, "No flash,Compulsory\n");
+                           break;
+                case 0x18: fprintf(out, "No flash,Auto\n");
+                           break;
+                case 0x19: fprintf(out, "Flash,Auto\n");
+                           break;
+                case 0x1D: fprintf(out, "Flash,Auto,No detect\n");
+                           break;
+                case 0x1F: fprintf(out, "Flash,Auto,Detected\n");
+                           break;
+                case 0x20: fprintf(out, "No flash function\n");
+                           break;
+                case 0x41: fprintf(out, "Flash,Red-eye\n");
+                           break;
+                case 0x45: fprintf(out, "Flash,Red-eye,No detect\n");
+                           break;
+                case 0x47: fprintf(out, "Flash,Red-eye,Detected\n");
+                           break;
+                case 0x49: fprintf(out, "Flash,Compulsory,Red-eye\n");
+                           break;
+                case 0x4D: fprintf(out, "Flash,Compulsory,Red-eye,No detect\n");
+                           break;
+                case 0x4F: fprintf(out, "Flash,Compulsory,Red-eye,Detected\n");
+                           break;
+                case 0x59: fprintf(out, "Flash,Auto,Red-eye\n");
+                           break;
+                case 0x5D: fprintf(out, "Flash,Auto,Red-eye,No detect\n");
+                           break;
+                case 0x5F: fprintf(out, "Flash,Auto,Red-eye,Detected\n");
+                           break;
+                default:
+                           fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA402:
+            fprintf(out, "    Exposure mode: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Auto exposure\n");
+                        break;
+                case 1: fprintf(out, "Manual exposure\n");
+                        break;
+                case 2: fprintf(out, "Auto bracket\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA403:
+            fprintf(out, "    White balance: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Auto white balance\n");
+                        break;
+                case 1: fprintf(out, "Manual white balance\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA406:
+            fprintf(out, "    Scene capture type: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Standard\n");
+                        break;
+                case 1: fprintf(out, "Landscape\n");
+                        break;
+                case 2: fprintf(out, "Portrait\n");
+                        break;
+                case 3: fprintf(out, "Night scene\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA408:
+            fprintf(out, "    Contrast: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Normal\n");
+                        break;
+                case 1: fprintf(out, "Soft\n");
+                        break;
+                case 2: fprintf(out, "Hard\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA409:
+            fprintf(out, "    Saturation: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Normal\n");
+                        break;
+                case 1: fprintf(out, "Low\n");
+                        break;
+                case 2: fprintf(out, "High\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA40A:
+            fprintf(out, "    Sharpness: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Normal\n");
+                        break;
+                case 1: fprintf(out, "Soft\n");
+                        break;
+                case 2: fprintf(out, "Hard\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        case 0xA40C:
+            fprintf(out, "    Subject distance range: ");
+            switch (wval)
+            {
+                case 0: fprintf(out, "Unknown\n");
+                        break;
+                case 1: fprintf(out, "Macro\n");
+                        break;
+                case 2: fprintf(out, "Close\n");
+                        break;
+                case 3: fprintf(out, "Distant\n");
+                        break;
+                default:
+                        fprintf(out, "Reserved\n");
+            }
+        break;
+
+
+        default:
+            return 0;
+    }
+
+    return 1;
+}
+
+
+
+
+/*
+ *  print_exif(out, item) - Print an Exif IFD field
+ */
+
+static void print_exif(FILE *out, const imginf_item *item)
+{
+    unsigned int tag = item->tag;
+    double frac;
+
+    if (print_exif_short(out, item))
+        return;
+
+    if (item->type == 2)
+    {
+        /* 0x9003, 0xA420 tags */
+
+        print_ascii(out, item);
+        return;
+    }
+
+    fprintf(out, "    %s: ", getifdname(tag, IFD_TN_EXIF));
+
+    if (item->type == 5)
+    {
+        /* Rational: Two ulongs in a fraction */
+
+        frac = (double)item->num[0]/(double)item->den[0];
+
+        if (tag == 0x829A)          /* ExposureTime */
+        {
+            if (frac >= 1.0 || frac == 0.0)
+                fprintf(out, "%.1f\n", frac);
+            else
+                fprintf(out, "1/%.0f\n", 1.0/frac);
+        }
+
+        else if (tag == 0x829D)     /* F-stop */
+        {
+            fprintf(out, "f/%.1f\n", frac);
+        }
+
+        else if (tag == 0x9202 ||   /* Aperture */
+                 tag == 0x9205  )   /* Max aperture */
+        {
+            errno = 0;
+            frac = pow(2, frac/2.0);
+            if (errno)
+                fprintf(out, "Unknown\n");
+            else
+                fprintf(out, "f/%.1f\n", frac);
+        }
+
+        else if (tag == 0x9206)     /* Distance */
+        {
+            if (item->num[0] == 0xFFFFFFFF)
+                fprintf(out, "Infinity\n");
+
+            else if (item->num[0] == 0)
+                fprintf(out, "Unknown\n");
+
+            else
+                fprintf(out, "%.2f\n", frac);
+        }
+
+        else
+        {
+            fprintf(out, "%.1f\n", frac);
+        }
+    }
+    else
+    {
+        /* Srational: Two slongs in a fraction.
+           Only: 0x9201, 0x9203, 0x9204 */
+
+        frac = (double)(int32_t)item->num[0]/(double)(int32_t)item->den[0];
+
+        if (tag == 0x9201)          /* Shutter Speed */
+        {
+            errno = 0;
+            frac = pow(2, -frac);
+            if (errno)
+                fprintf(out, "Unknown\n");
+            else
+            {
+                if (frac >= 1.0 || frac == 0.0)
+                    fprintf(out, "%.1f\n", frac);
+                else
+                    fprintf(out, "1/%.0f\n", 1.0/frac);
+            }
+        }
+
+        else if (tag == 0x9203)     /* Brightness */
+        {
+            if (item->num[0] == 0xFFFFFFFF)
+                fprintf(out, "Unknown\n");
+            else
+                fprintf(out, "%.2f\n", frac);
+        }
+
+        else if (tag == 0x9204)     /* Exposure Bias */
+        {
+            fprintf(out, "%.2f step\n", frac);
+        }
+    }
+}
+
+
+
+
+/*
+ *  print_gps(out, item) - Print a GPS IFD field
+ */
+
+static void print_gps(FILE *out, const imginf_item *item)
+{
+    const uint32_t *num = item->num, *den = item->den;
+    double frac[3];
+    int k, ref = item->ref;
+
+    if (item->tag == 0x00)          /* GPSVersionID */
+    {
+        fprintf(out, "    GPS Version ID: %u.%u.%u.%u\n",
+                item->val[0], item->val[1], item->val[2], item->val[3]);
+        return;
+    }
+
+    if (item->type == 2)            /* 0x1D date stamp tag */
+    {
+        print_ascii(out, item);
+        return;
+    }
+
+    for (k = 0; k < 3; k++)
+        frac[k] = (double)num[k]/(double)den[k];
+
+    fprintf(out, "    %s: ", getifdname(item->tag, IFD_TN_GPS));
+
+    switch (item->tag)
+    {
+        case 0x07:      /* GPSTimeStamp */
+            fprintf(out, "%.0f:%.0f:%.2f\n", frac[0], frac[1], frac[2]);
+        break;
+
+        case 0x02:      /* GPSLatitude */
+        case 0x04:      /* GPSLongitude */
+
+            fprintf(out, "%.0f", frac[0]);
+
+            if (den[1] == 1)
+            {
+                /* DD MM SS */
+                fprintf(out, " %.0f %.2f", frac[1], frac[2]);
+            }
+            else
+            {
+                /* DD MM.MMMM [sss?] */
+
+                if (den[1] == 10)
+                    fprintf(out, " %.1f", frac[1]);
+                else if (den[1] == 100)
+                    fprintf(out, " %.2f", frac[1]);
+                else if (den[1] == 1000)
+                    fprintf(out, " %.3f", frac[1]);
+                else
+                    fprintf(out, " %.4f", frac[1]);
+
+                if (num[2] != 0)
+                    fprintf(out, "%.2f", frac[2]);
+            }
+
+            fprintf(out, " %c\n", ref);
+        break;
+
+        case 0x06:      /* GPSAltitude */
+            if (ref)
+                fprintf(out, "-");
+            fprintf(out, "%.1f m\n", frac[0]);
+        break;
+
+        case 0x0D:      /* GPSSpeed */
+            fprintf(out, "%.1f", frac[0]);
+
+            if (ref == 'K' || ref == 'k')
+                fprintf(out, " kph");
+            else if (ref == 'M' || ref == 'm')
+                fprintf(out, " mph");
+            else if (ref == 'N' || ref == 'n')
+                fprintf(out, " knots");
+
+            fprintf(out, "\n");
+        break;
+
+        case 0x0F:      /* GPSTrack */
+        case 0x11:      /* GPSImgDirection */
+            fprintf(out, "%.0f", frac[0]);
+
+            if (ref == 'T' || ref == 't')
+                fprintf(out, " (deg true)");
+            else if (ref == 'M' || ref == 'm')
+                fprintf(out, " (deg magnetic)");
+
+            fprintf(out, "\n");
+        break;
+    }
+}
+
+
+
+
+/*
+ *  print_item(out, item) - Print one item, as -v shows it
+ */
+
+static void print_item(FILE *out, const imginf_item *item)
+{
+    const unsigned int *val = item->val;
+
+    switch (item->kind)
+    {
+        case IMGINF_ITEM_IHDR:
+
+            fprintf(out, "    Width x Height: %u x %u\n", val[0], val[1]);
+            fprintf(out, "    Bit depth: %u\n", val[2]);
+
+            fprintf(out, "    Color type: ");
+
+            switch (val[3])
+            {
+                case 0: fprintf(out, "grayscale\n");          break;
+                case 2: fprintf(out, "RGB\n");                break;
+                case 3: fprintf(out, "palette\n");            break;
+                case 4: fprintf(out, "grayscale + alpha\n");  break;
+                case 6: fprintf(out, "RGB + alpha\n");        break;
+                default:
+                        fprintf(out, "Unknown!\n");
+            }
+        break;
+
+
+        case IMGINF_ITEM_PHYS:
+
+            if (!val[2])
+            {
+                fprintf(out, "    Pixels per unit: %u x %u\n", val[0], val[1]);
+            }
+            else
+            {
+                fprintf(out, "    Pixels per metre: %u x %u\n", val[0], val[1]);
+                fprintf(out, "    Pixels per inch: %u x %u\n", val[3], val[4]);
+                fprintf(out, "    Printed size (mm): %u x %u\n", val[5], val[6]);
+            }
+        break;
+
+
+        case IMGINF_ITEM_TEXT:
+            print_text(out, item);
+        break;
+
+
+        case IMGINF_ITEM_SOF:
+
+            fprintf(out, "\n"
+                         "    Frame\n"
+                         "    -----\n");
+            fprintf(out, "    Width: %u\n", val[0]);
+            fprintf(out, "    Height: %u\n", val[1]);
+            fprintf(out, "    Bit depth: %u\n", val[2]);
+
+            switch (val[3])
+            {
+                case 1: fprintf(out, "    Components: Greyscale\n"); break;
+                case 3: fprintf(out, "    Components: YCbCr\n"); break;
+                case 4: fprintf(out, "    Components: CMYK\n"); break;
+            }
+        break;
+
+
+        case IMGINF_ITEM_JFIF:
+
+            fprintf(out, "\n"
+                         "    Image (JFIF)\n"
+                         "    ------------\n");
+
+            if (val[0] == 0)
+            {
+                fprintf(out, "    XY Aspect Ratio: %u:%u\n", val[1], val[2]);
+            }
+            else
+            {
+                fprintf(out, "    X Density: %u\n", val[1]);
+                fprintf(out, "    Y Density: %u\n", val[2]);
+
+                fprintf(out, "    Density Unit: ");
+
+                if (val[0] == 1)
+                    fprintf(out, "pixels per inch\n");
+                else if (val[0] == 2)
+                    fprintf(out, "pixels per cm\n");
+                else
+                    fprintf(out, "Unknown\n");
+            }
+        break;
+
+
+        case IMGINF_ITEM_IFD:
+
+            if (item->ifd == IFD_TN_TIFF)
+                fprintf(out, "\n"
+                             "    Image (TIFF)\n"
+                             "    ------------\n");
+            else if (item->ifd == IFD_TN_EXIF)
+                fprintf(out, "\n"
+                             "    Camera\n"
+                             "    ------\n");
+            else
+                fprintf(out, "\n"
+                             "    GPS Data\n"
+                             "    --------\n");
+        break;
+
+
+        case IMGINF_ITEM_TAG:
+
+            if (item->ifd == IFD_TN_TIFF)
+                print_tiff(out, item);
+            else if (item->ifd == IFD_TN_EXIF)
+                print_exif(out, item);
+            else
+                print_gps(out, item);
+        break;
+    }
+}
+
+
+
+
+/*
+ *  print_fname(out, fname) - The summary's last column
+ */
+
+static void print_fname(FILE *out, const char *fname)
+{
+    if (strlen(fname) >= 30)
+        fprintf(out, "%.26s...\n", fname);
+    else
+        fprintf(out, "%s\n", fname);
+}
+
+
+
+
+/*
+ *  print_summary(out, fname, resp) - One line for a parsed image
+ */
+
+static void print_summary(FILE *out, const char *fname,
+                          const imginf_result *resp)
+{
+    unsigned int res_x, res_unit;
+
+    if (resp->format == IMGINF_PNG)
+    {
+        fprintf(out, "P  %5u   %5u   %2u    ",
+                resp->width, resp->height, resp->depth);
+
+        switch (resp->colortype)
+        {
+            case 0: fprintf(out, "gry "); break;
+            case 2: fprintf(out, "RGB "); break;
+            case 3: fprintf(out, "palt"); break;
+            case 4: fprintf(out, "gryA"); break;
+            case 6: fprintf(out, "RGBA"); break;
+            default:fprintf(out, "Unkn");
+        }
+
+        if (resp->ppu_spec)
+        {
+            fprintf(out, "  %5u  %3u x %3u  ",
+                    resp->dpi_x, resp->mm_x, resp->mm_y);
+        }
+        else
+        {
+            fprintf(out, "                    ");
+        }
+
+        print_fname(out, fname);
+        return;
+    }
+
+    fprintf(out, "J  %5u   %5u   %2u    ",
+            resp->width, resp->height, resp->depth);
+
+    fprintf(out, "    ");         /* No colortype. Just no! */
+
+    /* Prioritise JFIF information. I have to pick one! */
+
+    res_x = resp->res_x;
+    res_unit = resp->res_unit;
+
+    if (resp->den_x)
+    {
+        res_x = resp->den_x;
+        res_unit = resp->den_unit;
+    }
+
+    if (res_x)
+    {
+        if (res_unit == 1)          /* Inch */
+        {
+            fprintf(out, "  %5u  %3.0f x %3.0f  ",
+                res_x,
+                ((double)resp->width / (double)res_x) * 25.4,
+                ((double)resp->height / (double)res_x) * 25.4);
+        }
+
+        else if (res_unit == 2)     /* cm */
+        {
+            fprintf(out, "  %5.0f  %3.0f x %3.0f  ",
+                (double)res_x * 2.54,
+                ((double)resp->width / (double)res_x) * 10,
+                ((double)resp->height / (double)res_x) * 10);
+        }
+
+        else
+        {
+            fprintf(out, "                    ");
+        }
+    }
+
+    print_fname(out, fname);
+}
+
+
+
+
+/**
+ *  imginf_print(out, fname, resp, ret, verbose) - Print a parsed image
+ *
+ *  ret is what imginf_parse() returned for resp. With verbose, prints
+ *  everything found (as far as it got) then any error. Otherwise prints
+ *  the one summary line, or a status line if it failed.
+ */
+
+void imginf_print(FILE *out, const char *fname,
+                  const imginf_result *resp, int ret, int verbose)
+{
+    const imginf_item *item;
+
+    if (!verbose)
+    {
+        if (resp->overflow)
+            fprintf(out, "Internal error, out of space in %s parser\n",
+                    resp->overflow);
+
+        if (ret)
+            imginf_print_status(out, fname, ret);
+        else
+            print_summary(out, fname, resp);
+        return;
+    }
+
+    if (resp->format == IMGINF_PNG)
+        fprintf(out, "[ %s ]\n\n", fname);
+    else
+        fprintf(out, "[ %s ]\n", fname);
+
+    for (item = resp->items; item; item = item->next)
+        print_item(out, item);
+
+    if (resp->overflow)
+        fprintf(out, "Internal error, out of space in %s parser\n",
+                resp->overflow);
+
+    switch (resp->error)
+    {
+        case IMGINF_E_OPEN:
+            fprintf(out, "\tError: Cannot open file\n");
+        break;
+
+        case IMGINF_E_NOTPNG:
+            fprintf(out, "\tError: File is not a PNG file\n");
+        break;
+
+        case IMGINF_E_NOTJPG:
+            fprintf(out, "\tError: File is not a JPG file\n");
+        break;
+
+        case IMGINF_E_NOTJPEG:
+            fprintf(out, "\tError: File is not a JPEG file\n");
+        break;
+
+        case IMGINF_E_CORRUPT:
+            fprintf(out, "\tError: File is corrupt in some way\n");
+        break;
+
+        case IMGINF_E_NOFRAME:
+            fprintf(out, "No Frame information. File is not valid\n");
+        break;
+
+        default:
+            fprintf(out, "\n\n");
+    }
+}
+
+
+
+
+/*
+ *  imginf_print_header(out) - Column headings for the summary lines
+ */
+
+void imginf_print_header(FILE *out)
+{
+    fprintf(out, "   width  height  depth  colour  dpi  print(mm)  filename\n"
+                 "---------------------------------------------------------"
+                 "----------------------\n");
+}
+
+
+
+
+/*
+ *  imginf_print_status(out, fname, ret) - Summary line for a failure
+ */
+
+void imginf_print_status(FILE *out, const char *fname, int ret)
+{
+    switch (ret)
+    {
+        case 1:  ret = 'F'; break;
+        case 2:  ret = 'E'; break;
+        default: ret = 'C';
+    }
+
+    fprintf(out, "%c%48s", ret, " ");
+    print_fname(out, fname);
+}
@@ -0,0 +1,622 @@
+/*
+ *  Walk directory trees on a pool of threads, parsing images as found
+ *
+ *  Distribution and use of this software are as per the terms of the
+ *  Simplified BSD License (also known as the "2-Clause License")
+ *
+ *  Copyright 2016 Conor F. O'Rourke. All rights reserved.
+ */
+
+/*
+ *  Each thread has a deque of directories. It scans from the front of
+ *  its own, pushing any subdirectories it finds back on the front, and
+ *  parses and prints each image as it comes across it. A thread with
+ *  nothing left steals from the back of another's deque, which is where
+ *  the biggest untouched parts of the tree are.
+ *
+ *  Entries are read with getdents64 on Linux (readdir elsewhere) and
+ *  d_type is trusted: there's only an fstatat() when it's DT_UNKNOWN,
+ *  or to see where a symlink with an image name goes. Symlinks to
+ *  directories are not followed. Subdirectories are opened relative to
+ *  their parent as they're found, so nothing is looked up by path
+ *  twice, unless a walker already has plenty queued that way.
+ *
+ *  Output is a file at a time but in no particular order when there's
+ *  more than one thread.
+ */
+
+#ifndef _WIN32
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+  #include <sys/syscall.h>
+#endif
+
+#include "imginf.h"
+
+
+#define WALK_BUFSIZE    (32 * 1024)     /* For getdents64 */
+#define WALK_HOLDFDS    64              /* Queued open per walker, at most */
+
+
+typedef struct
+{
+    char *path;
+    int fd;                     /* -1 to open by path */
+
+} Walkdir;
+
+
+typedef struct
+{
+    Walkdir *dirs;
+    int head, count, max;       /* Ring of max */
+
+} Deque;
+
+
+typedef struct Walk Walk;
+
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    Deque deque;
+    Walk *walk;
+
+} Walker;
+
+
+struct Walk
+{
+    FILE *out;
+    int verbose;
+    int flags;                  /* For imginf_parse() */
+
+    int nwalkers;
+    Walker *walkers;
+
+    pthread_mutex_t lock;       /* All deques and outstanding */
+    pthread_cond_t cond;
+    int outstanding;            /* Directories queued or being scanned */
+
+    pthread_mutex_t outlock;    /* Output and nfiles */
+    int nfiles;
+};
+
+
+
+
+/*
+ *  Directory deques, all under walk->lock
+ *  --------------------------------------
+ */
+
+static int deque_push(Deque *dq, Walkdir *dir)
+{
+    int newmax, i;
+    Walkdir *newdirs;
+
+    if (dq->count == dq->max)
+    {
+        newmax = dq->max ? dq->max * 2 : 16;
+
+        if ((newdirs = malloc(newmax * sizeof(Walkdir))) == NULL)
+            return 0;
+
+        for (i = 0; i < dq->count; i++)
+            newdirs[i] = dq->dirs[(dq->head + i) % dq->max];
+
+        free(dq->dirs);
+        dq->dirs = newdirs;
+        dq->head = 0;
+        dq->max = newmax;
+    }
+
+    /* Always on the front */
+
+    dq->head = (dq->head + dq->max - 1) % dq->max;
+    dq->dirs[dq->head] = *dir;
+    dq->count++;
+    return 1;
+}
+
+
+
+
+/*
+ *  find_dir(w, dir) - The next directory from our own deque, or stolen
+ *
+ *  Returns: 1 with *dir filled in, 0 if there's nothing anywhere
+ */
+
+static int find_dir(Walker *w, Walkdir *dir)
+{
+    Walk *walk = w->walk;
+    Deque *dq;
+    int i;
+
+    dq = &w->deque;
+
+    if (dq->count)
+    {
+        *dir = dq->dirs[dq->head];
+        dq->head = (dq->head + 1) % dq->max;
+        dq->count--;
+        return 1;
+    }
+
+    for (i = 1; i < walk->nwalkers; i++)
+    {
+        dq = &walk->walkers[(w->id + i) % walk->nwalkers].deque;
+
+        if (dq->count)
+        {
+            *dir = dq->dirs[(dq->head + --dq->count) % dq->max];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+
+/*
+ *  image_format(name) - PNG or JPG going by the extension
+ *
+ *  Returns: IMGINF_PNG, IMGINF_JPG or 0 if neither
+ */
+
+static int image_format(const char *name)
+{
+    const char *ext;
+    int len;
+
+    len = strlen(name);
+    if (len < 5)
+        return 0;
+
+    if (name[len - 4] == '.')
+        ext = &name[len - 3];
+    else if (len >= 6 && name[len - 5] == '.')
+        ext = &name[len - 4];
+    else
+        return 0;
+
+    if (strcasecmp(ext, "png") == 0)
+        return IMGINF_PNG;
+
+    if (strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0)
+        return IMGINF_JPG;
+
+    return 0;
+}
+
+
+
+
+/*
+ *  join_path(dir, name) - dir/name, or just name in "."
+ *
+ *  Returns: malloc()ed path, or NULL if out of memory
+ */
+
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir);
+    char *path;
+
+    if (strcmp(dir, ".") == 0)
+        dlen = 0;
+
+    if ((path = malloc(dlen + strlen(name) + 2)) == NULL)
+        return NULL;
+
+    memcpy(path, dir, dlen);
+
+    if (dlen && dir[dlen - 1] != '/')
+        path[dlen++] = '/';
+
+    strcpy(path + dlen, name);
+    return path;
+}
+
+
+
+
+/*
+ *  walk_print(walk, fmt, path) - A line about a directory, not an image
+ */
+
+static void walk_print(Walk *walk, const char *fmt, const char *path)
+{
+    pthread_mutex_lock(&walk->outlock);
+    fprintf(walk->out, fmt, path);
+    pthread_mutex_unlock(&walk->outlock);
+}
+
+
+
+
+/*
+ *  walk_file(walk, path, format) - Parse and print an image
+ */
+
+static void walk_file(Walk *walk, const char *path, int format)
+{
+    imginf_source src;
+    imginf_result res;
+    int ret;
+
+    src.fname = path;
+    src.format = format;
+    src.flags = walk->flags;
+
+    ret = imginf_parse(&src, &res);
+
+    pthread_mutex_lock(&walk->outlock);
+
+    if (walk->nfiles++ == 0 && !walk->verbose)
+        imginf_print_header(walk->out);
+
+    imginf_print(walk->out, path, &res, ret, walk->verbose);
+
+    pthread_mutex_unlock(&walk->outlock);
+
+    imginf_free(&res);
+}
+
+
+
+
+/*
+ *  walk_notdir(walk, path) - A root that turned out not to be a directory
+ *
+ *  An image given as a root is parsed like any other; anything else
+ *  is only mentioned.
+ */
+
+static void walk_notdir(Walk *walk, const char *path)
+{
+    int format;
+
+    if ((format = image_format(path)) != 0)
+        walk_file(walk, path, format);
+    else
+        walk_print(walk, "%s is not a directory!\n", path);
+}
+
+
+
+
+/*
+ *  walk_entry(w, dfd, dir, name, type) - Deal with one directory entry
+ *
+ *  type is a DT_* from the directory, trusted unless DT_UNKNOWN
+ */
+
+static void walk_entry(Walker *w, int dfd, const char *dir,
+                       const char *name, int type)
+{
+    Walk *walk = w->walk;
+    struct stat sb;
+    Walkdir sub;
+    char *path;
+    int format, hold;
+
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        return;
+
+    if (type == DT_UNKNOWN)
+    {
+        if (fstatat(dfd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+            return;
+
+        if (S_ISDIR(sb.st_mode))
+            type = DT_DIR;
+        else if (S_ISREG(sb.st_mode))
+            type = DT_REG;
+        else if (S_ISLNK(sb.st_mode))
+            type = DT_LNK;
+        else
+            return;
+    }
+
+    if (type == DT_DIR)
+    {
+        if ((path = join_path(dir, name)) == NULL)
+            return;
+
+        /* Past a point, queue by path so files still have descriptors */
+
+        pthread_mutex_lock(&walk->lock);
+        hold = w->deque.count < WALK_HOLDFDS;
+        pthread_mutex_unlock(&walk->lock);
+
+        sub.path = path;
+        sub.fd = -1;
+
+        if (hold)
+            sub.fd = openat(dfd, name,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+        if (hold && sub.fd < 0 && errno != EMFILE && errno != ENFILE)
+        {
+            walk_print(walk, "Access denied to %s!\n", path);
+            free(path);
+            return;
+        }
+
+        pthread_mutex_lock(&walk->lock);
+
+        if (deque_push(&w->deque, &sub))
+        {
+            walk->outstanding++;
+            pthread_cond_broadcast(&walk->cond);
+            path = NULL;
+        }
+
+        pthread_mutex_unlock(&walk->lock);
+
+        if (path)
+        {
+            if (sub.fd >= 0)
+                close(sub.fd);
+            free(path);
+        }
+        return;
+    }
+
+    if (type != DT_REG && type != DT_LNK)
+        return;
+
+    if ((format = image_format(name)) == 0)
+        return;
+
+    /* Files only, wherever a link goes */
+
+    if (type == DT_LNK &&
+        (fstatat(dfd, name, &sb, 0) != 0 || !S_ISREG(sb.st_mode)))
+        return;
+
+    if ((path = join_path(dir, name)) == NULL)
+        return;
+
+    walk_file(walk, path, format);
+    free(path);
+}
+
+
+
+
+#ifdef __linux__
+
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+
+/*
+ *  walk_entries(w, fd, dir, buf) - Every entry in the directory fd
+ *
+ *  Takes fd and closes it
+ */
+
+static void walk_entries(Walker *w, int fd, const char *dir, char *buf)
+{
+    struct linux_dirent64 *ent;
+    long n, pos;
+
+    while ((n = syscall(SYS_getdents64, fd, buf, WALK_BUFSIZE)) > 0)
+    {
+        for (pos = 0; pos < n; pos += ent->d_reclen)
+        {
+            ent = (struct linux_dirent64 *)(buf + pos);
+            walk_entry(w, fd, dir, ent->d_name, ent->d_type);
+        }
+    }
+
+    close(fd);
+}
+
+#else
+
+static void walk_entries(Walker *w, int fd, const char *dir, char *buf)
+{
+    struct dirent *dentp;
+    DIR *dp;
+
+    if ((dp = fdopendir(fd)) == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    while ((dentp = readdir(dp)) != NULL)
+        walk_entry(w, dirfd(dp), dir, dentp->d_name, dentp->d_type);
+
+    closedir(dp);
+}
+
+#endif  /* !__linux__ */
+
+
+
+
+/*
+ *  walk_thread(arg) - Scan directories until there are none anywhere
+ */
+
+static void *walk_thread(void *arg)
+{
+    Walker *w = (Walker *)arg;
+    Walk *walk = w->walk;
+    Walkdir dir;
+    char *buf;
+
+    if ((buf = malloc(WALK_BUFSIZE)) == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&walk->lock);
+
+    while (1)
+    {
+        /* Nothing to take, but directories being scanned may add more */
+
+        while (!find_dir(w, &dir) && walk->outstanding)
+            pthread_cond_wait(&walk->cond, &walk->lock);
+
+        if (!walk->outstanding)
+            break;
+
+        pthread_mutex_unlock(&walk->lock);
+
+        if (dir.fd < 0)
+            dir.fd = open(dir.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (dir.fd < 0 && errno == ENOTDIR)
+            walk_notdir(walk, dir.path);
+        else if (dir.fd < 0 && strcmp(dir.path, ".") == 0)
+            walk_print(walk, "Access denied to current directory!\n", "");
+        else if (dir.fd < 0)
+            walk_print(walk, "Access denied to %s!\n", dir.path);
+        else
+            walk_entries(w, dir.fd, dir.path, buf);
+
+        free(dir.path);
+
+        pthread_mutex_lock(&walk->lock);
+        walk->outstanding--;
+        pthread_cond_broadcast(&walk->cond);
+    }
+
+    pthread_mutex_unlock(&walk->lock);
+    free(buf);
+    return NULL;
+}
+
+
+
+
+/**
+ *  imginf_walk(roots, nroots, nthreads, out, verbose, flags) - Parse trees
+ *
+ *  Every PNG and JPG file under the roots is parsed and printed to out
+ *  as imginf_print() has it, with the summary header before the first.
+ *  flags are any more imginf_source flags to parse with (IMGINF_MMAP).
+ *  With nthreads of 1 it all happens on the calling thread.
+ *
+ *  Returns: the number of images found, -1 if out of memory
+ */
+
+int imginf_walk(char **roots, int nroots, int nthreads, FILE *out,
+                int verbose, int flags)
+{
+    Walkdir dir;
+    Walk walk;
+    int i, ok = 1;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.out = out;
+    walk.verbose = verbose;
+    walk.flags = flags | (verbose ? IMGINF_DETAIL : 0);
+
+    if ((walk.walkers = calloc(nthreads, sizeof(Walker))) == NULL)
+        return -1;
+
+    walk.nwalkers = nthreads;
+
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.cond, NULL);
+    pthread_mutex_init(&walk.outlock, NULL);
+
+    for (i = 0; i < nthreads; i++)
+    {
+        walk.walkers[i].id = i;
+        walk.walkers[i].walk = &walk;
+    }
+
+    /* Deal the roots out, they're opened by whoever takes them */
+
+    for (i = 0; i < nroots && ok; i++)
+    {
+        dir.fd = -1;
+        if ((dir.path = malloc(strlen(roots[i]) + 1)) == NULL ||
+            !deque_push(&walk.walkers[i % nthreads].deque, &dir))
+        {
+            free(dir.path);
+            ok = 0;
+            break;
+        }
+
+        strcpy(dir.path, roots[i]);
+        walk.outstanding++;
+    }
+
+    /* We're walker 0. If threads run short, fewer walkers steal from
+       the deques of the ones that never started */
+
+    for (i = 1; i < nthreads && ok; i++)
+    {
+        if (pthread_create(&walk.walkers[i].thread, NULL, walk_thread,
+                           &walk.walkers[i]) != 0)
+            break;
+    }
+
+    nthreads = i;
+
+    if (ok)
+        walk_thread(&walk.walkers[0]);
+
+    for (i = 1; i < nthreads; i++)
+        pthread_join(walk.walkers[i].thread, NULL);
+
+    /* Only anything left if out of memory */
+
+    for (i = 0; i < walk.nwalkers; i++)
+    {
+        Deque *dq = &walk.walkers[i].deque;
+
+        while (dq->count)
+        {
+            dir = dq->dirs[dq->head];
+            dq->head = (dq->head + 1) % dq->max;
+            dq->count--;
+
+            if (dir.fd >= 0)
+                close(dir.fd);
+            free(dir.path);
+        }
+
+        free(dq->dirs);
+    }
+
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.cond);
+    pthread_mutex_destroy(&walk.outlock);
+    free(walk.walkers);
+
+    return ok ? walk.nfiles : -1;
+}
+
+#endif  /* !_WIN32 */
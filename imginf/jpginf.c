@@ -1,5 +1,5 @@
 /*
- *  Dump out jpg information
+ *  Parse jpg information
  *
  *  Distribution and use of this software are as per the terms of the
  *  Simplified BSD License (also known as the "2-Clause License")
@@ -16,18 +16,6 @@
 #include "imginf.h"
 
 
-static struct {
-
-    unsigned int width;
-    unsigned int height;
-    unsigned char depth;
-
-    unsigned int res_x, res_y, res_unit;    /* Exif */
-    unsigned int den_x, den_y, den_unit;    /* JFIF */
-
-} jpginf;
-
-
 struct ifdtagname
 {
     unsigned int tag;
@@ -146,45 +134,7 @@ const char *getifdname(unsigned int tag, int tntype)
 
 
 /*
- *  fp_move_forward(fp, hop) - Uses a buffer to move fp forward by hop
- *
- *  Uses a small buffer to move forward by small amounts otherwise
- *  use fseek. Yes, this does assume fseek is completely stupid, but
- *  I've seen some pretty dim implementations that throw everything out,
- *  move the file pointer and then reread the buffer...
- *
- *  Returns: 1 on success, 0 on error
- */
-
-int fp_move_forward(FILE *fp, int hop)
-{
-    char buf[256];
-
-    if (!fp || hop < 0)
-        return 0;
-
-    if (!hop)
-        return 1;
-
-    if (hop <= sizeof(buf))
-    {
-        if (fread(buf, 1, hop, fp) != hop)
-            return 0;
-    }
-    else
-    {
-        if (fseek(fp, hop, SEEK_CUR) != 0)
-            return 0;
-    }
-
-    return 1;
-}
-
-
-
-
-/*
- *  read_sofx(fp, clen) - Read a SOF0(1,2,3) jpeg segment
+ *  read_sofx(ctx, clen) - Read a SOF0(1,2,3) jpeg segment
  *
  *  Start of Frame segment contains height, width, depth
  *  Function absorbs all bytes passed in clen
@@ -193,52 +143,46 @@ int fp_move_forward(FILE *fp, int hop)
  *  Returns: 1 if ok, 0 if corrupt
  */
 
-static int read_sofx(FILE *fp, int clen)
+static int read_sofx(imginf_ctx *ctx, int clen)
 {
+    imginf_result *res = ctx->res;
+    imginf_item *item;
     unsigned char buf[6];
 
     if (clen < 6)
         return 0;
 
-    if (fread(buf, 1, 6, fp) != 6)
+    if (!imginf_get(ctx, buf, 6))
         return 0;
 
     clen -= 6;
 
     /* Precision, 2 byte height, 2 byte width, components */
 
-    jpginf.depth = buf[0];
-    jpginf.height = strbe_to_word(buf + 1);
-    jpginf.width = strbe_to_word(buf + 3);
+    res->depth = buf[0];
+    res->height = strbe_to_word(buf + 1);
+    res->width = strbe_to_word(buf + 3);
+    res->components = buf[5];
 
-    if (jpginf.width == 0 || jpginf.height == 0 || jpginf.depth == 0)
+    if (res->width == 0 || res->height == 0 || res->depth == 0)
         return 0;
 
-    if (g_verbose)
-    {
-        printf("\n"
-               "    Frame\n"
-               "    -----\n");
-        printf("    Width: %u\n", jpginf.width);
-        printf("    Height: %u\n", jpginf.height);
-        printf("    Bit depth: %u\n", jpginf.depth);
-
-        switch (buf[5])
-        {
-            case 1: printf("    Components: Greyscale\n"); break;
-            case 3: printf("    Components: YCbCr\n"); break;
-            case 4: printf("    Components: CMYK\n"); break;
-        }
-    }
+    if ((item = imginf_add(ctx, IMGINF_ITEM_SOF)) == NULL)
+        return 0;
+
+    item->val[0] = res->width;
+    item->val[1] = res->height;
+    item->val[2] = res->depth;
+    item->val[3] = res->components;
 
-    return fp_move_forward(fp, clen);
+    return imginf_skip(ctx, clen);
 }
 
 
 
 
 /*
- *  read_tiff(fp, clen) - Read an entire TIFF block
+ *  read_tiff(ctx, clen) - Read an entire TIFF block
  *
  *  Within APP1, lies a TIFF section and within that section
  *  lies a number of IFDs (Exif, GPS). The TIFF header point to
@@ -247,15 +191,18 @@ static int read_sofx(FILE *fp, int clen)
  *  processing for any IFD is pretty similar so this function
  *  looks like read_ifd_exif and read_ifd_gps for the most part.
  *
- *  This function reads the TIFF section and dumps data if
- *  g_verbose is set. Otherwise just grabs res_[x,y,unit]
+ *  This function reads the TIFF section and adds its fields as
+ *  items if IMGINF_DETAIL is set. Otherwise just grabs res_[x,y,unit]
  *
  *  Returns: number of bytes absorbed from input if ok
  *           0 if corrupt
  */
 
-static int read_tiff(FILE *fp, int clen)
+static int read_tiff(imginf_ctx *ctx, int clen)
 {
+    imginf_result *res = ctx->res;
+    int detail = ctx->flags & IMGINF_DETAIL;
+    imginf_item *item;
     unsigned char buf[20];
     struct ifdentry ifdent[20];
     int tiffoff, nents, i, isle, nfields, bhop;
@@ -269,7 +216,7 @@ static int read_tiff(FILE *fp, int clen)
     if (clen < 8)
         return 0;
 
-    if (fread(buf, 1, 8, fp) != 8)
+    if (!imginf_get(ctx, buf, 8))
         return 0;
 
     clen -= 8; tiffoff += 8;
@@ -290,7 +237,7 @@ static int read_tiff(FILE *fp, int clen)
     if (bhop > clen)
         return 0;
 
-    if (!fp_move_forward(fp, bhop))
+    if (!imginf_skip(ctx, bhop))
         return 0;
 
     clen -= bhop; tiffoff += bhop;
@@ -302,7 +249,7 @@ static int read_tiff(FILE *fp, int clen)
     if (clen < 6)
         return 0;
 
-    if (fread(buf, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, buf, 2))
         return 0;
 
     clen -=2; tiffoff += 2;
@@ -312,11 +259,11 @@ static int read_tiff(FILE *fp, int clen)
     if (clen < nfields * 12 + 4)
         return 0;
 
-    if (g_verbose)
+    if (detail)
     {
-        printf("\n"
-               "    Image (TIFF)\n"
-               "    ------------\n");
+        if ((item = imginf_add(ctx, IMGINF_ITEM_IFD)) == NULL)
+            return 0;
+        item->ifd = IFD_TN_TIFF;
     }
 
 
@@ -326,7 +273,7 @@ static int read_tiff(FILE *fp, int clen)
     {
         unsigned int tag, type, cnt, dval;
 
-        if (fread(buf, 1, 12, fp) != 12)
+        if (!imginf_get(ctx, buf, 12))
             return 0;
 
         clen -= 12; tiffoff += 12;
@@ -348,29 +295,22 @@ static int read_tiff(FILE *fp, int clen)
 
                 /* These are all ascii so in theory could be 3 characters
                    and a null terminator. Thus fits in the val field and
-                   can be output right away... */
+                   can be kept right away... */
 
-                if (g_verbose && cnt <= 4)
+                if (detail && cnt <= 4)
                 {
-                    char *str = (char *)buf + 8;
+                    char *str;
 
                     buf[11] = 0;    /* Terminate, just in case */
 
-                    printf("    %s: ", getifdname(tag, IFD_TN_TIFF));
+                    item = imginf_add_tag(ctx, IFD_TN_TIFF, tag, type, cnt);
+                    if (item == NULL ||
+                        (str = imginf_alloc(res, 4)) == NULL)
+                        return 0;
 
-                    if (!*str)
-                        printf("(no value)");
-
-                    while (*str)
-                    {
-                        if (isprint(*str))
-                            printf("%c", *str);
-                        else
-                            printf("?");
-
-                        str++;
-                    }
-                    printf("\n");
+                    strcpy(str, (char *)buf + 8);
+                    item->str = str;
+                    item->len = strlen(str);
                 }
 
                 if (cnt <= 4)
@@ -386,7 +326,7 @@ static int read_tiff(FILE *fp, int clen)
 
                 if (nents >= NELEMS(ifdent))
                 {
-                    printf("Internal error, out of space in tiff parser\n");
+                    res->overflow = "tiff";
                     return 0;
                 }
 
@@ -404,15 +344,14 @@ static int read_tiff(FILE *fp, int clen)
 
                 /* Subtract one to be same as JFIF. Honestly... */
 
-                jpginf.res_unit = str_to_word(buf + 8, isle) - 1;
+                res->res_unit = str_to_word(buf + 8, isle) - 1;
 
-                if (g_verbose)
+                if (detail)
                 {
-                    printf("    Resolution Unit: ");
-                    if (jpginf.res_unit == 1)
-                        printf("pixels per inch\n");
-                    else if (jpginf.res_unit == 2)
-                        printf("pixels per cm\n");
+                    item = imginf_add_tag(ctx, IFD_TN_TIFF, tag, type, cnt);
+                    if (item == NULL)
+                        return 0;
+                    item->val[0] = res->res_unit;
                 }
 
             break;
@@ -438,7 +377,7 @@ static int read_tiff(FILE *fp, int clen)
         if (bhop > clen)
             return 0;
 
-        if (!fp_move_forward(fp, bhop))
+        if (!imginf_skip(ctx, bhop))
             return 0;
 
         clen -= bhop; tiffoff += bhop;
@@ -447,11 +386,11 @@ static int read_tiff(FILE *fp, int clen)
             return 0;
 
 
-        if (g_verbose && ifdent[i].tag == 0x8769)
+        if (detail && ifdent[i].tag == 0x8769)
         {
             /* An entire EXIF IFD block, somewhere up further */
 
-            int ret = read_ifd_exif(fp, clen, tiffoff, isle);
+            int ret = read_ifd_exif(ctx, clen, tiffoff, isle);
             if (!ret || ret > clen)
                 return 0;
 
@@ -459,11 +398,11 @@ static int read_tiff(FILE *fp, int clen)
             tiffoff += ret;
         }
 
-        else if (g_verbose && ifdent[i].tag == 0x8825)
+        else if (detail && ifdent[i].tag == 0x8825)
         {
-            /* GPS IFD offset. Not processed at the moment */
+            /* GPS IFD offset */
 
-            int ret = read_ifd_gps(fp, clen, tiffoff, isle);
+            int ret = read_ifd_gps(ctx, clen, tiffoff, isle);
             if (!ret || ret > clen)
                 return 0;
 
@@ -482,7 +421,7 @@ static int read_tiff(FILE *fp, int clen)
             if (clen < 8)
                 return 0;
 
-            if (fread(buf, 1, 8, fp) != 8)
+            if (!imginf_get(ctx, buf, 8))
                 return 0;
 
             clen -= 8; tiffoff += 8;
@@ -495,52 +434,35 @@ static int read_tiff(FILE *fp, int clen)
 
             frac = (double)num/(double)den;
 
-            if (g_verbose)
-                printf("    %s: %.0f\n", ifdent[i].name, frac);
+            if (detail)
+            {
+                item = imginf_add_tag(ctx, IFD_TN_TIFF, ifdent[i].tag,
+                                      ifdent[i].type, ifdent[i].cnt);
+                if (item == NULL)
+                    return 0;
+                item->num[0] = num;
+                item->den[0] = den;
+            }
 
             if (ifdent[i].tag == 0x011A)
-                jpginf.res_x = (int)(frac + 0.5);      /* Round properly */
+                res->res_x = (int)(frac + 0.5);     /* Round properly */
             else
-                jpginf.res_y = (int)(frac + 0.5);
+                res->res_y = (int)(frac + 0.5);
         }
 
-        else if (ifdent[i].type == 2 && g_verbose)
+        else if (ifdent[i].type == 2 && detail)
         {
-            /* ASCII (type 2): Same as with exif:
-               string of length ifdent[i].cnt including terminator.
-               This string can be terminated early (generally to stop
-               having to pack it into bytes inside the value)
-            */
+            /* ASCII (type 2): Same as with exif */
 
-            int ch, k;
+            int ret;
 
             if (clen < ifdent[i].cnt)
                 return 0;
 
-            printf("    %s: ", ifdent[i].name);
-
-            for (k = 0; k < ifdent[i].cnt; k++)
-            {
-                ch = getc(fp);
-                if (ch < 0)
-                    return 0;
-
-                clen--; tiffoff++;
-
-                if (ch == 0)
-                    break;
-                else if (isprint(ch))
-                    printf("%c", ch);
-                else
-                    printf("?");
-            }
-
-            if (k == 0)
-                printf("(no value)");
-            printf("\n");
+            if ((ret = read_ifd_ascii(ctx, IFD_TN_TIFF, &ifdent[i])) == 0)
+                return 0;
 
-            if (k >= ifdent[i].cnt)
-                return 0;       /* Unterminated */
+            clen -= ret; tiffoff += ret;
         }
 
     }   /* end for() */
@@ -552,10 +474,10 @@ static int read_tiff(FILE *fp, int clen)
 
 
 /*
- *  read_app1(fp, clen) - Read the jpg app1 segment (TIFF/Exif)
+ *  read_app1(ctx, clen) - Read the jpg app1 segment (TIFF/Exif)
  *
- *  This reads and dumps all information in block. Hope to
- *  gather res_x, res_y and res_unit at the very least
+ *  This reads all information in block. Hope to gather
+ *  res_x, res_y and res_unit at the very least
  *
  *  Function absorbs all bytes passed in clen
  *  (reads entire segment)
@@ -563,7 +485,7 @@ static int read_tiff(FILE *fp, int clen)
  *  Returns: 1 if ok, 0 if corrupt
  */
 
-static int read_app1(FILE *fp, int clen)
+static int read_app1(imginf_ctx *ctx, int clen)
 {
     char buf[6];
     int ret;
@@ -574,7 +496,7 @@ static int read_app1(FILE *fp, int clen)
     /* APP1 "EXIF\0\0" ident is immediately followed
        by a TIFF Header and one or two IFDs */
 
-    if (fread(buf, 1, 6, fp) != 6)
+    if (!imginf_get(ctx, buf, 6))
         return 0;
 
     clen -= 6;
@@ -587,23 +509,23 @@ static int read_app1(FILE *fp, int clen)
 
     /* Now at the very beginning of the TIFF header */
 
-    ret = read_tiff(fp, clen);
+    ret = read_tiff(ctx, clen);
     if (!ret || ret > clen)
         return 0;
 
     clen -= ret;
-    return fp_move_forward(fp, clen);
+    return imginf_skip(ctx, clen);
 }
 
 
 
 
 /*
- *  read_app0(fp, clen) - Read the jpg app0 segment, JFIF
+ *  read_app0(ctx, clen) - Read the jpg app0 segment, JFIF
  *
  *  There can be two with the same id (why!!!)
  *
- *  This reads and dumps all information in block. Should
+ *  This reads all information in block. Should
  *  gather den_x, den_y, den_unit
  *
  *  Function absorbs all bytes passed in clen
@@ -612,14 +534,16 @@ static int read_app1(FILE *fp, int clen)
  *  Returns: 1 if ok, 0 if corrupt
  */
 
-static int read_app0(FILE *fp, int clen)
+static int read_app0(imginf_ctx *ctx, int clen)
 {
+    imginf_result *res = ctx->res;
+    imginf_item *item;
     unsigned char buf[10];
 
     if (clen < 5)
         return 0;
 
-    if (fread(buf, 1, 5, fp) != 5)
+    if (!imginf_get(ctx, buf, 5))
         return 0;
 
     clen -= 5;
@@ -632,68 +556,48 @@ static int read_app0(FILE *fp, int clen)
         /* Not the end of the world as we can have
            a JFXX header instead which is skipped */
 
-        return fp_move_forward(fp, clen);
+        return imginf_skip(ctx, clen);
     }
 
     if (clen < 7)
         return 0;
 
-    if (fread(buf, 1, 7, fp) != 7)
+    if (!imginf_get(ctx, buf, 7))
         return 0;
 
     clen -= 7;
 
-    jpginf.den_unit = buf[2];
-    jpginf.den_x = strbe_to_word(buf + 3);
-    jpginf.den_y = strbe_to_word(buf + 5);
-
-    if (g_verbose)
-    {
-        printf("\n"
-               "    Image (JFIF)\n"
-               "    ------------\n");
-
-        if (jpginf.den_unit == 0)
-        {
-            printf("    XY Aspect Ratio: %u:%u\n",
-                    jpginf.den_x, jpginf.den_y);
-        }
-        else
-        {
-            printf("    X Density: %u\n", jpginf.den_x);
-            printf("    Y Density: %u\n", jpginf.den_y);
+    res->den_unit = buf[2];
+    res->den_x = strbe_to_word(buf + 3);
+    res->den_y = strbe_to_word(buf + 5);
 
-            printf("    Density Unit: ");
+    if ((item = imginf_add(ctx, IMGINF_ITEM_JFIF)) == NULL)
+        return 0;
 
-            if (jpginf.den_unit == 1)
-                printf("pixels per inch\n");
-            else if (jpginf.den_unit == 2)
-                printf("pixels per cm\n");
-            else
-                printf("Unknown\n");
-        }
-    }
+    item->val[0] = res->den_unit;
+    item->val[1] = res->den_x;
+    item->val[2] = res->den_y;
 
-    return fp_move_forward(fp, clen);
+    return imginf_skip(ctx, clen);
 }
 
 
 
 
 /*
- *  read_marker(fp) - Read a JPG file's marker segment
+ *  read_marker(ctx) - Read a JPG file's marker segment
  *
  *  Format: 2 byte id + optional 2 byte length ... data
  *
  *  Returns: 1 if ok, 0 if end of JPG, -1 if corrupt
  */
 
-static int read_marker(FILE *fp)
+static int read_marker(imginf_ctx *ctx)
 {
     unsigned char buf[4];
     int clen, ret, id;
 
-    if (fread(buf, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, buf, 2))
         return -1;
 
     if (buf[0] != 0xFF)
@@ -703,7 +607,7 @@ static int read_marker(FILE *fp)
     {
         /* 0xFF is fill padding, keep chucking it away... */
 
-        if ((ret = getc(fp)) < 0)
+        if ((ret = imginf_getc(ctx)) < 0)
             return -1;
         buf[1] = ret;
     }
@@ -719,7 +623,7 @@ static int read_marker(FILE *fp)
 
     /* Read the 2 byte content length, big endian */
 
-    if (fread(buf, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, buf, 2))
         return -1;
 
     clen = strbe_to_word(buf) - 2;
@@ -731,19 +635,19 @@ static int read_marker(FILE *fp)
 
     if (id >= 0xC0 && id <= 0xC3)   /* SOF */
     {
-        ret = read_sofx(fp, clen);
+        ret = read_sofx(ctx, clen);
     }
     else if (id == 0xe0)            /* APP0 */
     {
-        ret = read_app0(fp, clen);
+        ret = read_app0(ctx, clen);
     }
     else if (id == 0xe1)            /* APP1 */
     {
-        ret = read_app1(fp, clen);
+        ret = read_app1(ctx, clen);
     }
     else
     {
-        if (!fp_move_forward(fp, clen))
+        if (!imginf_skip(ctx, clen))
             return -1;
     }
 
@@ -757,124 +661,45 @@ static int read_marker(FILE *fp)
 
 
 /*
- *  process_image_jpg(fname, isverbose) - Process a JPG file
+ *  parse_jpg(ctx) - Parse a JPG file into ctx->res
  *
  *  Returns: 0 on success
- *           1 on open failure
  *           2 if not a JPG file
  *           3 if a JPG file but corrupt
  */
 
-int process_image_jpg(const char *fname)
+int parse_jpg(imginf_ctx *ctx)
 {
     unsigned char jpgsoi[2];
-    FILE *fp;
     int ret;
 
-    if (g_verbose)
-        printf("[ %s ]\n", fname);
-
-    fp = fopen(fname, "rb");
-    if (fp == NULL)
-    {
-        if (g_verbose)
-            printf("\tError: Cannot open file\n");
-        return 1;
-    }
-
-    if (fread(jpgsoi, 1, 2, fp) != 2)
+    if (!imginf_get(ctx, jpgsoi, 2))
     {
-        if (g_verbose)
-            printf("\tError: File is not a JPG file\n");
-
-        fclose(fp);
+        ctx->res->error = IMGINF_E_NOTJPG;
         return 2;
     }
 
     if (jpgsoi[0] != 0xff || jpgsoi[1] != 0xd8)
     {
-        if (g_verbose)
-            printf("\tError: File is not a JPEG file\n");
-
-        fclose(fp);
+        ctx->res->error = IMGINF_E_NOTJPEG;
         return 2;
     }
 
-    memset(&jpginf, 0, sizeof(jpginf));
-
     do {
-        if ((ret = read_marker(fp)) < 0)
+        if ((ret = read_marker(ctx)) < 0)
         {
-            if (g_verbose)
-                printf("\tError: File is corrupt in some way\n");
-
-            fclose(fp);
+            ctx->res->error = IMGINF_E_CORRUPT;
             return 3;
         }
 
     } while (ret);
 
-    fclose(fp);
-
 
-    if (jpginf.width == 0 || jpginf.height == 0)
+    if (ctx->res->width == 0 || ctx->res->height == 0)
     {
-        if (g_verbose)
-            printf("No Frame information. File is not valid\n");
+        ctx->res->error = IMGINF_E_NOFRAME;
         return 3;
     }
 
-
-    if (g_verbose)
-    {
-        printf("\n\n");
-    }
-    else
-    {
-        printf("J  %5u   %5u   %2u    ",
-                jpginf.width, jpginf.height, jpginf.depth);
-
-        printf("    ");         /* No colortype. Just no! */
-
-        /* Prioritise JFIF information. I have to pick one! */
-
-        if (jpginf.den_x)
-        {
-            jpginf.res_x = jpginf.den_x;
-            jpginf.res_y = jpginf.den_y;
-            jpginf.res_unit = jpginf.den_unit;
-        }
-
-        if (jpginf.res_x)
-        {
-            if (jpginf.res_unit == 1)       /* Inch */
-            {
-                printf("  %5u  %3.0f x %3.0f  ",
-                    jpginf.res_x,
-                    ((double)jpginf.width / (double)jpginf.res_x) * 25.4,
-                    ((double)jpginf.height / (double)jpginf.res_x) * 25.4);
-            }
-
-            else if (jpginf.res_unit == 2)  /* cm */
-            {
-                printf("  %5.0f  %3.0f x %3.0f  ",
-                    (double)jpginf.res_x * 2.54,
-                    ((double)jpginf.width / (double)jpginf.res_x) * 10,
-                    ((double)jpginf.height / (double)jpginf.res_x) * 10);
-            }
-
-            else
-            {
-                printf("                    ");
-            }
-        }
-
-        if (strlen(fname) >= 30)
-            printf("%.26s...\n", fname);
-        else
-            printf("%s\n", fname);
-    }
-
     return 0;
 }
-
@@ -1,10 +1,10 @@
 @echo off
 setlocal
 
-set gccinps=imginf.c ggetopt.c jpginf.c exif.c pnginf.c
+set gccinps=imginf.c ggetopt.c imgparse.c imgprint.c imgpool.c imgwalk.c jpginf.c exif.c pnginf.c
 set gccopts=-Wall -mconsole -O2
 set gccdefs=-DWINVER=0x0500 -D_WIN32_WINNT=0x500
-set gcclibs=
+set gcclibs=-lpthread
 set gccexec=imginf.exe
 
 echo Compiling %gccexec%
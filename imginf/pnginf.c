@@ -1,5 +1,5 @@
 /*
- *  Dump out png information
+ *  Parse png information
  *
  *  Distribution and use of this software are as per the terms of the
  *  Simplified BSD License (also known as the "2-Clause License")
@@ -26,69 +26,45 @@ static const unsigned char png_sig[] = {
     0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
 };
 
-static struct {
-
-    unsigned int width;
-    unsigned int height;
-    unsigned char depth;
-    unsigned char colortype;
-
-    unsigned int ppu_x, ppu_y;
-    unsigned int dpi_x, dpi_y;
-    unsigned int mm_x, mm_y;
-    unsigned char ppu_spec;
-
-} pnginf;
-
 
 
 
 /*
- *  read_ihdr(fp) - Read a PNG IHDR
+ *  read_ihdr(ctx, clen) - Read a PNG IHDR
  *
  *  Returns 1 if ok, 0 if corrupt
  */
 
-static int read_ihdr(FILE *fp, int clen)
+static int read_ihdr(imginf_ctx *ctx, int clen)
 {
+    imginf_result *res = ctx->res;
+    imginf_item *item;
     unsigned char buf[13];
 
-    if (pnginf.width)
+    if (res->width)
         return 0;
 
     if (clen != 13)
         return 0;
 
-    if (fread(buf, 1, 13, fp) != 13)
+    if (!imginf_get(ctx, buf, 13))
         return 0;
 
-    pnginf.width = str_to_dword(buf, 0);
-    pnginf.height = str_to_dword(buf + 4, 0);
-    pnginf.depth = buf[8];
-    pnginf.colortype = buf[9];
+    res->width = str_to_dword(buf, 0);
+    res->height = str_to_dword(buf + 4, 0);
+    res->depth = buf[8];
+    res->colortype = buf[9];
 
-    if (pnginf.width == 0 || pnginf.height == 0 || pnginf.depth == 0)
+    if (res->width == 0 || res->height == 0 || res->depth == 0)
         return 0;
 
-    if (!g_verbose)
-        return 1;
-
-    printf("    Width x Height: %u x %u\n", pnginf.width, pnginf.height);
-    printf("    Bit depth: %u\n", pnginf.depth);
-
-    printf("    Color type: ");
-
-    switch (pnginf.colortype)
-    {
-        case 0: printf("grayscale\n");          break;
-        case 2: printf("RGB\n");                break;
-        case 3: printf("palette\n");            break;
-        case 4: printf("grayscale + alpha\n");  break;
-        case 6: printf("RGB + alpha\n");        break;
-        default:
-                printf("Unknown!\n");
-    }
+    if ((item = imginf_add(ctx, IMGINF_ITEM_IHDR)) == NULL)
+        return 0;
 
+    item->val[0] = res->width;
+    item->val[1] = res->height;
+    item->val[2] = res->depth;
+    item->val[3] = res->colortype;
     return 1;
 }
 
@@ -96,55 +72,53 @@ static int read_ihdr(FILE *fp, int clen)
 
 
 /*
- *  read_phys(fp) - Read a PNG pHYs
+ *  read_phys(ctx, clen) - Read a PNG pHYs
  *
  *  Returns 1 if ok, 0 if corrupt
  */
 
-static int read_phys(FILE *fp, int clen)
+static int read_phys(imginf_ctx *ctx, int clen)
 {
+    imginf_result *res = ctx->res;
+    imginf_item *item;
     unsigned char buf[9];
 
     if (clen != 9)
         return 0;
 
-    if (fread(buf, 1, 9, fp) != 9)
+    if (!imginf_get(ctx, buf, 9))
         return 0;
 
-    pnginf.ppu_x = str_to_dword(buf, 0);
-    pnginf.ppu_y = str_to_dword(buf + 4, 0);
-    pnginf.ppu_spec = buf[8];
+    res->ppu_x = str_to_dword(buf, 0);
+    res->ppu_y = str_to_dword(buf + 4, 0);
+    res->ppu_spec = buf[8];
 
-    if (pnginf.ppu_spec)
+    if (res->ppu_spec)
     {
         /* 1 Inch = 0.0254 meters */
 
-        pnginf.dpi_x = ((pnginf.ppu_x * 254) / 1000) + 5;
-        pnginf.dpi_x /= 10;
+        res->dpi_x = ((res->ppu_x * 254) / 1000) + 5;
+        res->dpi_x /= 10;
 
-        pnginf.dpi_y = ((pnginf.ppu_y * 254) / 1000) + 5;
-        pnginf.dpi_y /= 10;
+        res->dpi_y = ((res->ppu_y * 254) / 1000) + 5;
+        res->dpi_y /= 10;
 
-        pnginf.mm_x = ((pnginf.width * 10000) / pnginf.ppu_x) + 5;
-        pnginf.mm_x /= 10;
-        pnginf.mm_y = ((pnginf.height * 10000) / pnginf.ppu_y) + 5;
-        pnginf.mm_y /= 10;
+        res->mm_x = ((res->width * 10000) / res->ppu_x) + 5;
+        res->mm_x /= 10;
+        res->mm_y = ((res->height * 10000) / res->ppu_y) + 5;
+        res->mm_y /= 10;
     }
 
-    if (!g_verbose)
-        return 1;
-
-    if (!pnginf.ppu_spec)
-    {
-        printf("    Pixels per unit: %u x %u\n", pnginf.ppu_x, pnginf.ppu_y);
-    }
-    else
-    {
-        printf("    Pixels per metre: %u x %u\n", pnginf.ppu_x, pnginf.ppu_y);
-        printf("    Pixels per inch: %u x %u\n", pnginf.dpi_x, pnginf.dpi_y);
-        printf("    Printed size (mm): %u x %u\n", pnginf.mm_x, pnginf.mm_y);
-    }
+    if ((item = imginf_add(ctx, IMGINF_ITEM_PHYS)) == NULL)
+        return 0;
 
+    item->val[0] = res->ppu_x;
+    item->val[1] = res->ppu_y;
+    item->val[2] = res->ppu_spec;
+    item->val[3] = res->dpi_x;
+    item->val[4] = res->dpi_y;
+    item->val[5] = res->mm_x;
+    item->val[6] = res->mm_y;
     return 1;
 }
 
@@ -152,74 +126,37 @@ static int read_phys(FILE *fp, int clen)
 
 
 /*
- *  read_text(fp) - Read a PNG tEXt
+ *  read_text(ctx, clen) - Read a PNG tEXt
+ *
+ *  A key, a NUL, then the rest of the chunk is the value. If the file
+ *  runs out part way, the item is kept (marked partial) with what there
+ *  was, as that still gets shown.
  *
  *  Returns 1 if ok, 0 if corrupt
  */
 
-static int read_text(FILE *fp, int clen)
+static int read_text(imginf_ctx *ctx, int clen)
 {
-    int ch, avail;
+    imginf_item *item;
+    int ret;
 
-    printf("    \"");
-    avail = 60;
+    if ((item = imginf_add(ctx, IMGINF_ITEM_TEXT)) == NULL)
+        return 0;
 
-    while (clen)
+    ret = imginf_read_str(ctx, &item->str, &item->len, clen, 1);
+    if (ret < 0)
     {
-        clen--;
-        if ((ch = getc(fp)) < 0)
-            return 0;
-
-        if (!ch)
-            break;
-
-        if (avail)
-        {
-            if (isprint(ch))
-                printf("%c", ch);
-            else
-                printf("?");
-            if (!--avail)
-                printf(" ... ");
-        }
+        item->partial = 1;
+        return 0;
     }
 
-    if ( (clen && avail >= clen) || (!clen && avail >= 10) )
-        printf("\" = ");
-    else
-        printf("\" = \n        ");
+    clen -= item->len + ret;
+    item->valuemax = clen;
 
-    if (!clen)
+    if (imginf_read_str(ctx, &item->value, &item->valuelen, clen, 0) < 0)
     {
-        printf("(no value)");
-    }
-    else
-    {
-        printf("\"");
-
-        avail = 60;
-
-        while (clen--)
-        {
-            if ((ch = getc(fp)) < 0)
-                return 0;
-
-            if (ch == '\n')
-                printf("\n        ");
-            else if (isprint(ch))
-                printf("%c", ch);
-            else
-                printf("?");
-
-            if (!--avail)
-            {
-                avail = 60;
-                if (ch != '\n')
-                    printf("\n        ");
-            }
-        }
-
-        printf("\"\n");
+        item->partial = 1;
+        return 0;
     }
 
     return 1;
@@ -229,21 +166,21 @@ static int read_text(FILE *fp, int clen)
 
 
 /*
- *  read_chunk(fp) - Read a PNG file's "chunk"
+ *  read_chunk(ctx) - Read a PNG file's "chunk"
  *
  *  Format: 4 byte length, 4 byte code, data, CRC32
  *
  *  Returns 1 if ok, 0 if end of PNG, -1 if corrupt
  */
 
-static int read_chunk(FILE *fp)
+static int read_chunk(imginf_ctx *ctx)
 {
     unsigned char buf[9];
     unsigned int chunklen;
     char *ccode;
     int i;
 
-    if (fread(buf, 1, 8, fp) != 8)
+    if (!imginf_get(ctx, buf, 8))
         return -1;
 
     chunklen = str_to_dword(buf, 0);
@@ -262,7 +199,7 @@ static int read_chunk(FILE *fp)
 
     /* First chunk must be ihdr */
 
-    if (!pnginf.width && strcmp(ccode, "IHDR") != 0)
+    if (!ctx->res->width && strcmp(ccode, "IHDR") != 0)
         return -1;
 
     i = 4;  /* CRC at end is 4 bytes */
@@ -274,17 +211,17 @@ static int read_chunk(FILE *fp)
     }
     else if (strcmp(ccode, "IHDR") == 0)
     {
-        if (!read_ihdr(fp, chunklen))
+        if (!read_ihdr(ctx, chunklen))
             return -1;
     }
     else if (strcmp(ccode, "pHYs") == 0)
     {
-        if (!read_phys(fp, chunklen))
+        if (!read_phys(ctx, chunklen))
             return -1;
     }
-    else if (strcmp(ccode, "tEXt") == 0 && g_verbose)
+    else if (strcmp(ccode, "tEXt") == 0 && (ctx->flags & IMGINF_DETAIL))
     {
-        if (!read_text(fp, chunklen))
+        if (!read_text(ctx, chunklen))
             return -1;
     }
     else
@@ -295,7 +232,7 @@ static int read_chunk(FILE *fp)
 
     /* Read the CRC if handled or skip forward... */
 
-    if (!fp_move_forward(fp, i))
+    if (!imginf_skip(ctx, i))
         return -1;
 
     return 1;
@@ -305,39 +242,23 @@ static int read_chunk(FILE *fp)
 
 
 /*
- *  process_image_png(fname, isverbose) - Process a PNG file
+ *  parse_png(ctx) - Parse a PNG file into ctx->res
  *
  *  Byte order is MSB first.
  *
  *  Returns: 0 on success
- *           1 on open failure
  *           2 if not a PNG file
  *           3 if a PNG file but corrupt
  */
 
-int process_image_png(const char *fname)
+int parse_png(imginf_ctx *ctx)
 {
     unsigned char pngheader[8];
-    FILE *fp;
     int ret, i;
 
-    if (g_verbose)
-        printf("[ %s ]\n\n", fname);
-
-    fp = fopen(fname, "rb");
-    if (fp == NULL)
-    {
-        if (g_verbose)
-            printf("\tError: Cannot open file\n");
-        return 1;
-    }
-
-    if (fread(pngheader, 1, 8, fp) != 8)
+    if (!imginf_get(ctx, pngheader, 8))
     {
-        if (g_verbose)
-            printf("\tError: File is not a PNG file\n");
-
-        fclose(fp);
+        ctx->res->error = IMGINF_E_NOTPNG;
         return 2;
     }
 
@@ -345,67 +266,21 @@ int process_image_png(const char *fname)
     {
         if (pngheader[i] != png_sig[i])
         {
-            if (g_verbose)
-                printf("\tError: File is not a PNG file\n");
-
-            fclose(fp);
+            ctx->res->error = IMGINF_E_NOTPNG;
             return 2;
         }
     }
 
-    memset(&pnginf, 0, sizeof(pnginf));
-
     do {
-        ret = read_chunk(fp);
+        ret = read_chunk(ctx);
 
         if (ret < 0)
         {
-            if (g_verbose)
-                printf("\tError: File is corrupt in some way\n");
-
-            fclose(fp);
+            ctx->res->error = IMGINF_E_CORRUPT;
             return 3;
         }
 
     } while (ret);
 
-    fclose(fp);
-
-    if (g_verbose)
-    {
-        printf("\n\n");
-    }
-    else
-    {
-        printf("P  %5u   %5u   %2u    ",
-                pnginf.width, pnginf.height, pnginf.depth);
-
-        switch (pnginf.colortype)
-        {
-            case 0: printf("gry "); break;
-            case 2: printf("RGB "); break;
-            case 3: printf("palt"); break;
-            case 4: printf("gryA"); break;
-            case 6: printf("RGBA"); break;
-            default:printf("Unkn");
-        }
-
-        if (pnginf.ppu_spec)
-        {
-            printf("  %5u  %3u x %3u  ",
-                   pnginf.dpi_x, pnginf.mm_x, pnginf.mm_y);
-        }
-        else
-        {
-            printf("                    ");
-        }
-
-        if (strlen(fname) >= 30)
-            printf("%.26s...\n", fname);
-        else
-            printf("%s\n", fname);
-    }
-
     return 0;
 }
-